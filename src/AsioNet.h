@@ -3,4 +3,5 @@
 #include "event/EventDriver.h"
 #include "event/IEventPoller.h"
 #include "tcp/TcpNetMgr.h"
-#include "kcp/KcpNetMgr.h"
\ No newline at end of file
+#include "kcp/KcpNetMgr.h"
+#include "shm/ShmNetMgr.h"
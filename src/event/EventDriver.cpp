@@ -1,9 +1,10 @@
 #include "./EventDriver.h"
 #include "../utils/utils.h"
+#include "../utils/Compress.h"
 
 namespace AsioNet
 {
-	EventDriver::EventDriver()
+	EventDriver::EventDriver() :m_zipDepth(0)
 	{
 		m_handler[static_cast<int>(EventType::Accept)] = std::function(
 			[](NetKey, std::string, uint16_t)->void {});
@@ -49,6 +50,26 @@ namespace AsioNet
 		m_recvBuffer.Push(data, trans);
 	}
 
+	void EventDriver::PushRecvBatch(NetKey k, const RecvMsg* msgs, size_t n)
+	{
+		_lock_guard_(m_lock);
+		for (size_t i = 0; i < n; i++)
+		{
+			m_events.push(NetEvent{
+				k,EventType::Recv
+				});
+			m_recvBuffer.Push(msgs[i].data, msgs[i].len);
+		}
+	}
+
+	void EventDriver::PushError(NetKey k, EventErrCode ec)
+	{
+		_lock_guard_(m_lock);
+		m_events.push(NetEvent{
+			k,EventType::Error,"",0,ec
+			});
+	}
+
 	// 注意：这是单线程处理消息
 	bool EventDriver::RunOne()
 	{
@@ -63,28 +84,7 @@ namespace AsioNet
 		{
 			// 以效率最高的方式获取数据，减少拷贝
 			auto [data, len] = m_recvBuffer.PopUnsafe();
-
-			Package pkg;
-			if (!pkg.Unpack(data, len)) {
-				m_errHandler(e.key, EventErrCode::RECV_ERR);
-				break;
-			}
-
-			auto itr = m_routers.find(pkg.GetMsgID());
-			if (itr != m_routers.end())
-			{
-				auto& caller = itr->second;
-				EventErrCode ec = (this->*(caller.func))(caller.user,e.key, pkg);
-				if (ec != EventErrCode::SUCCESS)
-				{
-					m_errHandler(e.key, ec);
-				}
-			}
-			else
-			{
-				m_errHandler(e.key, EventErrCode::UNKNOWN_MSG_ID);
-			}
-
+			dispatch(e.key, data, len);
 			break;
 		}
 		case EventType::Accept:
@@ -102,8 +102,103 @@ namespace AsioNet
 			m_handler[static_cast<int>(EventType::Disconnect)](e.key, e.ip, e.port);
 			break;
 		}
+		case EventType::Error:
+		{
+			m_errHandler(e.key, e.ec);
+			break;
+		}
 		}
 		m_events.pop();
 		return true;
 	}
+
+	void EventDriver::dispatch(NetKey key, char* data, size_t len)
+	{
+		Package pkg;
+		if (!pkg.Unpack(data, len)) {
+			m_errHandler(key, EventErrCode::RECV_ERR);
+			return;
+		}
+
+		// 合包不会被压缩，压缩过的合包是对端构造的，接收限速数不出里面的子消息，不分发
+		if ((pkg.GetFlag() & AN_MSG_FLAG_COMPRESSED) && (pkg.GetFlag() & AN_MSG_FLAG_BUNDLE)) {
+			m_errHandler(key, EventErrCode::RECV_ERR);
+			return;
+		}
+
+		if (pkg.GetFlag() & AN_MSG_FLAG_COMPRESSED) {
+			decompress(key, data, len);
+			return;
+		}
+
+		if (pkg.GetFlag() & AN_MSG_FLAG_BUNDLE) {
+			unbundle(key, data + sizeof(AN_MsgHead), len - sizeof(AN_MsgHead));
+			return;
+		}
+
+		auto itr = m_routers.find(pkg.GetMsgID());
+		if (itr != m_routers.end())
+		{
+			auto& caller = itr->second;
+			EventErrCode ec = (this->*(caller.func))(caller.user,key, pkg);
+			if (ec != EventErrCode::SUCCESS)
+			{
+				m_errHandler(key, ec);
+			}
+		}
+		else
+		{
+			m_errHandler(key, EventErrCode::UNKNOWN_MSG_ID);
+		}
+	}
+
+	void EventDriver::decompress(NetKey key, char* data, size_t len)
+	{
+		if (m_zipDepth == m_zipBuffers.size()) {
+			m_zipBuffers.emplace_back(new char[AN_MSG_MAX_SIZE]);
+		}
+		char* buf = m_zipBuffers[m_zipDepth].get();
+
+		size_t n = DecompressMsg(data, len, buf, AN_MSG_MAX_SIZE);
+		if (!n) {
+			m_errHandler(key, EventErrCode::DECOMPRESS_ERR);
+			return;
+		}
+
+		++m_zipDepth;
+		dispatch(key, buf, n);
+		--m_zipDepth;
+	}
+
+	void EventDriver::unbundle(NetKey key, char* data, size_t len)
+	{
+		// 一个合包只占一个NetEvent，子消息在这里一次性分发完
+		while (len)
+		{
+			decltype(AN_Msg::len) netLen = 0;
+			if (len < sizeof(AN_Msg::len)) {
+				m_errHandler(key, EventErrCode::RECV_ERR);
+				return;
+			}
+			memcpy(&netLen, data, sizeof(AN_Msg::len));
+			size_t subLen = asio::detail::socket_ops::network_to_host_short(netLen);
+			data += sizeof(AN_Msg::len);
+			len -= sizeof(AN_Msg::len);
+			if (subLen > len) {
+				m_errHandler(key, EventErrCode::RECV_ERR);
+				return;
+			}
+
+			Package sub;
+			if (!sub.Unpack(data, subLen) || (sub.GetFlag() & AN_MSG_FLAG_BUNDLE)) {
+				// 不允许嵌套
+				m_errHandler(key, EventErrCode::RECV_ERR);
+			}
+			else {
+				dispatch(key, data, subLen);
+			}
+			data += subLen;
+			len -= subLen;
+		}
+	}
 }
\ No newline at end of file
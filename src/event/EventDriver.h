@@ -11,17 +11,11 @@
 #include <unordered_map>
 #include <type_traits>
 #include <functional>
+#include <memory>
+#include <vector>
 
 namespace AsioNet
 {
-	enum class EventErrCode
-	{
-		SUCCESS,
-		RECV_ERR,
-		UNKNOWN_MSG_ID,
-		PRASE_PB_ERR,
-	};
-
 	template<class HANDLER, class ...Args>
 	constexpr bool check_functor_v =
 		std::is_object_v<HANDLER> && std::is_invocable_v<HANDLER, Args...>;
@@ -32,10 +26,10 @@ namespace AsioNet
 
 	using GooglePbLite = google::protobuf::MessageLite;
 
-	// EventDriverҵ߼Ӧǿ
+	// EventDriver和业务逻辑应该是强关联的
 	class EventDriver final: public IEventPoller
 	{
-		// ڲʹ
+		// 内部使用类
 		enum class EventType
 		{
 			Accept = 0,
@@ -51,6 +45,7 @@ namespace AsioNet
 			EventType type;
 			std::string ip;
 			uint16_t port;
+			EventErrCode ec;
 		};
 
 		class Package {
@@ -83,12 +78,12 @@ namespace AsioNet
 		template<typename HANDLER, typename PB>
 		EventErrCode wrapped_event_handler(void* user,NetKey key, const Package& pkg)
 		{
-			// ģ
+			// 模板参数检查
 			static_assert(std::is_base_of_v<GooglePbLite, PB>, "not a protobuf");
 			static_assert(check_functor_v<HANDLER, void*,NetKey, const PB&>,
 				"functor need && token is: void(NetKey,const GooglePbLite&)");
 
-			// Э鶼ҪĲ
+			// 对所有协议都需要的操作请在这里操作
 			PB pb;
 			if (!pb.ParseFromArray(pkg.GetData(), pkg.GetDataLen()))
 			{
@@ -100,23 +95,35 @@ namespace AsioNet
 			return EventErrCode::SUCCESS;
 		}
 
+		template<typename HANDLER>
+		EventErrCode wrapped_raw_handler(void* user, NetKey key, const Package& pkg)
+		{
+			static_assert(check_functor_v<HANDLER, void*, NetKey, const char*, size_t>,
+				"functor need && token is: void(void*,NetKey,const char*,size_t)");
+
+			HANDLER{}(user, key, pkg.GetData(), pkg.GetDataLen());
+			return EventErrCode::SUCCESS;
+		}
+
 	public:
 		EventDriver();
 		~EventDriver() override;
 
-		// νӵײĽӿ
+		// 衔接底层的接口
 		void PushAccept(NetKey k, const std::string& ip, uint16_t port) override;
 		void PushConnect(NetKey k, const std::string& ip, uint16_t port) override;
 		void PushDisconnect(NetKey k, const std::string& ip, uint16_t port) override;
 		void PushRecv(NetKey k, const char* data, size_t trans) override;
+		void PushError(NetKey k, EventErrCode ec) override;
+		void PushRecvBatch(NetKey k, const RecvMsg* msgs, size_t n) override;
 
-		// ȡһEventضĴ
+		// 取出一个Event并交给特定的处理器
 		bool RunOne();
 
 		/*
-		// 1.ĬϹ캯
-		// 2.ǩ
-		// 3.Ƿº
+		// 1.必须有默认构造函数
+		// 2.函数签名如下
+		// 3.必须是仿函数
 		class DemoHandler{
 		public:
 			void operator()(NetKey ne,const PB& pb){}
@@ -129,8 +136,19 @@ namespace AsioNet
 			caller.func = &EventDriver::wrapped_event_handler<HANDLER,PB>;
 			caller.user = user;
 			m_routers[msgID] = caller;
-			// Ҳʹlambda + functionʵָù
-			// ΪЧʣԼʵһ
+			// 你也可以使用lambda + function实现该功能
+			// 我这里为了效率，决定自己实现一个极简版的
+		}
+
+		// 不经过protobuf解析，直接拿到data，比如SendFile发过来的文件块
+		// 函数签名：void operator()(void* user,NetKey,const char* data,size_t len)
+		template<typename HANDLER>
+		void AddRawRouter(void* user, uint16_t msgID)
+		{
+			EventCaller caller;
+			caller.func = &EventDriver::wrapped_raw_handler<HANDLER>;
+			caller.user = user;
+			m_routers[msgID] = caller;
 		}
 
 		template<typename HANDLER>
@@ -178,10 +196,21 @@ namespace AsioNet
 		}
 
 	private:
+		// 把一个消息交给router
+		void dispatch(NetKey key, char* data, size_t len);
+		// 合包：依次拆出子消息，交给dispatch
+		void unbundle(NetKey key, char* data, size_t len);
+		// 解压到池子里的缓冲区，再交给dispatch
+		void decompress(NetKey key, char* data, size_t len);
+
 		std::mutex m_lock;
 		std::queue<NetEvent> m_events;
 		BlockBuffer<AN_MSG_MAX_SIZE, 2> m_recvBuffer;
 
+		// 解压用的缓冲区，分发是单线程的，按嵌套深度复用(合包里的子消息也可能是压缩的)
+		std::vector<std::unique_ptr<char[]>> m_zipBuffers;
+		size_t m_zipDepth;
+
 		struct EventCaller{
 			EventCaller():func(nullptr),user(nullptr){}
 			EventErrCode(EventDriver::*func)(void* user,NetKey, const Package&);
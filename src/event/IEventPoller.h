@@ -3,13 +3,40 @@
 
 namespace AsioNet
 {
+	enum class EventErrCode
+	{
+		SUCCESS,
+		RECV_ERR,
+		UNKNOWN_MSG_ID,
+		PRASE_PB_ERR,
+		SEND_QUEUE_FULL,	// 发送队列超过高水位
+		DECOMPRESS_ERR,		// 解压失败
+		RATE_LIMITED,		// 接收超过了限速，见RecvLimitOption
+	};
+
+	// PushRecvBatch里的一条消息
+	struct RecvMsg
+	{
+		const char* data;
+		size_t len;
+	};
+
     struct IEventPoller
 	{
 		virtual void PushAccept(NetKey k,const std::string& ip,uint16_t port) = 0;
 		virtual void PushConnect(NetKey k, const std::string& ip, uint16_t port) = 0;
 		virtual void PushDisconnect(NetKey k, const std::string& ip, uint16_t port) = 0;
 		virtual void PushRecv(NetKey k, const char *data, size_t trans) = 0;
+		virtual void PushError(NetKey k, EventErrCode ec) = 0;
+
+		// 同一个连接一次收到的多条消息，按顺序；默认逐条PushRecv，加锁的poller可以重写成一批只拿一次锁
+		virtual void PushRecvBatch(NetKey k, const RecvMsg* msgs, size_t n)
+		{
+			for (size_t i = 0; i < n; i++) {
+				PushRecv(k, msgs[i].data, msgs[i].len);
+			}
+		}
 
 		virtual ~IEventPoller(){}
 	};
-}
\ No newline at end of file
+}
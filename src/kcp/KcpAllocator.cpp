@@ -0,0 +1,316 @@
+#include "KcpAllocator.h"
+#include "../utils/AsioNetDef.h"
+#include "../utils/MemPool.h"
+
+#include <ikcp.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace AsioNet
+{
+	// 每块前面16字节的头，记录规格，保证返回的地址16字节对齐
+	// 空闲的块头部放链表指针
+	struct alignas(16) KcpChunkHead {
+		uint32_t cls;
+		uint32_t pad;
+		uint64_t size;		// 只有大块用
+	};
+	static constexpr size_t HEAD = sizeof(KcpChunkHead);
+	static constexpr uint32_t LARGE = 0xff;
+
+	// 块大小(包括头)，分片是IKCPSEG(64字节左右) + mss，默认mtu下落在1536
+	static constexpr size_t CLASS_SIZE[] = { 128, 256, 512, 1024, 1536, 2048 };
+	static constexpr size_t CLASS_NUM = sizeof(CLASS_SIZE) / sizeof(CLASS_SIZE[0]);
+
+	static constexpr size_t BATCH = 32;			// 和全局池之间一次搬多少块
+	static constexpr size_t CACHE_MAX = 128;	// 线程缓存每个规格最多留多少块
+
+	template<size_t N>
+	struct KcpChunk {
+		alignas(16) char data[N];
+	};
+
+	// 一个规格的全局池
+	struct IChunkPool {
+		virtual void Fetch(char** out, size_t n) = 0;
+		virtual void Release(char* const* in, size_t n) = 0;
+		virtual size_t Resident() = 0;
+		virtual ~IChunkPool() {}
+	};
+
+	template<size_t N>
+	class ChunkPool : public IChunkPool {
+		using Chunk = KcpChunk<N>;
+	public:
+		// 一次向系统申请64KB左右
+		ChunkPool() :m_pool(N < 4096 ? 64 * 1024 / N : 16) {}
+		void Fetch(char** out, size_t n) override
+		{
+			m_pool.NewBatch(reinterpret_cast<Chunk**>(out), n);
+		}
+		void Release(char* const* in, size_t n) override
+		{
+			m_pool.DelBatch(reinterpret_cast<Chunk* const*>(in), n);
+		}
+		size_t Resident() override
+		{
+			return m_pool.Capacity() * N;
+		}
+	private:
+		MemPool<Chunk> m_pool;
+	};
+
+	template<size_t... I>
+	static IChunkPool** makePools(std::index_sequence<I...>)
+	{
+		static IChunkPool* pools[] = { new ChunkPool<CLASS_SIZE[I]>()... };
+		return pools;
+	}
+
+	// 故意不析构，进程退出的时候还可能有别的静态对象里的kcp在释放
+	static IChunkPool* pool(size_t cls)
+	{
+		static IChunkPool** pools = makePools(std::make_index_sequence<CLASS_NUM>{});
+		return pools[cls];
+	}
+
+	static int classOf(size_t size)
+	{
+		for (size_t i = 0; i < CLASS_NUM; i++)
+		{
+			if (size <= CLASS_SIZE[i]) {
+				return static_cast<int>(i);
+			}
+		}
+		return -1;
+	}
+
+	// ******************** 线程缓存 ********************
+	class ThreadCache;
+	struct Registry {
+		std::mutex lock;
+		std::vector<ThreadCache*> caches;
+		// 已经退出的线程的统计
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		std::atomic<uint64_t> large{ 0 };
+		std::atomic<size_t> largeBytes{ 0 };
+	};
+
+	static Registry& registry()
+	{
+		static Registry* r = new Registry();
+		return *r;
+	}
+
+	class ThreadCache {
+		struct FreeList {
+			char* head = nullptr;
+			size_t num = 0;
+		};
+	public:
+		ThreadCache()
+		{
+			auto& r = registry();
+			_lock_guard_(r.lock);
+			r.caches.push_back(this);
+		}
+
+		~ThreadCache()
+		{
+			char* chunks[CACHE_MAX + 1];
+			for (size_t c = 0; c < CLASS_NUM; c++) {
+				while (m_lists[c].num)
+				{
+					size_t n = take(c, chunks, CACHE_MAX + 1);
+					pool(c)->Release(chunks, n);
+				}
+			}
+			auto& r = registry();
+			_lock_guard_(r.lock);
+			r.hits += m_hits.load(std::memory_order_relaxed);
+			r.misses += m_misses.load(std::memory_order_relaxed);
+			for (auto itr = r.caches.begin(); itr != r.caches.end(); ++itr)
+			{
+				if (*itr == this)
+				{
+					r.caches.erase(itr);
+					break;
+				}
+			}
+		}
+
+		char* Pop(size_t c)
+		{
+			FreeList& l = m_lists[c];
+			if (!l.head)
+			{
+				char* chunks[BATCH];
+				pool(c)->Fetch(chunks, BATCH);
+				for (size_t i = 0; i < BATCH; i++) {
+					push(c, chunks[i]);
+				}
+				inc(m_misses);
+			}
+			else {
+				inc(m_hits);
+			}
+			char* p = l.head;
+			l.head = *reinterpret_cast<char**>(p);
+			l.num--;
+			return p;
+		}
+
+		void Push(size_t c, char* p)
+		{
+			push(c, p);
+			if (m_lists[c].num > CACHE_MAX)
+			{
+				char* chunks[CACHE_MAX / 2];
+				size_t n = take(c, chunks, CACHE_MAX / 2);
+				pool(c)->Release(chunks, n);
+			}
+		}
+
+		uint64_t Hits() const { return m_hits.load(std::memory_order_relaxed); }
+		uint64_t Misses() const { return m_misses.load(std::memory_order_relaxed); }
+
+	private:
+		// 只有本线程写，不用原子的加法
+		static void inc(std::atomic<uint64_t>& v)
+		{
+			v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		}
+
+		void push(size_t c, char* p)
+		{
+			FreeList& l = m_lists[c];
+			*reinterpret_cast<char**>(p) = l.head;
+			l.head = p;
+			l.num++;
+		}
+
+		size_t take(size_t c, char** out, size_t n)
+		{
+			FreeList& l = m_lists[c];
+			size_t i = 0;
+			for (; i < n && l.head; i++)
+			{
+				out[i] = l.head;
+				l.head = *reinterpret_cast<char**>(l.head);
+				l.num--;
+			}
+			return i;
+		}
+
+		FreeList m_lists[CLASS_NUM];
+		std::atomic<uint64_t> m_hits{ 0 };
+		std::atomic<uint64_t> m_misses{ 0 };
+	};
+
+	// 线程退出的时候缓存已经析构了，之后的释放直接还给全局池
+	static thread_local bool t_cacheDead = false;
+
+	struct ThreadCacheHolder {
+		ThreadCache cache;
+		~ThreadCacheHolder() { t_cacheDead = true; }
+	};
+
+	static ThreadCache* localCache()
+	{
+		if (t_cacheDead) {
+			return nullptr;
+		}
+		thread_local ThreadCacheHolder holder;
+		return &holder.cache;
+	}
+
+	// ******************** KcpAllocator ********************
+	void KcpAllocator::Install()
+	{
+		static std::once_flag once;
+		std::call_once(once, [] {
+			ikcp_allocator(&KcpAllocator::Malloc, &KcpAllocator::Free);
+		});
+	}
+
+	void* KcpAllocator::Malloc(size_t size)
+	{
+		int c = classOf(size + HEAD);
+		char* p = nullptr;
+		if (c < 0)
+		{
+			p = static_cast<char*>(malloc(size + HEAD));
+			if (!p) {
+				return nullptr;
+			}
+			auto& r = registry();
+			r.large.fetch_add(1, std::memory_order_relaxed);
+			r.largeBytes.fetch_add(size + HEAD, std::memory_order_relaxed);
+			reinterpret_cast<KcpChunkHead*>(p)->cls = LARGE;
+			reinterpret_cast<KcpChunkHead*>(p)->size = size + HEAD;
+			return p + HEAD;
+		}
+
+		ThreadCache* t = localCache();
+		if (t) {
+			p = t->Pop(c);
+		}
+		else {
+			pool(c)->Fetch(&p, 1);
+		}
+		reinterpret_cast<KcpChunkHead*>(p)->cls = static_cast<uint32_t>(c);
+		return p + HEAD;
+	}
+
+	void KcpAllocator::Free(void* ptr)
+	{
+		if (!ptr) {
+			return;
+		}
+		char* p = static_cast<char*>(ptr) - HEAD;
+		auto head = reinterpret_cast<KcpChunkHead*>(p);
+		if (head->cls == LARGE)
+		{
+			registry().largeBytes.fetch_sub(head->size, std::memory_order_relaxed);
+			free(p);
+			return;
+		}
+
+		size_t c = head->cls;
+		ThreadCache* t = localCache();
+		if (t) {
+			t->Push(c, p);
+		}
+		else {
+			pool(c)->Release(&p, 1);
+		}
+	}
+
+	KcpAllocStats KcpAllocator::Stats()
+	{
+		KcpAllocStats s;
+		auto& r = registry();
+		{
+			_lock_guard_(r.lock);
+			s.hits = r.hits;
+			s.misses = r.misses;
+			for (auto c : r.caches)
+			{
+				s.hits += c->Hits();
+				s.misses += c->Misses();
+			}
+		}
+		s.large = r.large.load(std::memory_order_relaxed);
+		s.resident = r.largeBytes.load(std::memory_order_relaxed);
+		for (size_t c = 0; c < CLASS_NUM; c++) {
+			s.resident += pool(c)->Resident();
+		}
+		return s;
+	}
+}
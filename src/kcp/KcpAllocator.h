@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace AsioNet
+{
+	struct KcpAllocStats {
+		uint64_t hits = 0;		// 线程缓存里直接拿到
+		uint64_t misses = 0;	// 线程缓存空了，去全局池批量取
+		uint64_t large = 0;		// 超过最大规格，直接malloc
+		size_t resident = 0;	// 全局池向系统申请的字节数 + 还没释放的大块
+	};
+
+	// 接管ikcp的内存分配(ikcp_allocator)
+	// kcp每个分片(IKCPSEG + 数据)都要malloc/free一次，发送在业务线程，确认和释放在io线程，多线程下malloc的锁竞争很明显
+	// 按大小分几个规格，每个规格一个全局的MemPool，每个线程在前面有一层缓存，不加锁
+	// 缓存空了一次从全局池取一批，缓存太多了还一批回去，别的线程申请的块在这个线程释放也没问题
+	// 超过最大规格的(kcp控制块的缓冲区、acklist)直接malloc
+	// 全局池的内存不还给系统
+	class KcpAllocator
+	{
+	public:
+		// 要在创建第一个kcp之前调用，之后再调用没有效果
+		// 默认分配器malloc出来的块不能交给这里释放，反过来也一样，所以不提供换回去的接口
+		static void Install();
+
+		static void* Malloc(size_t size);
+		static void Free(void* p);
+
+		static KcpAllocStats Stats();
+	};
+}
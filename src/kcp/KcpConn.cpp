@@ -1,20 +1,24 @@
 #include "KcpConn.h"
 #include "../utils/utils.h"
+#include "../utils/Compress.h"
+
+#include <algorithm>
+#include <random>
 
 namespace AsioNet
 {
-	KcpConn::KcpConn(std::shared_ptr<UdpSock> sock,const UdpEndPoint& remote,IEventPoller* p,uint32_t conv) :
-		m_sock(sock),m_sender(remote),m_updater(sock->get_executor()), ptr_poller(p),m_conv(conv)
+	KcpConn::KcpConn(std::shared_ptr<UdpSock> sock,const UdpEndPoint& remote,IEventPoller* p) :
+		m_sock(sock),m_sender(remote), ptr_poller(p),m_conv(0)
 	{
 		m_mode = KcpConnMode::KCM_SERVER;
 		init();
-		initKcp();
 	}
 
 	KcpConn::KcpConn(io_ctx& ctx,IEventPoller* p):
-		m_updater(ctx), ptr_poller(p),m_conv(0)
+		m_sock(std::make_shared<UdpSock>(ctx)), ptr_poller(p),m_conv(0)
 	{
 		m_mode = KcpConnMode::KCM_CLIENT;
+		m_synTimer = std::make_unique<asio::steady_timer>(ctx);
 		init();
 	}
 
@@ -25,8 +29,11 @@ namespace AsioNet
 
 	void KcpConn::init()
 	{
-		m_key = GenNetKey();
+		// server的会话在Accept的时候由server给key
+		m_key = m_mode == KcpConnMode::KCM_CLIENT ? GenNetKey() : 0;
 		ptr_owner = nullptr;
+		ptr_scheduler = nullptr;
+		m_schedShard = 0;
 	}
 
 	void KcpConn::initKcp()
@@ -34,8 +41,13 @@ namespace AsioNet
 		assert(m_conv);
         m_kcp = ikcp_create(m_conv,this/*user*/);
 		m_kcp->output = &KcpConn::kcpOutPutFunc;	// ikcp_setoutput(m_kcp,&kcpOutPutFunc);
-		ikcp_nodelay(m_kcp, 1, 10, 2, 1);
-		ikcp_setmtu(m_kcp,IKCP_MTU);
+		if (m_fecData && m_fecParity && m_fecData + m_fecParity <= 255)
+		{
+			// 编码器的缓冲区按最大的mtu分配，之后SetProfile改小mtu也不用重建
+			m_fecEnc = std::make_unique<KcpFecEncoder>(m_conv, m_fecData, m_fecParity, IKCP_MTU);
+			m_fecDec = std::make_unique<KcpFecDecoder>(m_fecData, m_fecParity);
+		}
+		m_tuner.Reset(m_kcp, m_profile, m_adaptive, m_fecEnc ? static_cast<int>(AN_FEC_OVERHEAD) : 0);
 	}
 
 	bool KcpConn::Write(const char* data, size_t trans)
@@ -45,49 +57,213 @@ namespace AsioNet
 			return false;
 		}
 
-		// 只是将数据放到kcp的发送缓冲区里面，实际的发送在ikcp_update才会有实际的发送
+		// 在锁外面压缩
+		thread_local char zipBuffer[AN_MSG_MAX_SIZE];
+		if (m_compressSize && trans > m_compressSize)
+		{
+			size_t zipLen = CompressMsg(data, trans, zipBuffer, sizeof(zipBuffer));
+			if (zipLen) {
+				data = zipBuffer;
+				trans = zipLen;
+			}
+		}
+
+		SendWatermark::Action act;
+		{
+			// 只是将数据放到kcp的发送缓冲区里面，实际的发送在ikcp_update才会有实际的发送
+			_lock_guard_(m_kcpLock);
+			if (!m_kcp)
+			{
+				return false;
+			}
+
+			act = m_watermark.Check(queuedBytes(), data, trans);
+			if (act == SendWatermark::Action::SW_PUSH || act == SendWatermark::Action::SW_NOTIFY)
+			{
+				// ikcp_send成功返回0
+				if (ikcp_send(m_kcp, data, trans) < 0)
+				{
+					return false;
+				}
+				m_tuner.Wake(m_kcp);
+			}
+		}
+
+		// Close里面也要拿m_kcpLock，所以放到锁外面处理
+		// 调用线程可能正在EventDriver的handler里回消息，持有它的m_lock
+		// PushError和Close(会PushDisconnect)都要拿这个锁，所以投递到io线程处理
+		switch (act)
+		{
+		case SendWatermark::Action::SW_NOTIFY:
+			asio::post(m_sock->get_executor(), [self = shared_from_this()]() {
+				self->ptr_poller->PushError(self->Key(), EventErrCode::SEND_QUEUE_FULL);
+				});
+			return true;
+		case SendWatermark::Action::SW_DROP:
+			return false;
+		case SendWatermark::Action::SW_DISCONNECT:
+			asio::post(m_sock->get_executor(), std::bind(&KcpConn::Close, shared_from_this()));
+			return false;
+		default:
+			return true;
+		}
+	}
+
+	size_t KcpConn::SendQueueSize()
+	{
 		_lock_guard_(m_kcpLock);
 		if (!m_kcp)
 		{
-			return false;
+			return 0;
 		}
-		
-        return ikcp_send(m_kcp, data, trans) > 0;
+		return queuedBytes();
 	}
 
-	void KcpConn::Connect(const std::string& ip,uint16_t port,uint32_t conv)
+	size_t KcpConn::queuedBytes()
+	{
+		// 分片数 * mss，最后一个分片可能不满，这里只是估算
+		return static_cast<size_t>(ikcp_waitsnd(m_kcp)) * m_kcp->mss;
+	}
+
+	void KcpConn::Accept(NetKey key,uint32_t conv)
 	{
-		if(m_conv){
+		_lock_guard_(m_kcpLock);
+		if (m_kcp) {
 			return;
 		}
+		m_key = key;
 		m_conv = conv;
+		initKcp();
+	}
+
+	void KcpConn::Connect(const std::string& ip,uint16_t port,uint32_t conv)
+	{
+		if(m_nonce){
+			return;
+		}
+		// nonce用来认出这次握手的SYN_ACK，不能是0
+		thread_local std::mt19937 rnd(std::random_device{}());
+		do {
+			m_nonce = rnd();
+		} while (!m_nonce);
+		m_service = conv;
 		m_sender = UdpEndPoint(asio::ip::address::from_string(ip.c_str()),port);
-		m_sock = std::make_shared<UdpSock>(m_updater.get_executor());
 		m_sock->connect(m_sender);
 
-		initKcp();
-		m_kcp->output = &KcpConn::kcpOutPutFunc1;
-		KcpUpdate();
 		readLoop();
+		sendSyn(SYN_RETRY);
+	}
+
+	void KcpConn::writeSyn()
+	{
+		KcpHandshake hs;
+		hs.type = KcpHsType::HS_SYN;
+		hs.service = m_service;
+		hs.nonce = m_nonce;
+		hs.cookie = m_cookie;
+		char buf[KcpHandshake::SIZE];
+		KcpSendBatch::Local().Send(m_sock, nullptr, buf, hs.Encode(buf));
+	}
+
+	void KcpConn::sendSyn(int retry)
+	{
+		writeSyn();
+
+		m_synTimer->expires_after(std::chrono::milliseconds(SYN_INTERVAL));
+		m_synTimer->async_wait([self = shared_from_this(), retry](const NetErr& ec) {
+			if (ec) {
+				return;
+			}
+			{
+				_lock_guard_(self->m_kcpLock);
+				if (self->m_kcp) {
+					return;
+				}
+			}
+			if (retry > 0) {
+				self->sendSyn(retry - 1);
+				return;
+			}
+			// 连不上，关掉socket让readLoop退出
+			NetErr err;
+			self->m_sock->close(err);
+			});
+	}
+
+	void KcpConn::onHandshake(const KcpHandshake& hs)
+	{
+		if (hs.service != m_service || hs.nonce != m_nonce) {
+			return;
+		}
+		if (hs.type == KcpHsType::HS_COOKIE)
+		{
+			// 带着cookie马上再发一次，之后的重发也带上；cookie过期了server会再给一个新的
+			if (hs.cookie)
+			{
+				m_cookie = hs.cookie;
+				writeSyn();
+			}
+			return;
+		}
+		if (hs.type != KcpHsType::HS_SYN_ACK || !hs.conv) {
+			return;
+		}
+		{
+			// 重复的SYN_ACK
+			_lock_guard_(m_kcpLock);
+			if (m_kcp) {
+				return;
+			}
+			m_conv = hs.conv;
+			initKcp();
+			m_kcp->output = &KcpConn::kcpOutPutFunc1;
+		}
+		m_synTimer->cancel();
+		KcpUpdate(KcpScheduler::Clock());
 
-		// 这里可以做成发一个协议过去验证成功并收到返回了才算成功
-		// 即真异步
 		if(ptr_owner){
 			ptr_owner->AddConn(shared_from_this());
 		}
-		ptr_poller->PushConnect(Key(),ip,port);
+		ptr_poller->PushConnect(Key(),m_sender.address().to_string(),m_sender.port());
 	}
 
 	// 服务器版的conn使用
 	// ikcp_update的时候才会调用
 	int KcpConn::kcpOutPutFunc(const char* buf, int len, ikcpcb* kcp, void* user)
 	{
-		static NetErr ec;
 		auto ptr = static_cast<KcpConn*>(user);
 		// 这里不采用async_send的方式发送，因为kcp本身就已经是async的
 		// 而且udp的发送本来就很快，再改成async_send不仅增加逻辑复杂性，性能可能更低
-		ptr->m_sock->send_to(asio::buffer(buf, len), ptr->m_sender,0,ec);
-		return !ec;
+		// 调度器的tick里面先攒起来，tick结束的时候用sendmmsg一起发
+		ptr->udpOutput(buf, len, &ptr->m_sender);
+		return 0;
+	}
+
+	void KcpConn::udpOutput(const char* buf, size_t len, const UdpEndPoint* dest)
+	{
+		if (!m_fecEnc)
+		{
+			KcpSendBatch::Local().Send(m_sock, dest, buf, len, m_udpOffload);
+			return;
+		}
+		m_fecEnc->Encode(buf, len, [this, dest](const char* data, size_t n) {
+			KcpSendBatch::Local().Send(m_sock, dest, data, n, m_udpOffload);
+			});
+	}
+
+	bool KcpConn::kcpInput(const char* data, size_t trans)
+	{
+		if (!m_fecDec) {
+			return ikcp_input(m_kcp, data, trans) == 0;
+		}
+		// 恢复出来的包和收到的包一样交给kcp，赶在重传之前
+		bool accepted = false;
+		m_fecDec->Decode(data, trans, [this, &accepted](const char* pkt, size_t len) {
+			if (ikcp_input(m_kcp, pkt, static_cast<long>(len)) == 0) {
+				accepted = true;
+			}
+			});
+		return accepted;
 	}
 
 	// 客户端版conn使用
@@ -102,11 +278,15 @@ namespace AsioNet
                 return;
             }
 
-			if (trans < sizeof(IKCP_OVERHEAD) || trans > IKCP_MTU) {
-				return;
+			KcpHandshake hs;
+			if (KcpHandshake::Is(self->m_kcpBuffer, trans)) {
+				if (hs.Decode(self->m_kcpBuffer, trans)) {
+					self->onHandshake(hs);
+				}
+			}
+			else if (trans >= IKCP_OVERHEAD && trans <= IKCP_MTU) {
+				self->KcpInput(self->m_kcpBuffer,trans);
 			}
-			
-			self->KcpInput(self->m_kcpBuffer,trans);
 			
             self->readLoop();
         });
@@ -115,29 +295,53 @@ namespace AsioNet
 	// 客户端版使用
 	int KcpConn::kcpOutPutFunc1(const char* buf, int len, ikcpcb* kcp, void* user)
 	{
-		static NetErr ec;
 		auto ptr = static_cast<KcpConn*>(user);
-		ptr->m_sock->send(asio::buffer(buf, len),0,ec);
-		return !ec;
+		ptr->udpOutput(buf, len, nullptr);
+		return 0;
 	}
 
-	void KcpConn::KcpInput(const char* data,size_t trans)
+	void KcpConn::KcpInput(const char* data,size_t trans,const UdpEndPoint* from)
 	{
-		int recv = 0;
+		// 取出来的消息交给poller之前都不能放开，否则另一个线程的recvBatch会覆盖m_readBuffer，消息的顺序也会乱
+		_lock_guard_(m_recvLock);
+		RecvMsg msgs[RECV_BATCH];
+		size_t n = 0;
+		RecvState state = RecvState::RS_DONE;
 		{
 			_lock_guard_(m_kcpLock);
 			if (!m_kcp) {
 				return;
 			}
 
-			ikcp_input(m_kcp, data, trans);
+			// 只有能证明是对端发的包才换成新的地址：确认了我们发出去的数据(snd_una前进)，或者带了窗口里的新分片
+			// 猜中conv的人伪造一个ack/wask，kcp也会接受，但是不会让会话跟着跑到他的地址上
+			uint32_t una = m_kcp->snd_una;
+			uint32_t rcvNxt = m_kcp->rcv_nxt;
+			uint32_t rcvBuf = m_kcp->nrcv_buf;
+			if (kcpInput(data, trans))
+			{
+				m_tuner.Wake(m_kcp);
+				bool proved = m_kcp->snd_una != una || m_kcp->rcv_nxt != rcvNxt || m_kcp->nrcv_buf > rcvBuf;
+				if (from && proved && !(*from == m_sender)) {
+					m_sender = *from;
+				}
+			}
 
-			// 尝试从kcp里面获取一个包
-			recv = ikcp_recv(m_kcp, m_readBuffer, sizeof(m_readBuffer));
+			// 一个包可能让好几条消息同时完整(比如重传补上了前面的空洞)，全部取出来，不等下一个包
+			state = recvBatch(msgs, n);
 		}
 
-		if(recv > 0){   
-			ptr_poller->PushRecv(Key(),m_readBuffer,recv);
+		while (true)
+		{
+			deliver(msgs, n);
+			if (state != RecvState::RS_MORE) {
+				break;
+			}
+			_lock_guard_(m_kcpLock);
+			if (!m_kcp) {
+				return;
+			}
+			state = recvBatch(msgs, n);
 		}
 
 		// 源码分析：ikcp_recv
@@ -145,46 +349,89 @@ namespace AsioNet
 		// 如果对端发了个基于kcp协议的很大的包，那么这个包就会一直卡在kcp_recv里面，之后的包将再也取不出来
 		// 我这边的buffer如果不够大，那么接下来就再也取不出包了
 		// 直接断开连接
-		if (recv == -3){
+		if (state == RecvState::RS_TOO_BIG){
 			err_handler();
 		}
 	}
 
-	void KcpConn::KcpUpdate()
+	KcpConn::RecvState KcpConn::recvBatch(RecvMsg* msgs, size_t& n)
+	{
+		n = 0;
+		size_t used = 0;
+		while (n < RECV_BATCH)
+		{
+			int size = ikcp_peeksize(m_kcp);
+			if (size <= 0) {
+				return RecvState::RS_DONE;
+			}
+			if (static_cast<size_t>(size) > sizeof(m_readBuffer)) {
+				return RecvState::RS_TOO_BIG;
+			}
+			if (used + size > sizeof(m_readBuffer)) {
+				return RecvState::RS_MORE;
+			}
+			int recv = ikcp_recv(m_kcp, m_readBuffer + used, size);
+			if (recv <= 0) {
+				return RecvState::RS_DONE;
+			}
+			msgs[n++] = RecvMsg{ m_readBuffer + used, static_cast<size_t>(recv) };
+			used += recv;
+		}
+		return RecvState::RS_MORE;
+	}
+
+	void KcpConn::deliver(RecvMsg* msgs, size_t n)
 	{
-		auto ticks = std::chrono::duration_cast<std::chrono::milliseconds>
-			(std::chrono::system_clock::now().time_since_epoch()).count();
+		if (m_recvLimiter.Enabled())
+		{
+			// 没通过的去掉，剩下的顺序不变
+			size_t pass = 0;
+			for (size_t i = 0; i < n; i++)
+			{
+				uint64_t waitUs = 0;
+				auto act = m_recvLimiter.Check(msgs[i].data, msgs[i].len, waitUs);
+				if (act == RecvLimiter::Action::RL_PASS) {
+					msgs[pass++] = msgs[i];
+				}
+				else if (act == RecvLimiter::Action::RL_NOTIFY) {
+					ptr_poller->PushError(Key(), EventErrCode::RATE_LIMITED);
+				}
+			}
+			n = pass;
+		}
+		if (n) {
+			ptr_poller->PushRecvBatch(Key(), msgs, n);
+		}
+	}
 
-		uint32_t after = 0;	// 10ms
+	void KcpConn::KcpUpdate(uint32_t now)
+	{
+		uint32_t after = 0;
 
 		{
 			_lock_guard_(m_kcpLock);
 			if (!m_kcp)
 			{
+				// 已经关闭了，不再放回调度器，调度器里的引用释放之后conn就析构了
 				return;
 			}
 
 			// 正常一次check，一次update，然后再check获取下次update的时间
 			// 这里直接用循环了
-			ikcp_update(m_kcp, ticks);
-			after = ikcp_check(m_kcp, ticks);
+			ikcp_update(m_kcp, now);
+			m_tuner.Update(m_kcp, now);
+			after = ikcp_check(m_kcp, now);
+			m_watermark.Drained(queuedBytes());
 		}
 
-		if (after <= ticks)	// 理论上不会出现这种情况，防止有bug
+		if (static_cast<int32_t>(after - now) <= 0)	// 理论上不会出现这种情况，防止有bug
 		{
-			after = ticks + 10;
+			after = now + 10;
 		}
 
-		m_updater.expires_after(std::chrono::milliseconds(after - ticks));
-		m_updater.async_wait([self = shared_from_this()](const NetErr& ec) {
-			if (ec)
-			{
-				self->err_handler();
-				return;
-			}
-
-			self->KcpUpdate();
-			});
+		if (ptr_scheduler) {
+			ptr_scheduler->Schedule(m_schedShard, shared_from_this(), after);
+		}
 	}
 
 	// 网络库的错误处理：关闭连接
@@ -197,7 +444,7 @@ namespace AsioNet
 	{
 		{
 			_lock_guard_(m_kcpLock);
-			if (m_kcp)
+			if (!m_kcp)
 			{
 				return;
 			}
@@ -211,7 +458,7 @@ namespace AsioNet
 		}
 		ptr_poller->PushDisconnect(Key(),m_sender.address().to_string(),m_sender.port());
 
-		m_updater.cancel();
+		// 调度器里的引用到点之后发现已经关闭，自然就释放了
 		// 服务器模式下，多个conn使用同一个sock，不能关
 		if(m_mode == KcpConnMode::KCM_CLIENT && m_sock){
 			NetErr err;
@@ -228,6 +475,7 @@ namespace AsioNet
 
 	UdpEndPoint KcpConn::Remote()
 	{
+		_lock_guard_(m_kcpLock);
 		return m_sender;
 	}
 
@@ -235,6 +483,36 @@ namespace AsioNet
 	{
 		ptr_owner = o;
 	}
+
+	void KcpConn::SetScheduler(KcpScheduler* s)
+	{
+		ptr_scheduler = s;
+		m_schedShard = s ? s->PickShard() : 0;
+	}
+
+	void KcpConn::SetOption(const KcpOption& opt)
+	{
+		m_watermark.SetOption(opt.sendQueue);
+		m_compressSize = opt.compressSize;
+		m_udpOffload = opt.udpOffload;
+		m_fecData = opt.fecData;
+		m_fecParity = opt.fecParity;
+		m_recvLimiter.SetOption(opt.recvLimit);
+		m_adaptive = opt.adaptive;
+		SetProfile(opt.profile);
+	}
+
+	void KcpConn::SetProfile(const KcpProfile& profile)
+	{
+		_lock_guard_(m_kcpLock);
+		m_profile = profile;
+		// mtu太小的话连fec包头和kcp包头都放不下
+		int minMtu = static_cast<int>(IKCP_OVERHEAD + AN_FEC_OVERHEAD) + 1;
+		m_profile.mtu = std::max(minMtu, std::min(m_profile.mtu, static_cast<int>(IKCP_MTU)));
+		if (m_kcp) {
+			m_tuner.Reset(m_kcp, m_profile, m_adaptive, m_fecEnc ? static_cast<int>(AN_FEC_OVERHEAD) : 0);
+		}
+	}
 }
 
 namespace AsioNet
@@ -245,9 +523,7 @@ namespace AsioNet
 		auto itr = m_conns.find(key);
 		if (itr != m_conns.end())
 		{
-			auto conn = itr->second;
-			m_conns.erase(conn->Key());
-			m_connHelper.erase(conn->Remote());
+			m_conns.erase(itr);
 		}
 	}
 
@@ -259,7 +535,6 @@ namespace AsioNet
 		}
 		if (m_conns.find(conn->Key()) == m_conns.end()) {
 			m_conns[conn->Key()] = conn;
-			m_connHelper[conn->Remote()] = conn->Key();
 		}
 	}
 	
@@ -273,41 +548,46 @@ namespace AsioNet
 		return nullptr;
 	}
 
-	std::shared_ptr<KcpConn> KcpConnMgr::GetConn(const UdpEndPoint& remote)
+	void KcpConnMgr::Disconnect(NetKey k)
 	{
-		_lock_guard_(m_lock);
-		auto itr = m_connHelper.find(remote);
-		if (itr != m_connHelper.end()) {
-			auto conn = m_conns.find(itr->second);
-			if (conn != m_conns.end())
-			{
-				return conn->second;
+		// Close会回调DelConn，不能在锁里调用
+		std::shared_ptr<KcpConn> conn;
+		{
+			_lock_guard_(m_lock);
+			auto itr = m_conns.find(k);
+			if (itr != m_conns.end()) {
+				conn = itr->second;
 			}
 		}
-		return nullptr;
-	}
-
-	void KcpConnMgr::Disconnect(NetKey k)
-	{
-		_lock_guard_(m_lock);
-		auto itr = m_conns.find(k);
-		if (itr != m_conns.end()) {
-			itr->second->Close();
+		if (conn) {
+			conn->Close();
 		}
 	}
 
 	void KcpConnMgr::Broadcast(const char* data,size_t trans)
 	{
-		_lock_guard_(m_lock);
-		for(auto p : m_conns){
-			p.second->Write(data,trans);
+		// Write可能关闭连接回调DelConn，不能在锁里调用
+		std::vector<std::shared_ptr<KcpConn>> conns;
+		{
+			_lock_guard_(m_lock);
+			conns.reserve(m_conns.size());
+			for (auto& p : m_conns) {
+				conns.push_back(p.second);
+			}
+		}
+		for (auto& conn : conns) {
+			conn->Write(data, trans);
 		}
 	}
 
 	KcpConnMgr::~KcpConnMgr()
 	{
-		_lock_guard_(m_lock);
-		for(auto p : m_conns){
+		decltype(m_conns) conns;
+		{
+			_lock_guard_(m_lock);
+			conns.swap(m_conns);
+		}
+		for(auto p : conns){
 			p.second->Close();
 		}
 	}
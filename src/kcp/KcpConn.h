@@ -4,7 +4,14 @@
 
 #include "../utils/AsioNetDef.h"
 #include "../utils/BlockBuffer.h"
+#include "../utils/SendWatermark.h"
+#include "../utils/RateLimiter.h"
 #include "../event/IEventPoller.h"
+#include "KcpScheduler.h"
+#include "KcpSendBatch.h"
+#include "KcpHandshake.h"
+#include "KcpFec.h"
+#include "KcpTuner.h"
 
 // 参考资料
 // doc:https://github.com/libinzhangyuan/asio_kcp
@@ -27,7 +34,41 @@ namespace AsioNet
 
 	const uint32_t IKCP_OVERHEAD = 24;
 	const uint32_t IKCP_MTU = 1400;	// default
-	// ikcp_allocator:可以考虑接管内存管理
+
+	// 连接相关的配置
+	struct KcpOption {
+		SendQueueOption sendQueue;	// 按nsnd_que+nsnd_buf里的分片估算字节数
+
+		// 大于0时，超过这个大小的消息先用lz4压缩，压缩后没变小就原样发送
+		// kcp重传的也是压缩后的数据，大包越小重传代价越低
+		size_t compressSize = 0;
+
+		// 接收限速，RLP_PAUSE对kcp按RLP_DROP处理：server的所有连接共用一个udp socket，不能停下来等一个连接
+		RecvLimitOption recvLimit;
+
+		// udp的GSO/GRO，只在linux上生效，默认关闭
+		// 发送：一次update里发往同一个地址的mtu大小的包合成一次UDP_SEGMENT发送
+		// 接收：只对Serve生效，打开UDP_GRO，内核合并的大包在交给kcp之前再切开
+		bool udpOffload = false;
+
+		// 只对Serve生效，linux上每个io线程一个SO_REUSEPORT的udp socket绑定同一个端口
+		// 内核按四元组把对端分到固定的socket上，收包可以在多个线程上并行
+		// 其他平台没有按四元组分流的SO_REUSEPORT，还是一个socket
+		bool reusePort = false;
+
+		// 前向纠错，两个都大于0时打开，两端必须一样，data + parity <= 255
+		// 每fecData个kcp包多发fecParity个校验包，一组里丢的包不超过fecParity个就能直接恢复，不用等重传
+		// kcp的mtu会减掉fec包头的12字节
+		size_t fecData = 0;
+		size_t fecParity = 0;
+
+		// kcp参数，Serve的时候是这个server所有连接的默认值，单个连接可以用KcpNetMgr::SetProfile再改
+		// 两端的mtu要一样，不能超过IKCP_MTU
+		KcpProfile profile;
+		// 按rtt、重传率调整窗口、快速重传，空闲的连接放大update间隔，默认关闭
+		KcpAdaptiveOption adaptive;
+	};
+	// kcp的内存分配见KcpAllocator
 	// 请使用shared_ptr管理对象
 	class KcpConn : public std::enable_shared_from_this<KcpConn>
 	{
@@ -39,29 +80,49 @@ namespace AsioNet
 		KcpConn& operator=(KcpConn&&) = delete;
 		
 		// for server
-		KcpConn(std::shared_ptr<UdpSock>,const UdpEndPoint&,IEventPoller* p,uint32_t conv);
-		
+		// 握手的时候创建，Accept之前收到的包都丢掉
+		KcpConn(std::shared_ptr<UdpSock>,const UdpEndPoint&,IEventPoller* p);
+
 		// for client
 		KcpConn(io_ctx& ,IEventPoller*);
 
-		// 目前其实是同步连接
+		// server分配好conv之后调用，key:server给这个会话的NetKey
+		void Accept(NetKey key,uint32_t conv);
+
+		// conv:和Serve的conv一样，握手的时候server用来校验，kcp用的conv由server分配
+		// 收到SYN_ACK才算连接成功，超时没有回应就关掉，和tcp一样不通知上层
 		void Connect(const std::string& ip,uint16_t port,uint32_t conv);
 
 		~KcpConn();
 
 		void SetOwner(IKcpConnOwner*);
+
+		// 由调度器驱动ikcp_update，Connect或者第一次KcpUpdate之前设置
+		void SetScheduler(KcpScheduler*);
+
+		void SetOption(const KcpOption&);
+
+		// 运行中换kcp参数，自适应调整从新的profile重新开始
+		void SetProfile(const KcpProfile&);
 		
+		// 发送队列超过高水位时，按照KcpOption::sendQueue的策略处理
 		bool Write(const char* data, size_t trans);
 
+		// kcp发送队列和发送窗口中还没确认的字节数
+		size_t SendQueueSize();
+
 		void Close();
 
 		NetKey Key();
 		
 		UdpEndPoint Remote();
 
-		void KcpInput(const char* data,size_t trans);
+		// from:收到这个包的地址，包里有新的分片或者确认了新的数据，并且地址变了的话(NAT重新映射)，之后发往新的地址
+		void KcpInput(const char* data,size_t trans,const UdpEndPoint* from = nullptr);
 		
-		void KcpUpdate();
+		// now:KcpScheduler::Clock()，调度器在tick里用缓存的时间调用
+		// 之后按ikcp_check的结果重新交给调度器
+		void KcpUpdate(uint32_t now);
 
 	protected:
 		// 服务器创建的conn使用的output
@@ -71,11 +132,36 @@ namespace AsioNet
 
 		void readLoop();
 
+		// 发SYN，每SYN_INTERVAL重发一次，retry次之后放弃
+		void sendSyn(int retry);
+		void writeSyn();
+		// 收到COOKIE或者SYN_ACK
+		void onHandshake(const KcpHandshake&);
+
 		void init();
 
 		void initKcp();
 
 		void err_handler();
+
+		// 需要持有m_kcpLock
+		size_t queuedBytes();
+		// kcp的输出，开了fec的话先过一遍fec，需要持有m_kcpLock
+		void udpOutput(const char* buf, size_t len, const UdpEndPoint* dest);
+		// 交给ikcp_input，开了fec的话先解fec，kcp接受了(至少一个)包返回true，需要持有m_kcpLock
+		bool kcpInput(const char* data, size_t trans);
+
+		enum class RecvState
+		{
+			RS_DONE,		// kcp里没有完整的消息了
+			RS_MORE,		// 缓冲区或者msgs满了，交出去之后接着取
+			RS_TOO_BIG,		// 下一条消息比m_readBuffer还大
+		};
+		static constexpr size_t RECV_BATCH = 64;
+		// 把kcp里已经完整的消息按ikcp_peeksize依次取到m_readBuffer里，需要持有m_recvLock和m_kcpLock
+		RecvState recvBatch(RecvMsg* msgs, size_t& n);
+		// 过一遍接收限速，然后一批交给poller，需要持有m_recvLock，不能持有m_kcpLock
+		void deliver(RecvMsg* msgs, size_t n);
 	private:
         // kcpsvr中，多个kcp依赖在一个udpsock上，所以这里使用了shared_ptr
 		std::shared_ptr<UdpSock> m_sock;
@@ -83,14 +169,41 @@ namespace AsioNet
 		// kcp相关
 		uint32_t m_conv;
         ikcpcb *m_kcp = nullptr;
-		asio::high_resolution_timer m_updater;
+		KcpScheduler* ptr_scheduler;
+		size_t m_schedShard;
 		std::mutex m_kcpLock;
-
-		// 对端addr
+		// KcpInput从头到尾持有，先拿它再拿m_kcpLock
+		// 开了reusePort的时候，NAT重新映射的对端的包可能落在别的shard上，同一个conn的KcpInput会在两个io线程上同时跑
+		std::mutex m_recvLock;
+		SendWatermark m_watermark;
+		size_t m_compressSize = 0;
+		bool m_udpOffload = false;
+		size_t m_fecData = 0;
+		size_t m_fecParity = 0;
+		// 在initKcp里按conv创建，需要持有m_kcpLock
+		std::unique_ptr<KcpFecEncoder> m_fecEnc;
+		std::unique_ptr<KcpFecDecoder> m_fecDec;
+		// 只在KcpInput里访问，需要持有m_recvLock
+		RecvLimiter m_recvLimiter;
+		KcpProfile m_profile;
+		KcpAdaptiveOption m_adaptive;
+		// 需要持有m_kcpLock
+		KcpTuner m_tuner;
+
+		// 对端addr，server模式下NAT重新映射之后会变，需要持有m_kcpLock
 		UdpEndPoint m_sender;
+
+		// client握手用
+		static constexpr int SYN_RETRY = 10;
+		static constexpr int SYN_INTERVAL = 200;	// ms
+		std::unique_ptr<asio::steady_timer> m_synTimer;
+		uint32_t m_service = 0;
+		uint32_t m_nonce = 0;
+		std::atomic<uint64_t> m_cookie{ 0 };	// server给的cookie，重发SYN的时候带上
 		
         // 用于接受kcp协议的buffer，kcp协议经过分片处理，不需要很大
 		char m_kcpBuffer[AN_KCP_BUFFER_SIZE];
+		// recvBatch取出来的消息依次放在这里，deliver完之前不能被下一次recvBatch覆盖，需要持有m_recvLock
 		char m_readBuffer[AN_MSG_MAX_SIZE];
 		NetKey m_key;
 		KcpConnMode m_mode;
@@ -112,13 +225,11 @@ namespace AsioNet
 		
 		void Disconnect(NetKey k);
 		std::shared_ptr<KcpConn> GetConn(NetKey);
-		std::shared_ptr<KcpConn> GetConn(const UdpEndPoint&);
 		void Broadcast(const char*,size_t);
 
 		~KcpConnMgr() override;
 	private:
 		std::unordered_map<NetKey,std::shared_ptr<KcpConn>> m_conns;
-		std::unordered_map<UdpEndPoint,NetKey> m_connHelper;
 		std::mutex m_lock;
 	};
 }
@@ -0,0 +1,183 @@
+#include "KcpFec.h"
+
+#include <cstring>
+
+namespace AsioNet
+{
+	static void putLe(uint8_t* buf, uint32_t v, size_t n)
+	{
+		for (size_t i = 0; i < n; i++) {
+			buf[i] = static_cast<uint8_t>(v >> (8 * i));
+		}
+	}
+
+	static uint32_t getLe(const uint8_t* buf, size_t n)
+	{
+		uint32_t v = 0;
+		for (size_t i = 0; i < n; i++) {
+			v |= static_cast<uint32_t>(buf[i]) << (8 * i);
+		}
+		return v;
+	}
+
+	// ******************** KcpFecEncoder ********************
+	KcpFecEncoder::KcpFecEncoder(uint32_t conv, size_t dataShards, size_t parityShards, size_t mtu) :
+		m_rs(dataShards, parityShards), m_conv(conv), m_seq(0), m_mtu(mtu), m_num(0), m_maxBody(0)
+	{
+		size_t shardNum = dataShards + parityShards;
+		m_paws = static_cast<uint32_t>(UINT32_MAX / shardNum * shardNum);
+		m_shards.resize(shardNum);
+		for (auto& s : m_shards) {
+			s.resize(mtu, 0);
+		}
+		for (auto& s : m_shards) {
+			m_bodies.push_back(s.data() + AN_FEC_HEADER);
+		}
+	}
+
+	void KcpFecEncoder::header(uint8_t* buf, uint16_t flag)
+	{
+		putLe(buf, m_conv, 4);
+		putLe(buf + 4, m_seq, 4);
+		putLe(buf + 8, flag, 2);
+		m_seq = (m_seq + 1) % m_paws;
+	}
+
+	size_t KcpFecEncoder::push(const char* pkt, size_t len)
+	{
+		size_t body = len + 2;
+		if (AN_FEC_HEADER + body > m_mtu) {
+			return 0;
+		}
+		uint8_t* buf = m_shards[m_num].data();
+		header(buf, AN_FEC_TYPE_DATA);
+		putLe(buf + AN_FEC_HEADER, static_cast<uint32_t>(body), 2);
+		memcpy(buf + AN_FEC_HEADER + 2, pkt, len);
+		if (body > m_maxBody) {
+			m_maxBody = body;
+		}
+		m_num++;
+		return AN_FEC_HEADER + body;
+	}
+
+	size_t KcpFecEncoder::finish()
+	{
+		// 短的数据分片后面补0，校验按最长的算
+		for (size_t i = 0; i < m_rs.DataShards(); i++)
+		{
+			size_t body = getLe(m_bodies[i], 2);
+			memset(m_bodies[i] + body, 0, m_maxBody - body);
+		}
+		m_rs.Encode(m_bodies.data(), m_maxBody);
+		for (size_t i = 0; i < m_rs.ParityShards(); i++) {
+			header(m_shards[m_rs.DataShards() + i].data(), AN_FEC_TYPE_PARITY);
+		}
+
+		size_t len = AN_FEC_HEADER + m_maxBody;
+		m_num = 0;
+		m_maxBody = 0;
+		return len;
+	}
+
+	// ******************** KcpFecDecoder ********************
+	KcpFecDecoder::KcpFecDecoder(size_t dataShards, size_t parityShards) :
+		m_rs(dataShards, parityShards), m_shardNum(dataShards + parityShards),
+		m_present(new bool[dataShards + parityShards]), m_bodies(dataShards + parityShards)
+	{
+		for (auto& g : m_groups)
+		{
+			g.present.resize(m_shardNum);
+			g.bodies.resize(m_shardNum);
+		}
+	}
+
+	bool KcpFecDecoder::parse(const char* data, size_t len, Packet& pkt)
+	{
+		auto buf = reinterpret_cast<const uint8_t*>(data);
+		if (len < AN_FEC_OVERHEAD) {
+			return false;
+		}
+		pkt.seq = getLe(buf + 4, 4);
+		pkt.flag = static_cast<uint16_t>(getLe(buf + 8, 2));
+		pkt.body = data + AN_FEC_HEADER;
+		pkt.len = len - AN_FEC_HEADER;
+		pkt.size = 0;
+		if (pkt.flag == AN_FEC_TYPE_DATA)
+		{
+			pkt.size = getLe(buf + AN_FEC_HEADER, 2);
+			return pkt.size > 2 && pkt.size <= pkt.len;
+		}
+		return pkt.flag == AN_FEC_TYPE_PARITY;
+	}
+
+	KcpFecDecoder::Group* KcpFecDecoder::store(const Packet& pkt)
+	{
+		uint32_t id = pkt.seq / static_cast<uint32_t>(m_shardNum);
+		size_t idx = pkt.seq % m_shardNum;
+		Group& g = m_groups[id % GROUPS];
+		if (!g.used || g.id != id)
+		{
+			// 用差值比较，seqid回绕也没问题；比这个位置上的组还老的包没用了
+			if (g.used && static_cast<int32_t>(id - g.id) < 0) {
+				return nullptr;
+			}
+			g.id = id;
+			g.used = true;
+			g.done = false;
+			g.num = 0;
+			g.dataNum = 0;
+			g.parityLen = 0;
+			g.present.assign(m_shardNum, false);
+		}
+		if (g.done || g.present[idx]) {
+			return nullptr;
+		}
+
+		bool isData = idx < m_rs.DataShards();
+		if (isData != (pkt.flag == AN_FEC_TYPE_DATA)) {
+			return nullptr;
+		}
+		size_t len = isData ? pkt.size : pkt.len;
+		if (!isData)
+		{
+			// 同一组的校验包一样长
+			if (g.parityLen && g.parityLen != len) {
+				return nullptr;
+			}
+			g.parityLen = len;
+		}
+		g.bodies[idx].assign(pkt.body, pkt.body + len);
+		g.present[idx] = true;
+		g.num++;
+		if (isData) {
+			g.dataNum++;
+		}
+		return &g;
+	}
+
+	bool KcpFecDecoder::reconstruct(Group& g)
+	{
+		// 缺数据分片又凑够了数量，一定收到了校验包
+		size_t size = g.parityLen;
+		if (!size) {
+			return false;
+		}
+		for (size_t i = 0; i < m_shardNum; i++)
+		{
+			m_present[i] = g.present[i];
+			if (g.present[i] && g.bodies[i].size() > size) {
+				return false;
+			}
+			// 短的数据分片补0，缺的分片准备好缓冲区
+			g.bodies[i].resize(size, 0);
+			m_bodies[i] = g.bodies[i].data();
+		}
+		return m_rs.Reconstruct(m_bodies.data(), m_present.get(), size);
+	}
+
+	bool KcpFecDecoder::recovered(Group& g, size_t idx, size_t& size)
+	{
+		size = getLe(g.bodies[idx].data(), 2);
+		return size > 2 && size <= g.bodies[idx].size();
+	}
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "../utils/ReedSolomon.h"
+
+#include <memory>
+#include <vector>
+
+namespace AsioNet
+{
+	// kcp输出和udp之间的前向纠错，格式参考kcp-go
+	// fec包：conv(4B) | seqid(4B) | flag(2B) | body，数字都是小端，和kcp包头一样
+	// 数据包的body：size(2B，包括自己) | kcp包；校验包的body：这一组数据包body(补0到一样长)的RS校验
+	// 每dataShards个数据包算出parityShards个校验包，seqid连续，seqid / (data+parity)是组号
+	// 开头是conv，server不用解fec就能按conv找到会话；握手包不走fec
+	// 两边的dataShards/parityShards必须一样
+	const uint16_t AN_FEC_TYPE_DATA = 0xf1;
+	const uint16_t AN_FEC_TYPE_PARITY = 0xf2;
+	const size_t AN_FEC_HEADER = 10;
+	const size_t AN_FEC_OVERHEAD = AN_FEC_HEADER + 2;	// kcp的mtu要减掉这么多
+
+	// 只在持有conn的m_kcpLock时使用
+	class KcpFecEncoder
+	{
+	public:
+		KcpFecEncoder(const KcpFecEncoder&) = delete;
+		KcpFecEncoder& operator=(const KcpFecEncoder&) = delete;
+
+		// mtu:udp包的最大长度
+		KcpFecEncoder(uint32_t conv, size_t dataShards, size_t parityShards, size_t mtu);
+
+		// 输入一个kcp包，马上输出对应的数据包；凑满一组之后接着输出这一组的校验包
+		// out(const char* data, size_t len)
+		template<typename F>
+		void Encode(const char* pkt, size_t len, F&& out)
+		{
+			size_t n = push(pkt, len);
+			if (!n) {
+				return;
+			}
+			out(reinterpret_cast<const char*>(m_shards[m_num - 1].data()), n);
+			if (m_num < m_rs.DataShards()) {
+				return;
+			}
+			size_t pn = finish();
+			for (size_t i = 0; i < m_rs.ParityShards(); i++) {
+				out(reinterpret_cast<const char*>(m_shards[m_rs.DataShards() + i].data()), pn);
+			}
+		}
+
+	private:
+		// 放进当前组，返回数据包的长度，太长返回0
+		size_t push(const char* pkt, size_t len);
+		// 算校验包，返回校验包的长度
+		size_t finish();
+		void header(uint8_t* buf, uint16_t flag);
+
+		ReedSolomon m_rs;
+		uint32_t m_conv;
+		uint32_t m_seq;
+		uint32_t m_paws;	// seqid在这个数回绕，保证回绕的时候正好是一组的开头
+		size_t m_mtu;
+		size_t m_num;		// 当前组已经有几个数据包
+		size_t m_maxBody;	// 当前组最长的body
+		std::vector<std::vector<uint8_t>> m_shards;	// 每个分片一个完整的udp包，包头 | body
+		std::vector<uint8_t*> m_bodies;
+	};
+
+	// 只在持有conn的m_kcpLock时使用
+	class KcpFecDecoder
+	{
+	public:
+		KcpFecDecoder(const KcpFecDecoder&) = delete;
+		KcpFecDecoder& operator=(const KcpFecDecoder&) = delete;
+
+		KcpFecDecoder(size_t dataShards, size_t parityShards);
+
+		// 输入一个fec包，数据包里的kcp包马上交给out，缺的数据包能恢复的时候也交给out
+		// out(const char* pkt, size_t len)；不是fec包返回false
+		template<typename F>
+		bool Decode(const char* data, size_t len, F&& out)
+		{
+			Packet pkt;
+			if (!parse(data, len, pkt)) {
+				return false;
+			}
+			if (pkt.flag == AN_FEC_TYPE_DATA) {
+				out(pkt.body + 2, pkt.size - 2);
+			}
+			Group* g = store(pkt);
+			if (g && g->num >= m_rs.DataShards() && !g->done)
+			{
+				g->done = true;
+				if (g->dataNum < m_rs.DataShards() && reconstruct(*g))
+				{
+					for (size_t i = 0; i < m_rs.DataShards(); i++)
+					{
+						if (g->present[i]) {
+							continue;
+						}
+						size_t size = 0;
+						if (recovered(*g, i, size)) {
+							out(reinterpret_cast<const char*>(g->bodies[i].data()) + 2, size - 2);
+						}
+					}
+				}
+			}
+			return true;
+		}
+
+	private:
+		// 同时在等的组数，更老的组的包直接丢掉，对应的kcp包交给重传
+		static constexpr size_t GROUPS = 4;
+
+		struct Packet {
+			uint32_t seq;
+			uint16_t flag;
+			const char* body;
+			size_t len;		// body长度
+			size_t size;	// 数据包的size字段
+		};
+
+		struct Group {
+			uint32_t id = 0;
+			bool used = false;
+			bool done = false;		// 数据齐了或者已经恢复过了
+			size_t num = 0;			// 收到的分片数
+			size_t dataNum = 0;		// 收到的数据分片数
+			size_t parityLen = 0;	// 校验包body的长度，恢复的时候所有分片按这个长度算
+			std::vector<bool> present;
+			std::vector<std::vector<uint8_t>> bodies;
+		};
+
+		bool parse(const char* data, size_t len, Packet& pkt);
+		// 存进对应的组，包太老或者重复了返回nullptr
+		Group* store(const Packet& pkt);
+		bool reconstruct(Group& g);
+		// 恢复出来的数据分片的size字段是否合法
+		bool recovered(Group& g, size_t idx, size_t& size);
+
+		ReedSolomon m_rs;
+		size_t m_shardNum;
+		Group m_groups[GROUPS];
+		std::unique_ptr<bool[]> m_present;
+		std::vector<uint8_t*> m_bodies;
+	};
+}
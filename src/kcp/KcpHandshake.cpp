@@ -0,0 +1,100 @@
+#include "KcpHandshake.h"
+#include "../utils/SipHash.h"
+
+#include <chrono>
+#include <cstring>
+#include <random>
+
+namespace AsioNet
+{
+	static void putU32(char* buf, uint32_t v)
+	{
+		v = asio::detail::socket_ops::host_to_network_long(v);
+		memcpy(buf, &v, sizeof(v));
+	}
+
+	static uint32_t getU32(const char* data)
+	{
+		uint32_t v = 0;
+		memcpy(&v, data, sizeof(v));
+		return asio::detail::socket_ops::network_to_host_long(v);
+	}
+
+	bool KcpHandshake::Is(const char* data, size_t len)
+	{
+		return len >= sizeof(uint32_t) && getU32(data) == 0;
+	}
+
+	size_t KcpHandshake::Encode(char* buf) const
+	{
+		putU32(buf, 0);
+		buf[4] = static_cast<char>(type);
+		putU32(buf + 5, service);
+		putU32(buf + 9, nonce);
+		putU32(buf + 13, conv);
+		putU32(buf + 17, static_cast<uint32_t>(cookie >> 32));
+		putU32(buf + 21, static_cast<uint32_t>(cookie));
+		return SIZE;
+	}
+
+	bool KcpHandshake::Decode(const char* data, size_t len)
+	{
+		if (len != SIZE || !Is(data, len)) {
+			return false;
+		}
+		uint8_t t = static_cast<uint8_t>(data[4]);
+		if (t < static_cast<uint8_t>(KcpHsType::HS_SYN) || t > static_cast<uint8_t>(KcpHsType::HS_COOKIE)) {
+			return false;
+		}
+		type = static_cast<KcpHsType>(t);
+		service = getU32(data + 5);
+		nonce = getU32(data + 9);
+		conv = getU32(data + 13);
+		cookie = (static_cast<uint64_t>(getU32(data + 17)) << 32) | getU32(data + 21);
+		return true;
+	}
+
+	KcpCookie::KcpCookie()
+	{
+		std::random_device rd;
+		m_k0 = (static_cast<uint64_t>(rd()) << 32) | rd();
+		m_k1 = (static_cast<uint64_t>(rd()) << 32) | rd();
+	}
+
+	uint64_t KcpCookie::window()
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>
+			(std::chrono::steady_clock::now().time_since_epoch()).count() / WINDOW_SEC;
+	}
+
+	uint64_t KcpCookie::make(uint64_t w, const asio::ip::udp::endpoint& from, uint32_t service, uint32_t nonce)
+	{
+		// 这个窗口的key
+		uint64_t k0 = SipHash(m_k0, m_k1, &w, sizeof(w));
+		uint64_t k1 = SipHash(m_k1, m_k0, &w, sizeof(w));
+
+		// ipv6(16B) | port(2B) | service(4B) | nonce(4B)，ipv4按映射的ipv6地址算
+		char buf[26];
+		auto addr = from.address();
+		auto ip = addr.is_v6() ? addr.to_v6().to_bytes() : asio::ip::make_address_v6(asio::ip::v4_mapped, addr.to_v4()).to_bytes();
+		uint16_t port = from.port();
+		memcpy(buf, ip.data(), 16);
+		memcpy(buf + 16, &port, sizeof(port));
+		memcpy(buf + 18, &service, sizeof(service));
+		memcpy(buf + 22, &nonce, sizeof(nonce));
+		uint64_t cookie = SipHash(k0, k1, buf, sizeof(buf));
+		// 0表示没有cookie
+		return cookie ? cookie : 1;
+	}
+
+	uint64_t KcpCookie::Make(const asio::ip::udp::endpoint& from, uint32_t service, uint32_t nonce)
+	{
+		return make(window(), from, service, nonce);
+	}
+
+	bool KcpCookie::Check(const asio::ip::udp::endpoint& from, uint32_t service, uint32_t nonce, uint64_t cookie)
+	{
+		uint64_t w = window();
+		return cookie && (cookie == make(w, from, service, nonce) || cookie == make(w - 1, from, service, nonce));
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "../utils/AsioNetDef.h"
+
+namespace AsioNet
+{
+	// kcp连接的握手，在kcp之前用裸udp包完成
+	// 包格式：0(4B) | type(1B) | service(4B) | nonce(4B) | conv(4B) | cookie(8B)，数字都是网络序
+	// 开头4个字节是kcp包里conv的位置，server分配的conv不会是0，所以conv为0的包就是握手包
+	// 1. client发SYN(带上Connect的conv作为service，随机的nonce，cookie为0)
+	// 2. server不分配任何东西，用(地址,service,nonce)算一个cookie回COOKIE
+	// 3. client带着cookie重发SYN，server校验通过才分配会话，回SYN_ACK
+	// 伪造源地址的包收不到COOKIE，也就拿不到会话；所有握手包一样长，server的回包不会比请求大
+	// SYN_ACK丢了client会重发SYN，server按(地址,nonce)认出重复的SYN，回同一个conv
+	enum class KcpHsType : uint8_t
+	{
+		HS_SYN = 1,
+		HS_SYN_ACK = 2,
+		HS_COOKIE = 3,
+	};
+
+	struct KcpHandshake
+	{
+		static constexpr size_t SIZE = 25;
+
+		KcpHsType type = KcpHsType::HS_SYN;
+		uint32_t service = 0;
+		uint32_t nonce = 0;
+		uint32_t conv = 0;		// 只有SYN_ACK里有
+		uint64_t cookie = 0;	// COOKIE和第二次的SYN里有
+
+		// 是不是握手包，只看开头的conv
+		static bool Is(const char* data, size_t len);
+
+		// buf至少SIZE，返回写入的长度
+		size_t Encode(char* buf) const;
+		// 长度或者type不对返回false
+		bool Decode(const char* data, size_t len);
+	};
+
+	// 无状态的握手cookie：SipHash(窗口key, 地址|端口|service|nonce)
+	// 窗口key由随机的主key和时间窗口的序号算出来，不用定时换key，也不用加锁
+	// 当前窗口和上一个窗口的cookie都认，有效期在WINDOW_SEC到2*WINDOW_SEC之间
+	class KcpCookie
+	{
+	public:
+		static constexpr uint64_t WINDOW_SEC = 30;
+
+		KcpCookie();
+
+		uint64_t Make(const asio::ip::udp::endpoint& from, uint32_t service, uint32_t nonce);
+		bool Check(const asio::ip::udp::endpoint& from, uint32_t service, uint32_t nonce, uint64_t cookie);
+
+	private:
+		static uint64_t window();
+		uint64_t make(uint64_t window, const asio::ip::udp::endpoint& from, uint32_t service, uint32_t nonce);
+
+		uint64_t m_k0;
+		uint64_t m_k1;
+	};
+}
@@ -3,7 +3,7 @@
 
 namespace AsioNet
 {
-	KcpNetMgr::KcpNetMgr(size_t th_num):m_isClose(false)
+	KcpNetMgr::KcpNetMgr(size_t th_num):m_isClose(false), m_scheduler(m_ctx, th_num)
 	{
 		for (size_t i = 0; i < th_num; i++)
 		{
@@ -32,37 +32,66 @@ namespace AsioNet
 		}
 	}
 
-	void KcpNetMgr::Connect(IEventPoller* poller,const std::string& ip, uint16_t port,uint32_t conv)
+	void KcpNetMgr::Connect(IEventPoller* poller,const std::string& ip, uint16_t port,uint32_t conv,const KcpOption& opt)
 	{
 		auto conn = std::make_shared<KcpConn>(m_ctx, poller);
 		// 连接并没有成功建立，这里不应该调用AddConn
 		conn->SetOwner(&m_connMgr);
+		conn->SetOption(opt);
+		conn->SetScheduler(&m_scheduler);
 		conn->Connect(ip, port, conv);
 	}
 
-	ServerKey KcpNetMgr::Serve(IEventPoller* poller, const std::string& ip,uint16_t port, uint32_t conv)
+	ServerKey KcpNetMgr::Serve(IEventPoller* poller, const std::string& ip,uint16_t port, uint32_t conv,const KcpOption& opt)
 	{
 		auto s = std::make_shared<KcpServer>(m_ctx, poller);
-		s->Serve(ip,port,conv);
+		s->SetOption(opt);
+		s->SetScheduler(&m_scheduler);
+		// 开了reusePort的话每个io线程一个socket
+		s->Serve(ip,port,conv,thPool.size());
 		m_serverMgr.AddServer(s);
 		return s->Key();
 	}
 
-	bool KcpNetMgr::Send(NetKey k, const char* data, size_t trans)
+	std::shared_ptr<KcpConn> KcpNetMgr::getConn(NetKey k)
 	{
 		auto conn = m_connMgr.GetConn(k);
 		if (conn) {
-			return conn->Write(data, trans);
+			return conn;
 		}
 
 		ServerKey sk = GetSvrKeyFromNetKey(k);
 		auto svr = m_serverMgr.GetServer(sk);
 		if(svr){
-			auto cl = svr->GetConn(k);
-			if (cl)
-			{
-				return cl->Write(data,trans);
-			}
+			return svr->GetConn(k);
+		}
+		return nullptr;
+	}
+
+	bool KcpNetMgr::Send(NetKey k, const char* data, size_t trans)
+	{
+		auto conn = getConn(k);
+		if (conn) {
+			return conn->Write(data, trans);
+		}
+		return false;
+	}
+
+	size_t KcpNetMgr::SendQueueSize(NetKey k)
+	{
+		auto conn = getConn(k);
+		if (conn) {
+			return conn->SendQueueSize();
+		}
+		return 0;
+	}
+
+	bool KcpNetMgr::SetProfile(NetKey k, const KcpProfile& profile)
+	{
+		auto conn = getConn(k);
+		if (conn) {
+			conn->SetProfile(profile);
+			return true;
 		}
 		return false;
 	}
@@ -3,6 +3,7 @@
 // #include "../utils/AsioNetDef.h"
 #include "../event/IEventPoller.h"
 #include "KcpServer.h"
+#include "KcpAllocator.h"
 
 namespace AsioNet
 {
@@ -19,17 +20,29 @@ namespace AsioNet
         ~KcpNetMgr();
 
         // ******************** 连接相关 ********************
-        ServerKey Serve(IEventPoller* poller,const std::string& ip,uint16_t port, uint32_t conv);
+        ServerKey Serve(IEventPoller* poller,const std::string& ip,uint16_t port, uint32_t conv,
+            const KcpOption& opt = KcpOption());
         void Broadcast(ServerKey, const char* data, size_t trans);
 
         // 怎样算连接成功还有待商榷
-        void Connect(IEventPoller* poller,const std::string& ip, uint16_t port, uint32_t conv);
+        void Connect(IEventPoller* poller,const std::string& ip, uint16_t port, uint32_t conv,
+            const KcpOption& opt = KcpOption());
         void Disconnect(NetKey);
         bool Send(NetKey, const char* data, size_t trans);
+
+        // kcp发送队列中堆积的字节数(估算)，连接不存在返回0
+        size_t SendQueueSize(NetKey);
+
+        // 单独改一个连接的kcp参数，比如从交互切到下发大文件，连接不存在返回false
+        bool SetProfile(NetKey, const KcpProfile&);
     private:
+        std::shared_ptr<KcpConn> getConn(NetKey);
+
         io_ctx m_ctx;
         std::atomic<bool> m_isClose;
         std::vector<std::thread> thPool;
+        // 所有连接的ikcp_update，每个io线程一个shard
+        KcpScheduler m_scheduler;
         KcpConnMgr m_connMgr;
         KcpServerMgr m_serverMgr;
     };
@@ -0,0 +1,114 @@
+#include "KcpScheduler.h"
+#include "KcpConn.h"
+#include "KcpSendBatch.h"
+
+namespace AsioNet
+{
+	KcpScheduler::KcpScheduler(io_ctx& ctx, size_t shardNum) :m_next(0)
+	{
+		shardNum = shardNum ? shardNum : 1;
+		uint32_t now = Clock();
+		for (size_t i = 0; i < shardNum; i++)
+		{
+			auto s = std::make_unique<Shard>(ctx);
+			s->wheel.resize(WHEEL_SIZE);
+			s->cur = now;
+			m_shards.push_back(std::move(s));
+		}
+	}
+
+	KcpScheduler::~KcpScheduler()
+	{
+		// io线程已经退出了，剩下的conn跟着时间轮一起释放
+		for (auto& s : m_shards) {
+			s->timer.cancel();
+		}
+	}
+
+	uint32_t KcpScheduler::Clock()
+	{
+		return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>
+			(std::chrono::steady_clock::now().time_since_epoch()).count());
+	}
+
+	size_t KcpScheduler::PickShard()
+	{
+		return m_next.fetch_add(1, std::memory_order_relaxed) % m_shards.size();
+	}
+
+	void KcpScheduler::Schedule(size_t shard, std::shared_ptr<KcpConn> conn, uint32_t at)
+	{
+		auto& s = *m_shards[shard % m_shards.size()];
+		_lock_guard_(s.lock);
+
+		// 用差值比较，时钟回绕也没问题
+		int32_t delta = static_cast<int32_t>(at - s.cur);
+		if (delta < 0) {
+			delta = 0;
+		}
+		if (delta >= static_cast<int32_t>(WHEEL_SIZE)) {
+			delta = WHEEL_SIZE - 1;
+		}
+		s.wheel[(s.cur + delta) & (WHEEL_SIZE - 1)].push_back(std::move(conn));
+		s.num++;
+
+		if (!s.armed)
+		{
+			s.armed = true;
+			arm(s);
+		}
+	}
+
+	void KcpScheduler::arm(Shard& s)
+	{
+		s.timer.expires_after(std::chrono::milliseconds(TICK_MS));
+		s.timer.async_wait([this, &s](const NetErr& ec) {
+			if (ec) {
+				return;
+			}
+			tick(s);
+			});
+	}
+
+	void KcpScheduler::tick(Shard& s)
+	{
+		uint32_t now = Clock();
+		{
+			_lock_guard_(s.lock);
+			// 线程被卡住了很久的话，最多转一圈就把所有格子都处理到了
+			uint32_t n = static_cast<int32_t>(now - s.cur) < 0 ? 0 : now - s.cur + 1;
+			if (n > WHEEL_SIZE) {
+				n = WHEEL_SIZE;
+			}
+			for (uint32_t i = 0; i < n; i++)
+			{
+				auto& slot = s.wheel[(s.cur + i) & (WHEEL_SIZE - 1)];
+				s.due.insert(s.due.end(), std::make_move_iterator(slot.begin()), std::make_move_iterator(slot.end()));
+				slot.clear();
+			}
+			if (n) {
+				s.cur = now + 1;
+			}
+			s.num -= s.due.size();
+		}
+
+		// 在锁外面update，KcpUpdate会调用Schedule重新放回轮子里
+		// 定时器的回调是串行的，due只有这里用
+		{
+			// 这个tick里所有连接输出的包攒起来用sendmmsg发
+			KcpSendBatch::Scope batch;
+			for (auto& conn : s.due) {
+				conn->KcpUpdate(now);
+			}
+		}
+		s.due.clear();
+
+		_lock_guard_(s.lock);
+		if (s.num) {
+			arm(s);
+		}
+		else {
+			s.armed = false;
+		}
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "../utils/AsioNetDef.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace AsioNet
+{
+	class KcpConn;
+
+	// 所有kcp连接共用的update调度器，代替每个conn一个timer
+	// 按io线程数分成多个shard，每个shard一个时间轮，只挂一个1ms的定时器
+	// 时间轮按ikcp_check给出的时间把conn放进对应的格子，到点了统一调用KcpUpdate
+	// 每个tick只取一次单调时钟，同一个tick里的conn共用这个时间
+	class KcpScheduler {
+	public:
+		KcpScheduler() = delete;
+		KcpScheduler(const KcpScheduler&) = delete;
+		KcpScheduler(KcpScheduler&&) = delete;
+		KcpScheduler& operator=(const KcpScheduler&) = delete;
+		KcpScheduler& operator=(KcpScheduler&&) = delete;
+
+		KcpScheduler(io_ctx& ctx, size_t shardNum);
+		~KcpScheduler();
+
+		// 单调时钟的毫秒数，给ikcp_update用，回绕没有关系
+		static uint32_t Clock();
+
+		// 给新的conn分配一个shard，轮流分配
+		size_t PickShard();
+
+		// at(Clock()的时间)到了之后在io线程里调用conn->KcpUpdate，早于当前时间的下一个tick就调用
+		// 超过时间轮一圈的按一圈算，到时候KcpUpdate会重新check
+		void Schedule(size_t shard, std::shared_ptr<KcpConn> conn, uint32_t at);
+
+	private:
+		static constexpr uint32_t TICK_MS = 1;
+		static constexpr uint32_t WHEEL_SIZE = 1024;	// 2的幂，kcp的interval最大5000ms，大于一圈的会提前唤醒一次
+
+		struct Shard {
+			Shard(io_ctx& ctx) :timer(ctx), cur(0), num(0), armed(false) {}
+
+			std::mutex lock;
+			asio::steady_timer timer;
+			std::vector<std::vector<std::shared_ptr<KcpConn>>> wheel;
+			std::vector<std::shared_ptr<KcpConn>> due;	// 只在tick里用，复用内存
+			uint32_t cur;	// 下一个要处理的格子对应的时间
+			size_t num;		// 轮子里的conn数量
+			bool armed;		// 定时器是否在等，需要持有lock
+		};
+
+		// 需要持有shard.lock
+		void arm(Shard& s);
+		void tick(Shard& s);
+
+		std::vector<std::unique_ptr<Shard>> m_shards;
+		std::atomic<size_t> m_next;
+	};
+}
@@ -0,0 +1,217 @@
+#include "KcpSendBatch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
+
+namespace AsioNet
+{
+	KcpSendBatch::KcpSendBatch() :m_depth(0)
+	{
+#ifdef __linux__
+		m_num = 0;
+		m_bytes = 0;
+		m_gsoOpen = false;
+#endif
+	}
+
+	KcpSendBatch& KcpSendBatch::Local()
+	{
+		// 缓冲区有将近100KB，不放在栈上
+		thread_local std::unique_ptr<KcpSendBatch> batch(new KcpSendBatch());
+		return *batch;
+	}
+
+	void KcpSendBatch::Begin()
+	{
+		m_depth++;
+	}
+
+	void KcpSendBatch::End()
+	{
+		if (m_depth && --m_depth == 0) {
+			Flush();
+		}
+	}
+
+#ifdef ASIONET_UDP_GSO
+	// 一般是空的，不为空的时候才加锁查
+	static std::mutex s_noGsoLock;
+	static std::unordered_set<int> s_noGso;
+	static std::atomic<size_t> s_noGsoNum{ 0 };
+
+	void KcpSendBatch::disableGso(int fd)
+	{
+		_lock_guard_(s_noGsoLock);
+		if (s_noGso.insert(fd).second) {
+			s_noGsoNum.store(s_noGso.size(), std::memory_order_release);
+		}
+	}
+
+	bool KcpSendBatch::gsoDisabled(int fd)
+	{
+		if (!s_noGsoNum.load(std::memory_order_acquire)) {
+			return false;
+		}
+		_lock_guard_(s_noGsoLock);
+		return s_noGso.count(fd) > 0;
+	}
+
+	void KcpSendBatch::sendSegments(size_t i)
+	{
+		const auto& hdr = m_hdrs[i].msg_hdr;
+		const char* data = static_cast<const char*>(m_iovs[i].iov_base);
+		size_t len = m_iovs[i].iov_len;
+		for (size_t off = 0; off < len; off += m_segSize[i])
+		{
+			size_t n = std::min<size_t>(m_segSize[i], len - off);
+			ssize_t ret = 0;
+			do {
+				ret = ::sendto(m_sock->native_handle(), data + off, n, MSG_DONTWAIT,
+					static_cast<const sockaddr*>(hdr.msg_name), hdr.msg_namelen);
+			} while (ret < 0 && errno == EINTR);
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return;
+			}
+		}
+	}
+#endif
+
+#ifdef __linux__
+	bool KcpSendBatch::canAppend(const UdpEndPoint* dest, size_t len)
+	{
+		if (!m_num || !m_gsoOpen) {
+			return false;
+		}
+		size_t i = m_num - 1;
+		if (len > m_segSize[i] || m_segNum[i] >= GSO_MAX_SEGS ||
+			m_iovs[i].iov_len + len > GSO_MAX_BYTES || m_bytes + len > sizeof(m_data)) {
+			return false;
+		}
+		return dest ? (m_hasDest[i] && m_dests[i] == *dest) : !m_hasDest[i];
+	}
+#endif
+
+	void KcpSendBatch::Send(const std::shared_ptr<UdpSock>& sock, const UdpEndPoint* dest, const char* buf, size_t len, bool gso)
+	{
+#ifdef __linux__
+		if (m_depth && len <= PACKET_SIZE)
+		{
+			if (m_num && m_sock != sock) {
+				Flush();
+			}
+#ifdef ASIONET_UDP_GSO
+			if (gso && gsoDisabled(sock->native_handle())) {
+				gso = false;
+			}
+			if (gso && canAppend(dest, len))
+			{
+				// 数据紧跟在最后一条消息后面，直接加长这条消息
+				size_t i = m_num - 1;
+				memcpy(m_data + m_bytes, buf, len);
+				m_bytes += len;
+				m_iovs[i].iov_len += len;
+				m_segNum[i]++;
+				// 只有最后一个包可以比segSize短
+				m_gsoOpen = len == m_segSize[i];
+				return;
+			}
+#endif
+			if (m_num == BATCH_SIZE || m_bytes + len > sizeof(m_data)) {
+				Flush();
+			}
+			if (!m_num) {
+				m_sock = sock;
+			}
+
+			size_t i = m_num;
+			memcpy(m_data + m_bytes, buf, len);
+			m_iovs[i].iov_base = m_data + m_bytes;
+			m_iovs[i].iov_len = len;
+			m_bytes += len;
+			m_hasDest[i] = dest != nullptr;
+			if (dest) {
+				m_dests[i] = *dest;
+			}
+			m_segSize[i] = static_cast<uint16_t>(len);
+			m_segNum[i] = 1;
+			m_gsoOpen = gso;
+			m_num++;
+			return;
+		}
+#endif
+		NetErr ec;
+		if (dest) {
+			sock->send_to(asio::buffer(buf, len), *dest, 0, ec);
+		}
+		else {
+			sock->send(asio::buffer(buf, len), 0, ec);
+		}
+	}
+
+	void KcpSendBatch::Flush()
+	{
+#ifdef __linux__
+		if (!m_num) {
+			return;
+		}
+		for (size_t i = 0; i < m_num; i++)
+		{
+			auto& hdr = m_hdrs[i].msg_hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			if (m_hasDest[i])
+			{
+				hdr.msg_name = m_dests[i].data();
+				hdr.msg_namelen = static_cast<socklen_t>(m_dests[i].size());
+			}
+			hdr.msg_iov = &m_iovs[i];
+			hdr.msg_iovlen = 1;
+#ifdef ASIONET_UDP_GSO
+			if (m_segNum[i] > 1)
+			{
+				// 告诉内核按segSize切开，最后一个包可以短一些
+				hdr.msg_control = m_ctrls[i];
+				hdr.msg_controllen = sizeof(m_ctrls[i]);
+				cmsghdr* cm = CMSG_FIRSTHDR(&hdr);
+				cm->cmsg_level = SOL_UDP;
+				cm->cmsg_type = UDP_SEGMENT;
+				cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+				memcpy(CMSG_DATA(cm), &m_segSize[i], sizeof(uint16_t));
+			}
+#endif
+		}
+
+		// udp发不出去就算了，kcp自己会重传
+		size_t sent = 0;
+		while (sent < m_num && m_sock->is_open())
+		{
+			int n = ::sendmmsg(m_sock->native_handle(), m_hdrs + sent, static_cast<unsigned int>(m_num - sent), MSG_DONTWAIT);
+			if (n <= 0)
+			{
+				if (n < 0 && errno == EINTR) {
+					continue;
+				}
+				// EAGAIN的时候发送缓冲区满了，剩下的丢掉；其他错误是某个包的问题，跳过它继续发
+				if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+					break;
+				}
+#ifdef ASIONET_UDP_GSO
+				// 不支持UDP_SEGMENT，跳过的话kcp会一直往这里重传，直到连接超时
+				if (n < 0 && (errno == EIO || errno == EINVAL) && m_segNum[sent] > 1)
+				{
+					disableGso(m_sock->native_handle());
+					sendSegments(sent);
+				}
+#endif
+				n = 1;
+			}
+			sent += n;
+		}
+		m_num = 0;
+		m_bytes = 0;
+		m_gsoOpen = false;
+		m_sock.reset();
+#endif
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "../utils/AsioNetDef.h"
+
+#include <memory>
+
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <sys/socket.h>
+#endif
+
+// udp的GSO/GRO需要linux 4.18/5.0+，系统头文件里没有就不编译
+#if defined(__linux__) && defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define ASIONET_UDP_GSO
+#endif
+
+namespace AsioNet
+{
+	using UdpEndPoint = asio::ip::udp::endpoint;
+	using UdpSock = asio::ip::udp::socket;
+
+	// kcp输出的udp包先攒在当前线程里，Begin/End之间的包在End的时候用sendmmsg一次发出去
+	// 不在Begin/End里面的包直接发送，和以前一样
+	// KcpScheduler每个tick的update包在一对Begin/End里，一个tick里所有连接的包合并成少数几次系统调用
+	// 开启gso时，发往同一个地址的连续等长的包(kcp的满包都是mtu大小)合成一条消息，由内核或网卡切分
+	// 网卡或者内核不支持UDP_SEGMENT时gso的消息会返回EIO/EINVAL，这个socket之后不再合包，这条消息拆成普通的包重发
+	// 只有linux有sendmmsg，其他平台一直是直接发送
+	class KcpSendBatch {
+	public:
+		KcpSendBatch(const KcpSendBatch&) = delete;
+		KcpSendBatch(KcpSendBatch&&) = delete;
+		KcpSendBatch& operator=(const KcpSendBatch&) = delete;
+		KcpSendBatch& operator=(KcpSendBatch&&) = delete;
+
+		// 当前线程的batch
+		static KcpSendBatch& Local();
+
+		// dest为nullptr时sock必须是connect过的
+		// gso:允许和上一个包合并成一个UDP_SEGMENT的消息
+		void Send(const std::shared_ptr<UdpSock>& sock, const UdpEndPoint* dest, const char* buf, size_t len, bool gso = false);
+
+		// 可以嵌套，最外层的End会Flush
+		void Begin();
+		void End();
+		void Flush();
+
+		// Begin/End的RAII
+		struct Scope {
+			Scope() { KcpSendBatch::Local().Begin(); }
+			~Scope() { KcpSendBatch::Local().End(); }
+		};
+
+	private:
+		KcpSendBatch();
+
+		static constexpr size_t BATCH_SIZE = 64;		// 一次sendmmsg最多的消息数
+		static constexpr size_t PACKET_SIZE = 1500;		// 不小于kcp的mtu
+		static constexpr size_t GSO_MAX_SEGS = 64;		// 内核限制一条消息最多切成64个包(UDP_MAX_SEGMENTS)
+		static constexpr size_t GSO_MAX_BYTES = 65000;	// 一条udp消息不能超过64KB
+
+		size_t m_depth;
+#ifdef __linux__
+		// 能不能往最后一条消息后面追加一个包
+		bool canAppend(const UdpEndPoint* dest, size_t len);
+
+#ifdef ASIONET_UDP_GSO
+		// 把第i条gso消息按segSize拆开，一个包一个包地发
+		void sendSegments(size_t i);
+		// 按fd记录关掉了gso的socket，fd被新socket复用的话新socket也不合包
+		static void disableGso(int fd);
+		static bool gsoDisabled(int fd);
+#endif
+
+		// 同一个socket的包才能一起发，换socket的时候先把前面的发掉
+		std::shared_ptr<UdpSock> m_sock;
+		size_t m_num;		// 消息数
+		size_t m_bytes;		// m_data里用掉的字节数，消息的数据在m_data里是连续的
+		bool m_gsoOpen;		// 最后一条消息是gso的，而且还没有追加过短包
+		mmsghdr m_hdrs[BATCH_SIZE];
+		iovec m_iovs[BATCH_SIZE];
+		UdpEndPoint m_dests[BATCH_SIZE];
+		bool m_hasDest[BATCH_SIZE];
+		uint16_t m_segSize[BATCH_SIZE];
+		uint16_t m_segNum[BATCH_SIZE];
+		char m_ctrls[BATCH_SIZE][CMSG_SPACE(sizeof(uint16_t))];
+		char m_data[BATCH_SIZE * PACKET_SIZE];
+#endif
+	};
+}
@@ -1,80 +1,344 @@
 #include "KcpServer.h"
+#include "../utils/SipHash.h"
+
+#include <random>
 
 namespace AsioNet
 {
 	KcpServer::KcpServer(io_ctx& ctx,IEventPoller* p):
-	ptr_poller(p),m_conv(0)
+	m_ctx(ctx),m_service(0),m_tagSeq(0),ptr_poller(p),ptr_scheduler(nullptr)
 	{
-		m_sock = std::make_shared<UdpSock>(ctx);
-		memset(m_kcpBuffer, 0, sizeof(m_kcpBuffer));
 		m_key = GenSvrKey();
+		std::random_device rd;
+		m_tagK0 = (static_cast<uint64_t>(rd()) << 32) | rd();
+		m_tagK1 = (static_cast<uint64_t>(rd()) << 32) | rd();
 	}
 
 	KcpServer::~KcpServer()
 	{
+		// 会话的owner是server，server没了之前先关掉，Close会回调DelConn
+		std::vector<std::shared_ptr<KcpConn>> conns;
+		m_sessions.ForEach([&conns](Session& s) {
+			conns.push_back(s.conn);
+			});
+		for (auto& conn : conns) {
+			conn->Close();
+		}
 	}
 
-	void KcpServer::Serve(const std::string& ip,int16_t port,uint32_t conv)
+	void KcpServer::Serve(const std::string& ip,int16_t port,uint32_t conv,size_t shardNum)
 	{
-		if(m_conv){
+		if(!m_shards.empty()){
 			return;
 		}	
 		UdpEndPoint ep(asio::ip::address_v4().from_string(ip), port);
-		m_sock->open(ep.protocol());
-		m_sock->bind(ep);	// bind to local addr
 
-		m_conv = conv;
-		readLoop();
+#if defined(__linux__) && defined(SO_REUSEPORT)
+		bool reusePort = m_option.reusePort && shardNum > 1;
+#else
+		bool reusePort = false;
+#endif
+		if (!reusePort) {
+			shardNum = 1;
+		}
+		for (size_t i = 0; i < shardNum; i++)
+		{
+			auto shard = std::make_unique<Shard>(m_ctx);
+			open(*shard, ep, reusePort);
+			// 端口是0的时候第一个socket绑定之后才知道真正的端口
+			if (!ep.port()) {
+				ep = shard->sock->local_endpoint();
+			}
+			m_shards.push_back(std::move(shard));
+		}
+
+		m_service = conv;
+		for (auto& shard : m_shards) {
+			readLoop(*shard);
+		}
+	}
+
+	void KcpServer::open(Shard& shard, const UdpEndPoint& ep, bool reusePort)
+	{
+		memset(shard.kcpBuffer, 0, sizeof(shard.kcpBuffer));
+		shard.sock->open(ep.protocol());
+#if defined(__linux__) && defined(SO_REUSEPORT)
+		if (reusePort)
+		{
+			using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+			shard.sock->set_option(reuse_port(true));
+		}
+#endif
+		shard.sock->bind(ep);	// bind to local addr
+
+#ifdef __linux__
+#ifdef ASIONET_UDP_GSO
+		if (m_option.udpOffload)
+		{
+			int on = 1;
+			shard.gro = ::setsockopt(shard.sock->native_handle(), SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+			if (shard.gro) {
+				shard.recvBufSize = 65536;
+			}
+		}
+#endif
+		shard.recvBufs.reset(new char[Shard::RECV_BATCH * shard.recvBufSize]);
+#endif
 	}
 
-	void KcpServer::readLoop()
+	void KcpServer::readLoop(Shard& shard)
 	{
-		m_sock->async_receive_from(asio::buffer(m_kcpBuffer, sizeof(m_kcpBuffer)), m_tempRecevier,
-        [self = shared_from_this()](const NetErr& ec, size_t trans){
+		// shard属于server，回调里持有server就够了
+#ifdef __linux__
+		// 等socket可读，然后一次系统调用收一批，而不是每个包一次async_receive_from
+		shard.sock->async_wait(asio::socket_base::wait_read,
+		[self = shared_from_this(), &shard](const NetErr& ec){
+			if (ec){
+				return;
+			}
+			self->recvBatch(shard);
+			self->readLoop(shard);
+		});
+#else
+		shard.sock->async_receive_from(asio::buffer(shard.kcpBuffer, sizeof(shard.kcpBuffer)), shard.tempRecevier,
+        [self = shared_from_this(), &shard](const NetErr& ec, size_t trans){
             if (ec){
                 return;
             }
+			self->onPacket(shard, shard.kcpBuffer, trans, shard.tempRecevier);
+            self->readLoop(shard);
+        });
+#endif
+	}
 
-			if(trans < sizeof(IKCP_OVERHEAD) || trans > IKCP_MTU){
-				self->readLoop();
+#ifdef __linux__
+	void KcpServer::recvBatch(Shard& shard)
+	{
+		// 一次可读最多收几批，别让一个很忙的server一直占着io线程
+		const int MAX_ROUND = 4;
+		const size_t RECV_BATCH = Shard::RECV_BATCH;
+		int fd = shard.sock->native_handle();
+		for (int round = 0; round < MAX_ROUND; round++)
+		{
+			for (size_t i = 0; i < RECV_BATCH; i++)
+			{
+				shard.recvIovs[i].iov_base = shard.recvBufs.get() + i * shard.recvBufSize;
+				shard.recvIovs[i].iov_len = shard.recvBufSize;
+				auto& hdr = shard.recvHdrs[i].msg_hdr;
+				memset(&hdr, 0, sizeof(hdr));
+				hdr.msg_name = &shard.recvAddrs[i];
+				hdr.msg_namelen = sizeof(shard.recvAddrs[i]);
+				hdr.msg_iov = &shard.recvIovs[i];
+				hdr.msg_iovlen = 1;
+				if (shard.gro)
+				{
+					hdr.msg_control = shard.recvCtrls[i];
+					hdr.msg_controllen = sizeof(shard.recvCtrls[i]);
+				}
+			}
+
+			int n = ::recvmmsg(fd, shard.recvHdrs, RECV_BATCH, MSG_DONTWAIT, nullptr);
+			if (n <= 0) {
 				return;
 			}
+			for (int i = 0; i < n; i++)
+			{
+				UdpEndPoint remote;
+				auto& hdr = shard.recvHdrs[i].msg_hdr;
+				if (hdr.msg_namelen > remote.capacity()) {
+					continue;
+				}
+				memcpy(remote.data(), &shard.recvAddrs[i], hdr.msg_namelen);
+				remote.resize(hdr.msg_namelen);
 
-			// 一个udp上面可能依赖了多个kcp，这里禁止客户端的这种行为
-			// ip:port确定唯一客户端,符合认知
-			if(self->m_conv != ikcp_getconv(self->m_kcpBuffer)){
+				const char* data = static_cast<const char*>(shard.recvIovs[i].iov_base);
+				size_t len = shard.recvHdrs[i].msg_len;
+				size_t segSize = len;
+#ifdef ASIONET_UDP_GSO
+				// GRO合并的包带着原来每个包的大小，最后一个可能短一些
+				for (auto cm = shard.gro ? CMSG_FIRSTHDR(&hdr) : nullptr; cm; cm = CMSG_NXTHDR(&hdr, cm))
+				{
+					if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO)
+					{
+						int gso = 0;
+						memcpy(&gso, CMSG_DATA(cm), sizeof(gso));
+						if (gso > 0) {
+							segSize = static_cast<size_t>(gso);
+						}
+					}
+				}
+#endif
+				while (len)
+				{
+					size_t seg = len < segSize ? len : segSize;
+					onPacket(shard, data, seg, remote);
+					data += seg;
+					len -= seg;
+				}
+			}
+			if (n < static_cast<int>(RECV_BATCH)) {
 				return;
 			}
+		}
+	}
+#endif
 
-			auto& remote = self->m_tempRecevier;
-			auto conn = self->m_conns.GetConn(remote);
+	void KcpServer::onPacket(Shard& shard, const char* data, size_t trans, const UdpEndPoint& remote)
+	{
+		if (KcpHandshake::Is(data, trans))
+		{
+			KcpHandshake hs;
+			if (hs.Decode(data, trans) && hs.type == KcpHsType::HS_SYN) {
+				onSyn(shard, hs, remote);
+			}
+			return;
+		}
 
-			if (!conn)
-			{
-				// 这里应该还有校验,不然这里如果被攻击了,那么就会一直创建conn,把服务器资源给爆了
-				conn = std::make_shared<KcpConn>(self->m_sock, remote, self->ptr_poller, self->m_conv);
-				conn->KcpUpdate();
-				self->m_conns.AddConn(conn);
+		if(trans < IKCP_OVERHEAD || trans > IKCP_MTU){
+			return;
+		}
+
+		// 按conv找会话，不看地址
+		std::shared_ptr<KcpConn> conn;
+		visitSession(ikcp_getconv(data), [&conn](Session& s) {
+			conn = s.conn;
+			});
+		if(conn){
+			conn->KcpInput(data,trans,&remote);
+		}
+	}
+
+	void KcpServer::onSyn(Shard& shard, const KcpHandshake& syn, const UdpEndPoint& remote)
+	{
+		if (syn.service != m_service) {
+			return;
+		}
+
+		// 证明对端能收到发往这个地址的包之前，什么都不分配
+		if (!m_cookie.Check(remote, syn.service, syn.nonce, syn.cookie))
+		{
+			KcpHandshake hs;
+			hs.type = KcpHsType::HS_COOKIE;
+			hs.service = m_service;
+			hs.nonce = syn.nonce;
+			hs.cookie = m_cookie.Make(remote, syn.service, syn.nonce);
+			sendHandshake(shard, hs, remote);
+			return;
+		}
 
-				self->ptr_poller->PushAccept(conn->Key(), remote.address().to_string(), remote.port());
+		uint32_t conv = 0;
+		NetKey key = 0;
+		std::shared_ptr<KcpConn> conn;
+		{
+			_lock_guard_(m_synLock);
+			// SYN_ACK丢了，client重发的SYN，回原来的conv
+			auto itr = m_synConvs.find(remote);
+			if (itr != m_synConvs.end())
+			{
+				uint32_t old = itr->second;
+				visitSession(old, [&conv, old, &syn](Session& s) {
+					if (s.nonce == syn.nonce) {
+						conv = old;
+					}
+					});
 			}
-			
-			if(conn){
-				conn->KcpInput(self->m_kcpBuffer,trans);
+			if (!conv)
+			{
+				conn = std::make_shared<KcpConn>(shard.sock, remote, ptr_poller);
+				uint32_t tag = newTag();
+				auto slot = m_sessions.Add(Session{ conn, remote, syn.nonce, tag });
+				if (!slot) {
+					return;
+				}
+				conv = tag << INDEX_BITS | static_cast<uint32_t>(slot & INDEX_MASK);
+				key = (static_cast<NetKey>(m_key) << 32) | slot;
+				// 同一个地址的旧会话(client重启了)留在表里，等上层断开
+				m_synConvs[remote] = conv;
 			}
+		}
 
-            self->readLoop();
-        });
+		if (conn)
+		{
+			// 发出SYN_ACK之前kcp就要准备好
+			conn->SetOption(m_option);
+			conn->SetScheduler(ptr_scheduler);
+			conn->SetOwner(this);
+			conn->Accept(key, conv);
+			conn->KcpUpdate(KcpScheduler::Clock());
+
+			ptr_poller->PushAccept(conn->Key(), remote.address().to_string(), remote.port());
+		}
 
+		KcpHandshake ack;
+		ack.type = KcpHsType::HS_SYN_ACK;
+		ack.service = m_service;
+		ack.nonce = syn.nonce;
+		ack.conv = conv;
+		sendHandshake(shard, ack, remote);
+	}
+
+	uint32_t KcpServer::newTag()
+	{
+		// tag不为0，下标0的会话的conv也不会是0(握手包)
+		uint32_t tag = 0;
+		while (!tag)
+		{
+			uint64_t seq = m_tagSeq++;
+			tag = static_cast<uint32_t>(SipHash(m_tagK0, m_tagK1, &seq, sizeof(seq))) >> INDEX_BITS;
+		}
+		return tag;
+	}
+
+	void KcpServer::sendHandshake(Shard& shard, const KcpHandshake& hs, const UdpEndPoint& remote)
+	{
+		char buf[KcpHandshake::SIZE];
+		KcpSendBatch::Local().Send(shard.sock, &remote, buf, hs.Encode(buf));
 	}
 	
 	void KcpServer::err_handler()
 	{
 	}
 
+	void KcpServer::SetOption(const KcpOption& opt)
+	{
+		m_option = opt;
+	}
+
+	void KcpServer::SetScheduler(KcpScheduler* s)
+	{
+		ptr_scheduler = s;
+	}
+
+	void KcpServer::AddConn(std::shared_ptr<KcpConn>)
+	{
+	}
+
+	void KcpServer::DelConn(NetKey key)
+	{
+		if (GetSvrKeyFromNetKey(key) != m_key) {
+			return;
+		}
+		uint32_t slot = static_cast<uint32_t>(key);
+		uint32_t conv = 0;
+		UdpEndPoint from;
+		if (!m_sessions.Visit(slot, [slot, &conv, &from](Session& s) {
+			conv = convOf(s, slot & INDEX_MASK);
+			from = s.from;
+			})) {
+			return;
+		}
+		m_sessions.Del(slot);
+
+		_lock_guard_(m_synLock);
+		auto itr = m_synConvs.find(from);
+		if (itr != m_synConvs.end() && itr->second == conv) {
+			m_synConvs.erase(itr);
+		}
+	}
+
 	bool KcpServer::Write(NetKey key,const char* data, size_t trans)
 	{
-		auto conn = m_conns.GetConn(key);
+		auto conn = GetConn(key);
 		if (conn)
 		{
 			return conn->Write(data, trans);
@@ -89,17 +353,29 @@ namespace AsioNet
 
 	std::shared_ptr<KcpConn> KcpServer::GetConn(NetKey key)
 	{
-		return m_conns.GetConn(key);
+		if (GetSvrKeyFromNetKey(key) != m_key) {
+			return nullptr;
+		}
+		std::shared_ptr<KcpConn> conn;
+		m_sessions.Visit(static_cast<uint32_t>(key), [&conn](Session& s) {
+			conn = s.conn;
+			});
+		return conn;
 	}
 
 	void KcpServer::Broadcast(const char* data, size_t trans)
 	{
-		m_conns.Broadcast(data,trans);
+		m_sessions.ForEach([data, trans](Session& s) {
+			s.conn->Write(data,trans);
+			});
 	}
 
 	void KcpServer::Disconnect(NetKey k)
 	{
-		return m_conns.Disconnect(k);
+		auto conn = GetConn(k);
+		if (conn) {
+			conn->Close();
+		}
 	}
 
 }
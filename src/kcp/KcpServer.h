@@ -2,12 +2,16 @@
 
 #include "./KcpConn.h"
 #include "../utils/utils.h"
+#include "../utils/SlotMap.h"
 #include <unordered_map>
+#include <vector>
 
 namespace AsioNet
 {
-	// ikcp_allocator:可以考虑接管内存管理
-	class KcpServer : public std::enable_shared_from_this<KcpServer>
+	// 会话的conv由server分配，低位是会话表的下标，高位是随机的tag，收包的时候按conv一次下标寻址找到会话，再比对整个conv，不加锁
+	// 会话的NetKey = ServerKey << 32 | 会话表的key(带代数)，按NetKey找会话也是一次下标寻址
+	// 会话不和地址绑定，NAT重新映射之后从新地址来的包照样能找到会话，但是只有带新数据的包才能让会话换地址(见KcpConn::KcpInput)
+	class KcpServer : public std::enable_shared_from_this<KcpServer>, public IKcpConnOwner
 	{
 	public:
 		KcpServer() = delete;
@@ -20,7 +24,15 @@ namespace AsioNet
 
 		~KcpServer();
 
-		void Serve(const std::string& ip, int16_t port, uint32_t conv);
+		// conv:握手时校验的服务号，client Connect的conv要和它一样
+		// shardNum:option里开了reusePort时socket的数量，一般等于io线程数
+		void Serve(const std::string& ip, int16_t port, uint32_t conv, size_t shardNum = 1);
+
+		// 对之后建立的连接生效
+		void SetOption(const KcpOption&);
+
+		// 连接的ikcp_update由这个调度器驱动，Serve之前设置
+		void SetScheduler(KcpScheduler*);
 		
 		bool Write(NetKey,const char* data, size_t trans);
 
@@ -31,18 +43,101 @@ namespace AsioNet
 		void Disconnect(NetKey);
 
 		ServerKey Key();
+
+		// IKcpConnOwner，会话在握手的时候就加进表里了，AddConn什么都不做
+		void AddConn(std::shared_ptr<KcpConn>) override;
+		void DelConn(NetKey) override;
 	protected:
-		void readLoop();
+		// 一个udp socket和它上面的连接，不开reusePort的时候只有一个
+		struct Shard {
+			Shard(io_ctx& ctx) :sock(std::make_shared<UdpSock>(ctx)) {}
+
+			std::shared_ptr<UdpSock> sock;
+			UdpEndPoint tempRecevier;	// 每次收到udp包时候的对端地址
+			char kcpBuffer[AN_KCP_BUFFER_SIZE];
+#ifdef __linux__
+			// recvmmsg用的缓冲区，只在这个shard的readLoop里访问，Serve的时候分配
+			// 开启GRO时一次可能收到内核合并好的64KB，每个缓冲区都要按64KB分配
+			static constexpr size_t RECV_BATCH = 32;
+			mmsghdr recvHdrs[RECV_BATCH];
+			iovec recvIovs[RECV_BATCH];
+			sockaddr_storage recvAddrs[RECV_BATCH];
+			char recvCtrls[RECV_BATCH][CMSG_SPACE(sizeof(int))];
+			std::unique_ptr<char[]> recvBufs;
+			size_t recvBufSize = AN_KCP_BUFFER_SIZE;
+			bool gro = false;
+#endif
+		};
+
+		// 会话表里的元素，from/nonce用来认出重复的SYN，tag是conv的高位
+		struct Session {
+			std::shared_ptr<KcpConn> conn;
+			UdpEndPoint from;
+			uint32_t nonce;
+			uint32_t tag;
+		};
+		// 会话表的key：18位下标，最多26万个会话；14位代数，slot复用16383次之后NetKey才会重复
+		// conv：高14位是随机的tag(不为0)，低18位是下标；下标是按顺序分配的，不加tag的话看到自己的conv就能猜出别人的
+		// conv里放不下代数，slot复用之后旧conv的包只有tag碰巧一样才会落到新会话上
+		static constexpr uint32_t INDEX_BITS = 18;
+		static constexpr uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+		using SessionTable = SlotMap<Session, INDEX_BITS, 32 - INDEX_BITS>;
+
+		static uint32_t convOf(const Session& s, uint32_t idx)
+		{
+			return s.tag << INDEX_BITS | idx;
+		}
+
+		// 按conv找会话，下标上的会话的conv不是这个conv返回false
+		template<class F>
+		bool visitSession(uint32_t conv, F&& f)
+		{
+			uint32_t idx = conv & INDEX_MASK;
+			bool hit = false;
+			m_sessions.VisitIndex(idx, [conv, idx, &hit, &f](Session& s) {
+				if (convOf(s, idx) == conv)
+				{
+					hit = true;
+					f(s);
+				}
+				});
+			return hit;
+		}
+		// 新会话的tag，需要持有m_synLock
+		uint32_t newTag();
+
+		// 打开、绑定socket，失败抛异常
+		void open(Shard&, const UdpEndPoint&, bool reusePort);
+		void readLoop(Shard&);
+		// 收到一个udp包，找到(或者新建)对应的conn交给kcp
+		void onPacket(Shard&, const char* data, size_t trans, const UdpEndPoint& remote);
+		// 收到SYN，没有cookie(或者cookie不对)回COOKIE，cookie对了才分配会话，回SYN_ACK
+		void onSyn(Shard&, const KcpHandshake&, const UdpEndPoint& remote);
+		void sendHandshake(Shard&, const KcpHandshake&, const UdpEndPoint& remote);
+#ifdef __linux__
+		// socket可读之后用recvmmsg一次收一批
+		void recvBatch(Shard&);
+#endif
 		void err_handler();
 	private:
-		std::shared_ptr<UdpSock>	m_sock;		// underlying sock
-		UdpEndPoint m_tempRecevier;	// 每次收到udp包时候的对端地址
-		char m_kcpBuffer[AN_KCP_BUFFER_SIZE];
+		io_ctx& m_ctx;
+		std::vector<std::unique_ptr<Shard>> m_shards;	// Serve之后不再变化
 		ServerKey m_key;
-		uint32_t m_conv;
+		uint32_t m_service;
+
+		SessionTable m_sessions;
+		KcpCookie m_cookie;
+		// 握手的地址 -> conv，只在握手和删除会话的时候用
+		std::mutex m_synLock;
+		std::unordered_map<UdpEndPoint, uint32_t> m_synConvs;
+		// tag = SipHash(随机key, 序号)，对端看到再多的conv也推不出下一个tag，需要持有m_synLock
+		uint64_t m_tagK0;
+		uint64_t m_tagK1;
+		uint64_t m_tagSeq;
 
-		KcpConnMgr m_conns;
 		IEventPoller* ptr_poller;
+		KcpScheduler* ptr_scheduler;
+		KcpOption m_option;
 	};
 
     class KcpServerMgr{
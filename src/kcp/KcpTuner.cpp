@@ -0,0 +1,118 @@
+#include "KcpTuner.h"
+
+#include <algorithm>
+
+namespace AsioNet
+{
+	void KcpTuner::Reset(ikcpcb* kcp, const KcpProfile& profile, const KcpAdaptiveOption& opt, int fecOverhead)
+	{
+		m_profile = profile;
+		m_opt = opt;
+		m_idle = false;
+		m_active = false;
+		m_limited = false;
+		m_started = false;
+
+		ikcp_nodelay(kcp, profile.nodelay, profile.interval, profile.resend, profile.nc);
+		ikcp_wndsize(kcp, profile.sndWnd, profile.rcvWnd);
+		ikcp_setmtu(kcp, profile.mtu - fecOverhead);
+	}
+
+	void KcpTuner::Wake(ikcpcb* kcp)
+	{
+		m_active = true;
+		if (!m_idle) {
+			return;
+		}
+		m_idle = false;
+		ikcp_interval(kcp, m_profile.interval);
+		// 调度器里这个conn还是按idleInterval排的，先flush把数据和ack发出去
+		ikcp_flush(kcp);
+	}
+
+	void KcpTuner::Update(ikcpcb* kcp, uint32_t now)
+	{
+		if (!m_opt.enable) {
+			return;
+		}
+		if (!m_started)
+		{
+			m_started = true;
+			m_periodStart = now;
+			m_lastXmit = kcp->xmit;
+			m_lastSndNxt = kcp->snd_nxt;
+			m_lastRcvNxt = kcp->rcv_nxt;
+			return;
+		}
+		// 发送队列里有等窗口的分片
+		if (kcp->nsnd_que > 0) {
+			m_limited = true;
+		}
+		if (static_cast<int32_t>(now - m_periodStart) < static_cast<int32_t>(m_opt.period)) {
+			return;
+		}
+		sample(kcp);
+		m_periodStart = now;
+	}
+
+	void KcpTuner::sample(ikcpcb* kcp)
+	{
+		// 这个周期新发的分片、重传的分片、收到的分片
+		uint32_t xmit = kcp->xmit - m_lastXmit;
+		uint32_t sent = kcp->snd_nxt - m_lastSndNxt;
+		uint32_t recv = kcp->rcv_nxt - m_lastRcvNxt;
+		m_lastXmit = kcp->xmit;
+		m_lastSndNxt = kcp->snd_nxt;
+		m_lastRcvNxt = kcp->rcv_nxt;
+
+		bool active = m_active || sent || recv || kcp->nsnd_buf || kcp->nsnd_que;
+		bool limited = m_limited;
+		m_active = false;
+		m_limited = false;
+
+		if (!active)
+		{
+			// 空闲：窗口回到profile，interval放大
+			if (!m_idle)
+			{
+				m_idle = true;
+				ikcp_wndsize(kcp, m_profile.sndWnd, m_profile.rcvWnd);
+				ikcp_nodelay(kcp, -1, m_opt.idleInterval, m_profile.resend, -1);
+			}
+			return;
+		}
+		if (m_idle)
+		{
+			m_idle = false;
+			ikcp_interval(kcp, m_profile.interval);
+		}
+
+		uint32_t lossPermille = (sent + xmit) ? xmit * 1000 / (sent + xmit) : 0;
+		bool lossy = lossPermille >= m_opt.lossHigh;
+
+		int snd = static_cast<int>(kcp->snd_wnd);
+		if (lossy) {
+			snd = std::max(m_opt.minWnd, snd / 2);
+		}
+		else if (limited && lossPermille < m_opt.lossHigh / 4) {
+			snd = std::min(m_opt.maxWnd, snd * 2);
+		}
+
+		// 一个rtt里收到的分片超过接收窗口的一半，对端很可能被我们的窗口卡住了
+		int rcv = static_cast<int>(kcp->rcv_wnd);
+		uint32_t srtt = kcp->rx_srtt > 0 ? static_cast<uint32_t>(kcp->rx_srtt) : 1;
+		uint64_t perRtt = static_cast<uint64_t>(recv) * srtt / m_opt.period;
+		if (perRtt * 2 >= static_cast<uint64_t>(rcv)) {
+			rcv = std::min(m_opt.maxWnd, rcv * 2);
+		}
+		if (snd != static_cast<int>(kcp->snd_wnd) || rcv != static_cast<int>(kcp->rcv_wnd)) {
+			ikcp_wndsize(kcp, snd, rcv);
+		}
+
+		// 丢包多的时候被跳过一次就重传，不等超时
+		int resend = lossy && m_profile.resend ? 1 : m_profile.resend;
+		if (kcp->fastresend != resend) {
+			ikcp_nodelay(kcp, -1, -1, resend, -1);
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <ikcp.h>
+#include <stdint.h>
+
+namespace AsioNet
+{
+	// kcp的参数，含义见ikcp_nodelay/ikcp_wndsize/ikcp_setmtu
+	// 默认值就是以前写死的参数，窗口是kcp自己的默认值
+	struct KcpProfile
+	{
+		int nodelay = 1;
+		int interval = 10;		// ms，ikcp_update的间隔
+		int resend = 2;			// 快速重传：被跳过几次就重传，0关闭
+		int nc = 1;				// 1关闭拥塞控制
+		int sndWnd = 32;
+		int rcvWnd = 128;
+		int mtu = 1400;			// udp包的大小，不能超过IKCP_MTU，开了fec的话kcp自己的mtu再减掉fec包头
+
+		// 低延迟的小包交互，比如战斗同步
+		static KcpProfile Fast()
+		{
+			KcpProfile p;
+			p.sndWnd = 128;
+			p.rcvWnd = 128;
+			return p;
+		}
+		// 大块数据，比如下发地图、回放
+		static KcpProfile Bulk()
+		{
+			KcpProfile p;
+			p.interval = 20;
+			p.sndWnd = 1024;
+			p.rcvWnd = 1024;
+			return p;
+		}
+		// 不在乎延迟的后台连接，省cpu
+		static KcpProfile Lazy()
+		{
+			KcpProfile p;
+			p.nodelay = 0;
+			p.interval = 40;
+			p.resend = 0;
+			return p;
+		}
+	};
+
+	// 自适应调参，每period毫秒看一次这段时间的收发情况
+	// 窗口：发送被窗口卡住并且重传率低时翻倍，重传率高时减半；收到的太快把接收窗口占满一半时接收窗口翻倍
+	// 快速重传：重传率高时改成被跳过一次就重传
+	// 空闲：一个周期没有收发，interval放大到idleInterval；有收发的时候马上恢复并flush
+	struct KcpAdaptiveOption
+	{
+		bool enable = false;
+		uint32_t period = 1000;			// ms
+		int minWnd = 32;
+		int maxWnd = 1024;
+		int idleInterval = 100;			// ms
+		uint32_t lossHigh = 100;		// 重传率高于千分之lossHigh算高
+	};
+
+	// 一个连接的调参状态，所有接口都要持有conn的m_kcpLock
+	class KcpTuner
+	{
+	public:
+		// 按profile设置kcp的参数，窗口、interval等从profile重新开始调
+		void Reset(ikcpcb* kcp, const KcpProfile& profile, const KcpAdaptiveOption& opt, int fecOverhead);
+
+		// 每次ikcp_update之后调用，到了周期就调整
+		void Update(ikcpcb* kcp, uint32_t now);
+
+		// 有新的数据要发或者收到了包，空闲状态下马上恢复interval并flush，免得等一个idleInterval
+		void Wake(ikcpcb* kcp);
+
+	private:
+		void sample(ikcpcb* kcp);
+
+		KcpProfile m_profile;
+		KcpAdaptiveOption m_opt;
+		bool m_idle = false;
+		bool m_active = false;		// 这个周期里有没有收发
+		bool m_limited = false;		// 这个周期里发送有没有被窗口卡住
+		uint32_t m_periodStart = 0;
+		bool m_started = false;
+		uint32_t m_lastXmit = 0;
+		uint32_t m_lastSndNxt = 0;
+		uint32_t m_lastRcvNxt = 0;
+	};
+}
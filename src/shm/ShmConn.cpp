@@ -0,0 +1,308 @@
+#include "ShmConn.h"
+
+#ifdef __linux__
+
+#include "../utils/utils.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace AsioNet
+{
+	static inline void cpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#endif
+	}
+
+	static uint32_t roundUpPow2(uint32_t v)
+	{
+		uint32_t cap = 1;
+		while (cap < v) {
+			cap <<= 1;
+		}
+		return cap;
+	}
+
+	ShmConn::ShmConn(IEventPoller* p) :
+		m_mode(ShmConnMode::SCM_CLIENT), ptr_seg(nullptr), m_mapSize(0), m_cap(0),
+		m_key(0), m_svr(0), m_running(false), ptr_poller(p), ptr_owner(nullptr)
+	{
+	}
+
+	ShmConn::~ShmConn()
+	{
+		Stop();
+		unmapSegment();
+		if (m_mode == ShmConnMode::SCM_SERVER && !m_name.empty()) {
+			shm_unlink(m_name.c_str());
+		}
+	}
+
+	bool ShmConn::Serve(const std::string& name, uint32_t capacity, ServerKey svr)
+	{
+		if (m_running) {
+			return false;
+		}
+		m_name = name;
+		m_mode = ShmConnMode::SCM_SERVER;
+		m_svr = svr;
+		// 至少能放下两个最大的帧
+		const uint32_t minCap = 2 * (sizeof(AN_Msg::len) + AN_MSG_MAX_SIZE);
+		m_cap = roundUpPow2(capacity > minCap ? capacity : minCap);
+		if (!createSegment()) {
+			return false;
+		}
+
+		m_running = true;
+		m_thread = std::thread(&ShmConn::serverLoop, this);
+		return true;
+	}
+
+	bool ShmConn::Connect(const std::string& name)
+	{
+		if (m_running) {
+			return false;
+		}
+		m_name = name;
+		m_mode = ShmConnMode::SCM_CLIENT;
+		if (!openSegment()) {
+			return false;
+		}
+
+		// 一块共享内存同时只允许一个client
+		uint32_t expected = static_cast<uint32_t>(ShmState::SHM_LISTENING);
+		if (!ptr_seg->state.compare_exchange_strong(expected, static_cast<uint32_t>(ShmState::SHM_CONNECTED))) {
+			unmapSegment();
+			return false;
+		}
+		ShmFutexWake(&ptr_seg->state);
+
+		m_key = GenNetKey();
+		ptr_poller->PushConnect(Key(), m_name, 0);
+
+		m_running = true;
+		// 读线程持有引用，对端断开之后从owner的表里删掉也不会析构在半路
+		// 最后一个引用在读线程里释放的话，析构就在读线程里执行，见Stop
+		m_thread = std::thread([self = shared_from_this()]() mutable {
+			self->clientLoop();
+			self.reset();
+			});
+		return true;
+	}
+
+	bool ShmConn::Write(const char* data, size_t trans)
+	{
+		if (trans > AN_MSG_MAX_SIZE || trans <= 0)
+		{
+			return false;
+		}
+
+		_lock_guard_(m_writeLock);
+		if (!ptr_seg ||
+			ptr_seg->state.load(std::memory_order_acquire) != static_cast<uint32_t>(ShmState::SHM_CONNECTED))
+		{
+			return false;
+		}
+		return m_tx.Write(data, trans);
+	}
+
+	void ShmConn::Close()
+	{
+		_lock_guard_(m_writeLock);
+		if (!ptr_seg) {
+			return;
+		}
+		ptr_seg->state.store(static_cast<uint32_t>(ShmState::SHM_CLOSED), std::memory_order_release);
+		ShmFutexWake(&ptr_seg->state);
+		// 把两边的读线程都叫醒，让它们看到CLOSED
+		m_tx.Wake();
+		m_rx.Wake();
+	}
+
+	void ShmConn::Stop()
+	{
+		Close();
+		m_running = false;
+		if (m_thread.joinable())
+		{
+			// 读线程释放最后一个引用时析构会走到这里，不能join自己
+			if (m_thread.get_id() == std::this_thread::get_id()) {
+				m_thread.detach();
+			}
+			else {
+				m_thread.join();
+			}
+		}
+	}
+
+	void ShmConn::SetOwner(IShmConnOwner* o)
+	{
+		ptr_owner = o;
+	}
+
+	NetKey ShmConn::Key()
+	{
+		return m_key;
+	}
+
+	bool ShmConn::createSegment()
+	{
+		shm_unlink(m_name.c_str());
+		int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0) {
+			return false;
+		}
+
+		size_t size = sizeof(ShmSegmentHead) + 2 * static_cast<size_t>(m_cap);
+		if (ftruncate(fd, size) != 0) {
+			close(fd);
+			return false;
+		}
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+
+		ptr_seg = new (p) ShmSegmentHead();
+		m_mapSize = size;
+		ptr_seg->magic = AN_SHM_MAGIC;
+		ptr_seg->capacity = m_cap;
+		attachRings();
+		ptr_seg->state.store(static_cast<uint32_t>(ShmState::SHM_LISTENING), std::memory_order_release);
+		return true;
+	}
+
+	bool ShmConn::openSegment()
+	{
+		int fd = shm_open(m_name.c_str(), O_RDWR, 0);
+		if (fd < 0) {
+			return false;
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(ShmSegmentHead)) {
+			close(fd);
+			return false;
+		}
+		size_t size = static_cast<size_t>(st.st_size);
+		void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED) {
+			return false;
+		}
+
+		ptr_seg = static_cast<ShmSegmentHead*>(p);
+		m_mapSize = size;
+		m_cap = ptr_seg->capacity;
+		// server可能正在初始化，或者根本不是我们的共享内存
+		if (ptr_seg->magic != AN_SHM_MAGIC ||
+			sizeof(ShmSegmentHead) + 2 * static_cast<size_t>(m_cap) != size) {
+			unmapSegment();
+			return false;
+		}
+		attachRings();
+		return true;
+	}
+
+	void ShmConn::unmapSegment()
+	{
+		if (ptr_seg) {
+			munmap(ptr_seg, m_mapSize);
+			ptr_seg = nullptr;
+			m_mapSize = 0;
+		}
+	}
+
+	void ShmConn::attachRings()
+	{
+		char* data = reinterpret_cast<char*>(ptr_seg) + sizeof(ShmSegmentHead);
+		int tx = m_mode == ShmConnMode::SCM_SERVER ? 0 : 1;
+		int rx = 1 - tx;
+		m_tx.Attach(&ptr_seg->rings[tx], data + tx * static_cast<size_t>(m_cap), m_cap);
+		m_rx.Attach(&ptr_seg->rings[rx], data + rx * static_cast<size_t>(m_cap), m_cap);
+	}
+
+	void ShmConn::serverLoop()
+	{
+		while (m_running)
+		{
+			uint32_t st = ptr_seg->state.load(std::memory_order_acquire);
+			if (st == static_cast<uint32_t>(ShmState::SHM_LISTENING))
+			{
+				ShmFutexWait(&ptr_seg->state, st, SHM_WAIT_MS);
+				continue;
+			}
+
+			if (st == static_cast<uint32_t>(ShmState::SHM_CONNECTED))
+			{
+				m_key = GenNetKey(m_svr);
+				ptr_poller->PushAccept(Key(), m_name, 0);
+				readLoop();
+				ptr_poller->PushDisconnect(Key(), m_name, 0);
+				m_key = 0;
+			}
+
+			if (!m_running) {
+				break;
+			}
+
+			// 旧的共享内存可能还被对端映射着，换一块新的继续等待
+			_lock_guard_(m_writeLock);
+			unmapSegment();
+			if (!createSegment()) {
+				break;
+			}
+		}
+	}
+
+	void ShmConn::clientLoop()
+	{
+		readLoop();
+		Close();
+		const NetKey key = Key();
+		ptr_poller->PushDisconnect(key, m_name, 0);
+		// 先清key再回调，ShmNetMgr::Connect靠它判断会话是不是已经结束了
+		m_key = 0;
+		if (ptr_owner) {
+			ptr_owner->DelConn(key);
+		}
+	}
+
+	void ShmConn::readLoop()
+	{
+		const NetKey key = Key();
+		auto push = [this, key](const char* data, size_t trans) {
+			ptr_poller->PushRecv(key, data, trans);
+			};
+
+		uint32_t idle = 0;
+		while (m_running)
+		{
+			if (m_rx.Read(m_readBuffer, push))
+			{
+				idle = 0;
+				continue;
+			}
+
+			// 读空了才检查状态，对端关闭前写入的数据不会丢
+			if (ptr_seg->state.load(std::memory_order_acquire) != static_cast<uint32_t>(ShmState::SHM_CONNECTED))
+			{
+				break;
+			}
+
+			if (++idle < SHM_SPIN_NUM)
+			{
+				cpuRelax();
+				continue;
+			}
+			m_rx.Wait(SHM_WAIT_MS);
+			idle = 0;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "./ShmRing.h"
+#include "../event/IEventPoller.h"
+
+#include <memory>
+#include <thread>
+
+namespace AsioNet
+{
+	struct IShmConnOwner;
+
+	enum class ShmConnMode
+	{
+		SCM_SERVER = 1,
+		SCM_CLIENT = 2,
+	};
+
+	// 同机进程间通信的连接，一块共享内存里放两个单向的环形缓冲区
+	// 读端有数据时自旋读取，读空一段时间后才在futex上睡眠，写端只在读端睡眠时才唤醒
+	// 帧格式和IEventPoller的调用方式与TcpConn一致，业务层区分不出来
+	// 请使用shared_ptr管理对象，client的读线程持有一个引用，退出的时候释放
+	class ShmConn : public std::enable_shared_from_this<ShmConn>
+	{
+	public:
+		ShmConn() = delete;
+		ShmConn(const ShmConn&) = delete;
+		ShmConn(ShmConn&&) = delete;
+		ShmConn& operator=(const ShmConn&) = delete;
+		ShmConn& operator=(ShmConn&&) = delete;
+
+		ShmConn(IEventPoller* p);
+		~ShmConn();
+
+		// server端：创建共享内存，后台线程等待对端连接
+		// 会话断开后换一块新的共享内存继续等待，对端残留的写入不会影响新会话
+		bool Serve(const std::string& name, uint32_t capacity, ServerKey svr);
+
+		// client端：同步连接，成功后调用ptr_poller->PushConnect
+		bool Connect(const std::string& name);
+
+		// 对端没连上或者ring满了返回false
+		bool Write(const char* data, size_t trans);
+
+		// 断开当前会话，双方都会收到PushDisconnect
+		// 只是通知，不等读线程，可以在EventDriver的handler里调用
+		void Close();
+
+		// 停止后台线程并等待它退出，读线程可能卡在poller的锁上，不要在handler里调用
+		void Stop();
+
+		// client会话断开之后读线程回调owner->DelConn
+		void SetOwner(IShmConnOwner*);
+
+		NetKey Key();
+
+	protected:
+		bool createSegment();
+		bool openSegment();
+		void unmapSegment();
+		void attachRings();
+
+		void serverLoop();
+		void clientLoop();
+		void readLoop();
+
+	private:
+		static constexpr uint32_t SHM_SPIN_NUM = 4096;	// 读空之后自旋多少次才睡眠
+		static constexpr uint32_t SHM_WAIT_MS = 100;	// 每次睡眠的上限，用于检查退出
+
+		std::string m_name;
+		ShmConnMode m_mode;
+		ShmSegmentHead* ptr_seg;
+		size_t m_mapSize;
+		uint32_t m_cap;
+		ShmRing m_tx;
+		ShmRing m_rx;
+		std::mutex m_writeLock;	// 同进程多线程写，以及换共享内存时使用
+
+		std::atomic<NetKey> m_key;
+		ServerKey m_svr;
+		std::atomic<bool> m_running;
+		std::thread m_thread;
+		IEventPoller* ptr_poller;
+		IShmConnOwner* ptr_owner;
+
+		// 跨过ring尾部的帧才会拷贝到这里
+		char m_readBuffer[AN_MSG_MAX_SIZE];
+	};
+
+	struct IShmConnOwner {
+		virtual void DelConn(NetKey) = 0;
+		virtual ~IShmConnOwner() {}
+	};
+}
+
+#endif
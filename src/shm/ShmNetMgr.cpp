@@ -0,0 +1,122 @@
+#include "ShmNetMgr.h"
+
+#ifdef __linux__
+
+#include "../utils/utils.h"
+
+namespace AsioNet
+{
+	ShmNetMgr::ShmNetMgr()
+	{
+	}
+
+	ShmNetMgr::~ShmNetMgr()
+	{
+		// Stop会join读线程，读线程退出前会回调DelConn，不能在锁里等
+		decltype(m_servers) servers;
+		decltype(m_conns) conns;
+		{
+			_lock_guard_(m_lock);
+			servers.swap(m_servers);
+			conns.swap(m_conns);
+		}
+		for (auto& p : servers) {
+			p.second->Stop();
+		}
+		for (auto& p : conns) {
+			p.second->Stop();
+		}
+	}
+
+	ServerKey ShmNetMgr::Serve(IEventPoller* poller, const std::string& name, uint32_t capacity)
+	{
+		auto s = std::make_shared<ShmConn>(poller);
+		ServerKey key = GenSvrKey();
+		if (!s->Serve(name, capacity, key)) {
+			return 0;
+		}
+		_lock_guard_(m_lock);
+		m_servers[key] = s;
+		return key;
+	}
+
+	bool ShmNetMgr::Connect(IEventPoller* poller, const std::string& name)
+	{
+		auto conn = std::make_shared<ShmConn>(poller);
+		conn->SetOwner(this);
+		if (!conn->Connect(name)) {
+			return false;
+		}
+		// 对端可能已经断开了，读线程先清key再DelConn，key为0的话就不用放进表里了
+		_lock_guard_(m_lock);
+		NetKey key = conn->Key();
+		if (key) {
+			m_conns[key] = conn;
+		}
+		return true;
+	}
+
+	std::shared_ptr<ShmConn> ShmNetMgr::getConn(NetKey k)
+	{
+		_lock_guard_(m_lock);
+		auto itr = m_conns.find(k);
+		if (itr != m_conns.end()) {
+			return itr->second;
+		}
+
+		auto svr = m_servers.find(GetSvrKeyFromNetKey(k));
+		if (svr != m_servers.end() && svr->second->Key() == k) {
+			return svr->second;
+		}
+		return nullptr;
+	}
+
+	bool ShmNetMgr::Send(NetKey k, const char* data, size_t trans)
+	{
+		auto conn = getConn(k);
+		if (conn) {
+			return conn->Write(data, trans);
+		}
+		return false;
+	}
+
+	void ShmNetMgr::Broadcast(ServerKey sk, const char* data, size_t trans)
+	{
+		std::shared_ptr<ShmConn> svr;
+		{
+			_lock_guard_(m_lock);
+			auto itr = m_servers.find(sk);
+			if (itr != m_servers.end()) {
+				svr = itr->second;
+			}
+		}
+		if (svr) {
+			svr->Write(data, trans);
+		}
+	}
+
+	void ShmNetMgr::Disconnect(NetKey k)
+	{
+		// 只通知，不等读线程：读线程可能正卡在PushRecv上等EventDriver的锁，而调用者可能就在handler里
+		// client的读线程看到CLOSED之后PushDisconnect，再回调DelConn把自己从表里删掉
+		// server会继续等待下一个client
+		auto conn = getConn(k);
+		if (conn) {
+			conn->Close();
+		}
+	}
+
+	void ShmNetMgr::DelConn(NetKey k)
+	{
+		// 读线程还持有引用，这里不会析构
+		std::shared_ptr<ShmConn> removed;
+		_lock_guard_(m_lock);
+		auto itr = m_conns.find(k);
+		if (itr != m_conns.end()) {
+			removed = itr->second;
+			m_conns.erase(itr);
+		}
+	}
+}
+
+#endif
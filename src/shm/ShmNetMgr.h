@@ -0,0 +1,48 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "../event/IEventPoller.h"
+#include "./ShmConn.h"
+
+#include <memory>
+#include <unordered_map>
+
+namespace AsioNet
+{
+    // 同机进程间的共享内存传输，接口和TcpNetMgr一致
+    // 一个Serve对应一块共享内存，同时只服务一个client，适合固定配对的高频服务之间使用
+    // 断连判定同样需要应用层心跳
+    class ShmNetMgr : public IShmConnOwner {
+    public:
+        ShmNetMgr(const ShmNetMgr&) = delete;
+        ShmNetMgr(ShmNetMgr&&) = delete;
+        ShmNetMgr& operator=(const ShmNetMgr&) = delete;
+        ShmNetMgr& operator=(ShmNetMgr&&) = delete;
+
+        ShmNetMgr();
+        ~ShmNetMgr();
+
+        // ******************** 连接相关 ********************
+        // name:shm_open使用的名字，如"/gateway_logic"，capacity:单向ring的大小
+        // Accept/Connect/Disconnect事件里ip为name，port为0
+        ServerKey Serve(IEventPoller* poller, const std::string& name, uint32_t capacity = AN_SHM_RING_SIZE);
+        void Broadcast(ServerKey, const char* data, size_t trans);
+
+        // 同步连接，失败返回false
+        bool Connect(IEventPoller* poller, const std::string& name);
+        void Disconnect(NetKey);
+        bool Send(NetKey, const char* data, size_t trans);
+
+        // client的读线程在会话断开之后调用
+        void DelConn(NetKey) override;
+    private:
+        std::shared_ptr<ShmConn> getConn(NetKey);
+
+        std::mutex m_lock;
+        std::unordered_map<ServerKey, std::shared_ptr<ShmConn>> m_servers;
+        std::unordered_map<NetKey, std::shared_ptr<ShmConn>> m_conns;
+    };
+}
+
+#endif
@@ -0,0 +1,180 @@
+#pragma once
+
+#ifdef __linux__
+
+#include "../utils/AsioNetDef.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace AsioNet
+{
+	// 共享内存里的结构要求atomic是lock free的，这样才能跨进程使用
+	static_assert(std::atomic<uint32_t>::is_always_lock_free, "need lock free atomic<uint32_t>");
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "need lock free atomic<uint64_t>");
+
+	const uint32_t AN_SHM_MAGIC = 0x414E534D;	// "ANSM"
+	const uint32_t AN_SHM_RING_SIZE = 4 * 1024 * 1024;
+
+	enum class ShmState : uint32_t
+	{
+		SHM_INIT = 0,
+		SHM_LISTENING,
+		SHM_CONNECTED,
+		SHM_CLOSED,
+	};
+
+	// 跨进程的futex，不能带FUTEX_PRIVATE_FLAG
+	inline void ShmFutexWait(std::atomic<uint32_t>* addr, uint32_t val, uint32_t ms)
+	{
+		timespec ts{ static_cast<time_t>(ms / 1000), static_cast<long>(ms % 1000) * 1000000 };
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT, val, &ts, nullptr, 0);
+	}
+
+	inline void ShmFutexWake(std::atomic<uint32_t>* addr)
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+	}
+
+	// 单向环形缓冲区的控制块，生产者和消费者的游标分开在不同的cache line上
+	struct ShmRingHead
+	{
+		alignas(64) std::atomic<uint64_t> wpos;
+		alignas(64) std::atomic<uint64_t> rpos;
+		alignas(64) std::atomic<uint32_t> waitSeq;	// futex，生产者唤醒消费者时+1
+		std::atomic<uint32_t> sleeping;				// 消费者准备睡眠时置1
+	};
+
+	// 共享内存的布局：ShmSegmentHead | ring[0]数据 | ring[1]数据
+	// ring[0]:server->client，ring[1]:client->server
+	struct ShmSegmentHead
+	{
+		uint32_t magic;
+		uint32_t capacity;	// 单个ring的大小，2的幂
+		alignas(64) std::atomic<uint32_t> state;	// ShmState，同时也是等待连接的futex
+		ShmRingHead rings[2];
+	};
+
+	// 单生产者单消费者的环形缓冲区，帧格式和TcpConn一样：len(网络序)|data
+	// 同一个进程里面的多个生产者需要外部加锁
+	class ShmRing
+	{
+	public:
+		ShmRing() :ptr_head(nullptr), ptr_data(nullptr), m_cap(0) {}
+
+		void Attach(ShmRingHead* head, char* data, uint32_t cap)
+		{
+			ptr_head = head;
+			ptr_data = data;
+			m_cap = cap;
+		}
+
+		bool Empty()
+		{
+			return ptr_head->rpos.load(std::memory_order_relaxed) ==
+				ptr_head->wpos.load(std::memory_order_acquire);
+		}
+
+		// 生产者调用，空间不够返回false
+		bool Write(const char* data, size_t trans)
+		{
+			uint64_t w = ptr_head->wpos.load(std::memory_order_relaxed);
+			uint64_t r = ptr_head->rpos.load(std::memory_order_acquire);
+			size_t need = sizeof(AN_Msg::len) + trans;
+			if (m_cap - (w - r) < need)
+			{
+				return false;
+			}
+
+			auto netLen = asio::detail::socket_ops::
+				host_to_network_short(static_cast<decltype(AN_Msg::len)>(trans));
+			copyIn(w, (const char*)(&netLen), sizeof(AN_Msg::len));
+			copyIn(w + sizeof(AN_Msg::len), data, trans);
+			ptr_head->wpos.store(w + need, std::memory_order_release);
+
+			// 和Wait里面的sleeping/wpos构成Dekker式的配对，保证不会丢唤醒
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (ptr_head->sleeping.load(std::memory_order_relaxed))
+			{
+				Wake();
+			}
+			return true;
+		}
+
+		// 消费者调用，取出一帧交给f(const char*,size_t)
+		// 帧在ring里是连续的就直接把ring里的指针给出去，跨过尾部才拷贝到scratch
+		template<typename F>
+		bool Read(char* scratch, F&& f)
+		{
+			uint64_t r = ptr_head->rpos.load(std::memory_order_relaxed);
+			uint64_t w = ptr_head->wpos.load(std::memory_order_acquire);
+			if (r == w)
+			{
+				return false;
+			}
+
+			decltype(AN_Msg::len) netLen = 0;
+			copyOut(r, (char*)(&netLen), sizeof(AN_Msg::len));
+			size_t len = asio::detail::socket_ops::network_to_host_short(netLen);
+
+			uint64_t off = (r + sizeof(AN_Msg::len)) & (m_cap - 1);
+			const char* p = ptr_data + off;
+			if (off + len > m_cap)
+			{
+				copyOut(r + sizeof(AN_Msg::len), scratch, len);
+				p = scratch;
+			}
+			f(p, len);
+
+			ptr_head->rpos.store(r + sizeof(AN_Msg::len) + len, std::memory_order_release);
+			return true;
+		}
+
+		// 消费者没数据可读时调用，最多睡ms毫秒
+		void Wait(uint32_t ms)
+		{
+			uint32_t seq = ptr_head->waitSeq.load(std::memory_order_acquire);
+			ptr_head->sleeping.store(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (Empty())
+			{
+				ShmFutexWait(&ptr_head->waitSeq, seq, ms);
+			}
+			ptr_head->sleeping.store(0, std::memory_order_relaxed);
+		}
+
+		void Wake()
+		{
+			ptr_head->waitSeq.fetch_add(1, std::memory_order_release);
+			ShmFutexWake(&ptr_head->waitSeq);
+		}
+
+	private:
+		void copyIn(uint64_t pos, const char* src, size_t len)
+		{
+			uint64_t off = pos & (m_cap - 1);
+			size_t first = std::min<size_t>(len, m_cap - off);
+			memcpy(ptr_data + off, src, first);
+			memcpy(ptr_data, src + first, len - first);
+		}
+
+		void copyOut(uint64_t pos, char* dst, size_t len)
+		{
+			uint64_t off = pos & (m_cap - 1);
+			size_t first = std::min<size_t>(len, m_cap - off);
+			memcpy(dst, ptr_data + off, first);
+			memcpy(dst + first, ptr_data, len - first);
+		}
+
+		ShmRingHead* ptr_head;
+		char* ptr_data;
+		uint32_t m_cap;
+	};
+}
+
+#endif
@@ -1,9 +1,50 @@
 #include "TcpConn.h"
 #include <utility>	// std::move
+#include <algorithm>	// std::min
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#endif
+#ifdef ASIONET_ZEROCOPY
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#endif
 #include "../utils/utils.h"
+#include "../utils/Compress.h"
 
 namespace AsioNet
 {
+#ifdef ASIONET_ZEROCOPY
+	using zero_copy = asio::detail::socket_option::boolean<SOL_SOCKET, SO_ZEROCOPY>;
+#endif
+
+	static NetAddr toNetAddr(const StreamEndPoint& ep)
+	{
+		NetAddr addr{ "",0 };
+		int family = ep.protocol().family();
+		if (family == AF_INET || family == AF_INET6)
+		{
+			TcpEndPoint tcp;
+			memcpy(tcp.data(), ep.data(), ep.size());
+			tcp.resize(ep.size());
+			addr.ip = tcp.address().to_string();
+			addr.port = tcp.port();
+		}
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+		else if (family == AF_UNIX)
+		{
+			asio::local::stream_protocol::endpoint local;
+			memcpy(local.data(), ep.data(), ep.size());
+			local.resize(ep.size());
+			addr.ip = local.path();
+		}
+#endif
+		return addr;
+	}
+
 	// by connect
 	TcpConn::TcpConn(io_ctx& ctx, IEventPoller* p) :
 		m_sock(ctx), ptr_poller(p)
@@ -12,7 +53,7 @@ namespace AsioNet
 	}
 
 	// by accept
-	TcpConn::TcpConn(TcpSock&& sock, IEventPoller* p) :
+	TcpConn::TcpConn(StreamSock&& sock, IEventPoller* p) :
 		m_sock(std::move(sock)), ptr_poller(p)
 	{
 		init();
@@ -21,17 +62,100 @@ namespace AsioNet
 	TcpConn::~TcpConn()
 	{
 		Close();
+
+		// 走到析构说明已经没有生产者和正在进行的async_write了
+		for (auto n : m_inflight) {
+			delSendNode(n);
+		}
+		if (m_fileNode) {
+			delSendNode(m_fileNode);
+		}
+		while (auto n = m_sendQueue.Pop()) {
+			delSendNode(static_cast<SendNode*>(n));
+		}
+#ifdef ASIONET_ZEROCOPY
+		// 连接已经关了，内核就算还引用着这些内存，发出去的内容也没人收了
+		for (auto& call : m_zcCalls) {
+			for (auto n : call.nodes) {
+				delSendNode(n);
+			}
+		}
+#endif
 	}
 
 	void TcpConn::init()
 	{
+		// unix domain socket会设置失败，忽略即可
 		NetErr ec;
 		asio::ip::tcp::no_delay option(true);
 		m_sock.set_option(option, ec);
 
-		m_key = GenNetKey();
+		m_key = 0;
 		ptr_owner = nullptr;
-		m_close = false;	// ĬϿ
+		ptr_table = nullptr;
+		m_close = false;	// 默认开启
+		m_writing = false;
+		m_sendQueued = 0;
+		m_inflightBytes = 0;
+		m_fileNode = nullptr;
+		m_bundleMsgSize = 0;
+		m_compressSize = 0;
+		m_writeThrough = true;
+		m_bundled = false;
+		m_zeroCopySize = 0;
+#ifdef ASIONET_ZEROCOPY
+		m_zcBase = 0;
+		m_zcSeq = 0;
+		m_zcBatch = false;
+		m_zcWaiting = false;
+#endif
+		m_inflight.reserve(SEND_BUFFER_NUM);
+		m_sendBufs.reserve(SEND_BUFFER_NUM);
+	}
+
+	TcpConn::SendNode* TcpConn::newSendNode(const char* data, size_t trans)
+	{
+		auto netLen = asio::detail::socket_ops::
+			host_to_network_short(static_cast<decltype(AN_Msg::len)>(trans));
+
+		size_t size = sizeof(AN_Msg::len) + trans;
+		auto n = new (::operator new(sizeof(SendNode) + size)) SendNode();
+		char* buf = reinterpret_cast<char*>(n + 1);
+		memcpy(buf, &netLen, sizeof(AN_Msg::len));
+		memcpy(buf + sizeof(AN_Msg::len), data, trans);
+		n->size = size;
+		n->buf = buf;
+		return n;
+	}
+
+	TcpConn::SendNode* TcpConn::newSendNode(const SharedFrame& frame)
+	{
+		auto n = new (::operator new(sizeof(SendNode))) SendNode();
+		n->size = frame->size();
+		n->buf = frame->data();
+		n->frame = frame;
+		return n;
+	}
+
+	SharedFrame TcpConn::MakeFrame(const char* data, size_t trans)
+	{
+		if (trans > AN_MSG_MAX_SIZE || trans <= 0)
+		{
+			return nullptr;
+		}
+		auto netLen = asio::detail::socket_ops::
+			host_to_network_short(static_cast<decltype(AN_Msg::len)>(trans));
+
+		auto frame = std::make_shared<std::vector<char>>(sizeof(AN_Msg::len) + trans);
+		memcpy(frame->data(), &netLen, sizeof(AN_Msg::len));
+		memcpy(frame->data() + sizeof(AN_Msg::len), data, trans);
+		return frame;
+	}
+
+	void TcpConn::delSendNode(SendNode* n)
+	{
+		n->~SendNode();
+		::operator delete(n);
 	}
 
 	bool TcpConn::Write(const char* data, size_t trans)
@@ -40,53 +164,634 @@ namespace AsioNet
 		{
 			return false;
 		}
+		if (m_compressSize && trans > m_compressSize)
+		{
+			// 在调用线程里压缩，不占用io线程
+			thread_local char zipBuffer[AN_MSG_MAX_SIZE];
+			size_t zipLen = CompressMsg(data, trans, zipBuffer, sizeof(zipBuffer));
+			if (zipLen) {
+				return push(zipBuffer, zipLen, nullptr);
+			}
+		}
+		return push(data, trans, nullptr);
+	}
 
-		auto netLen = asio::detail::socket_ops::
-			host_to_network_short(static_cast<decltype(AN_Msg::len)>(trans));
+	bool TcpConn::WriteFrame(const SharedFrame& frame)
+	{
+		if (!frame || frame->size() <= sizeof(AN_Msg::len))
+		{
+			return false;
+		}
+		return push(frame->data() + sizeof(AN_Msg::len), frame->size() - sizeof(AN_Msg::len), &frame);
+	}
+
+	bool TcpConn::push(const char* data, size_t trans, const SharedFrame* frame)
+	{
+		if (m_close.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+
+		auto act = m_watermark.Check(m_sendQueued.load(std::memory_order_relaxed), data, trans + sizeof(AN_Msg::len));
+		if (act == SendWatermark::Action::SW_PUSH || act == SendWatermark::Action::SW_NOTIFY)
+		{
+			enqueue(frame ? newSendNode(*frame) : newSendNode(data, trans));
+		}
+
+		// 调用线程可能正在EventDriver的handler里回消息，持有它的m_lock
+		// PushError和Close(会PushDisconnect)都要拿这个锁，所以投递到io线程处理
+		switch (act)
+		{
+		case SendWatermark::Action::SW_NOTIFY:
+			asio::post(m_sock.get_executor(), [self = shared_from_this()]() {
+				self->ptr_poller->PushError(self->Key(), EventErrCode::SEND_QUEUE_FULL);
+				});
+			return true;
+		case SendWatermark::Action::SW_DROP:
+			return false;
+		case SendWatermark::Action::SW_DISCONNECT:
+			asio::post(m_sock.get_executor(), std::bind(&TcpConn::Close, shared_from_this()));
+			return false;
+		default:
+			return true;
+		}
+	}
+
+	void TcpConn::enqueue(SendNode* n)
+	{
+		// 先加计数再入队，消费者减的时候不会减成负数
+		m_sendQueued.fetch_add(n->size, std::memory_order_relaxed);
+		m_sendQueue.Push(n);
+		// 可能有数据正在发送中，那么这次只要把数据放进去就行，借用write_handler进行继续发送
+		if (!m_writing.exchange(true, std::memory_order_acquire))
+		{
+			flush(true);
+		}
+	}
+
+	size_t TcpConn::SendQueueSize()
+	{
+		return m_sendQueued.load(std::memory_order_relaxed);
+	}
+
+	size_t TcpConn::gather()
+	{
+		// 正在拼的合包：[bundleBegin,bundleEnd)，头部的len|msgid|flag最后再填
+		const size_t BUNDLE_HEAD_SIZE = sizeof(AN_Msg::len) + sizeof(AN_MsgHead);
+		size_t bundleBegin = 0, bundleEnd = 0, bundleNum = 0;
+		SendNode* bundleFirst = nullptr;
+		auto closeBundle = [&]() {
+			if (!bundleNum) {
+				return;
+			}
+			if (bundleNum == 1)
+			{
+				// 只有一条就没必要合包，直接发原来的
+				m_sendBufs.push_back(asio::buffer(bundleFirst->buf, bundleFirst->size));
+				bundleEnd = bundleBegin;
+			}
+			else
+			{
+				char* head = m_bundleBuf.get() + bundleBegin;
+				auto netLen = asio::detail::socket_ops::host_to_network_short(
+					static_cast<decltype(AN_Msg::len)>(bundleEnd - bundleBegin - sizeof(AN_Msg::len)));
+				AN_MsgHead msgHead{ AN_MSG_BUNDLE_ID, AN_MSG_FLAG_BUNDLE };
+				memcpy(head, &netLen, sizeof(AN_Msg::len));
+				memcpy(head + sizeof(AN_Msg::len), &msgHead, sizeof(AN_MsgHead));
+				m_sendBufs.push_back(asio::buffer(head, bundleEnd - bundleBegin));
+				m_bundled = true;
+			}
+			bundleBegin = bundleEnd;
+			bundleNum = 0;
+		};
+		auto appendBundle = [&](SendNode* n) -> bool {
+			if (!m_bundleMsgSize || n->size > m_bundleMsgSize + sizeof(AN_Msg::len)) {
+				return false;
+			}
+			if (bundleNum && bundleEnd - bundleBegin - sizeof(AN_Msg::len) + n->size > AN_MSG_MAX_SIZE) {
+				closeBundle();
+			}
+			size_t need = (bundleNum ? 0 : BUNDLE_HEAD_SIZE) + n->size;
+			if (bundleEnd + need > BUNDLE_BUFFER_SIZE) {
+				return false;
+			}
+			if (!bundleNum)
+			{
+				bundleFirst = n;
+				bundleEnd += BUNDLE_HEAD_SIZE;
+			}
+			// 子消息原样拷进来，格式和单独发送时一样
+			memcpy(m_bundleBuf.get() + bundleEnd, n->buf, n->size);
+			bundleEnd += n->size;
+			++bundleNum;
+			return true;
+		};
 
-		_lock_guard_(m_sendLock);
-		m_sendBuffer.Push((const char*)(&netLen), sizeof(AN_Msg::len));
-		m_sendBuffer.Push(data, trans);
-		// ڷУôֻҪݷŽȥУwrite_handlerм
-		auto head = m_sendBuffer.DetachHead();	
-		if (head)	
+		size_t bytes = 0;
+		m_bundled = false;
+		while (!m_fileNode && m_sendBufs.size() < SEND_BUFFER_NUM && bytes < SEND_BUFFER_SIZE)
 		{
-			asio::async_write(m_sock, asio::buffer(head->buffer, head->wpos),
+			auto n = static_cast<SendNode*>(m_sendQueue.Pop());
+			if (!n) {
+				break;
+			}
+			if (n->file) {
+				// 先把前面的普通消息发完
+				m_fileNode = n;
+				break;
+			}
+			m_inflight.push_back(n);
+			bytes += n->size;
+			if (appendBundle(n)) {
+				continue;
+			}
+			closeBundle();
+			m_sendBufs.push_back(asio::buffer(n->buf, n->size));
+		}
+		closeBundle();
+		return bytes;
+	}
+
+	void TcpConn::flush(bool writeThrough)
+	{
+		// writeThrough为true说明在Send的调用线程里，它可能正在EventDriver的handler里，持有EventDriver的m_lock
+		// 出错会err_handler -> Close -> PushDisconnect，又要拿这个锁，所以出错的处理都要投递到io线程
+		const bool onCaller = writeThrough;
+		while (true)
+		{
+			m_inflightBytes = gather();
+			if (m_sendBufs.empty())
+			{
+#ifdef __linux__
+				if (m_fileNode)
+				{
+					// 文件一块一块地发，出错也在里面处理，不在调用线程里做
+					if (onCaller) {
+						asio::post(m_sock.get_executor(), std::bind(&TcpConn::sendFile, shared_from_this()));
+					}
+					else {
+						sendFile();
+					}
+					return;
+				}
+#endif
+				break;
+			}
+
+			int flags = 0;
+#ifdef ASIONET_ZEROCOPY
+			bool zc = zeroCopy();
+			if (zc) {
+				flags = MSG_ZEROCOPY;
+			}
+#endif
+
+			// 没有正在进行的发送，直接在调用线程里非阻塞地send一次，发完了就不用再经过io线程
+			// 只试一次，避免生产者线程一直帮别的线程发数据
+			if (writeThrough && m_writeThrough)
+			{
+				writeThrough = false;
+				NetErr ec;
+				size_t total = asio::buffer_size(m_sendBufs);
+				size_t sent = m_sock.send(m_sendBufs, flags, ec);
+				if (ec == asio::error::would_block || ec == asio::error::try_again) {
+					ec.clear();
+					sent = 0;
+				}
+#ifdef ASIONET_ZEROCOPY
+				if (zc && ec == asio::error::no_buffer_space)
+				{
+					// 超过了内核允许pin住的内存，这一批改用普通的拷贝发送
+					ec.clear();
+					sent = 0;
+					zc = false;
+				}
+				if (zc && sent) {
+					zcSent();
+				}
+#endif
+				if (ec)
+				{
+					// 发送权还在我们手里，没人会动m_inflight，交给io线程去释放和关闭
+					asio::post(m_sock.get_executor(), [self = shared_from_this(), ec]() {
+						self->sendDone(ec);
+						});
+					return;
+				}
+				if (sent == total)
+				{
+					if (!sendDone(ec)) {
+						return;
+					}
+					continue;
+				}
+				// 只把没发出去的部分交给async_write
+				consumeSent(sent);
+			}
+
+#ifdef ASIONET_ZEROCOPY
+			if (zc)
+			{
+				zcWrite();
+				return;
+			}
+#endif
+			asio::async_write(m_sock, m_sendBufs,
 				std::bind(&TcpConn::write_handler, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+			return;
+		}
+
+		// 队列空了，交出发送权
+		m_writing.store(false, std::memory_order_seq_cst);
+		// 交出之前有人push了，但是他没抢到发送权，这里要抢回来继续发
+		// 这种情况下生产者可能还卡在Push的中间，投递到io线程再发，不在这里空转
+		if (!m_sendQueue.Empty() && !m_writing.exchange(true, std::memory_order_acquire))
+		{
+			asio::post(m_sock.get_executor(), std::bind(&TcpConn::flush, shared_from_this(), false));
+		}
+	}
+
+	void TcpConn::consumeSent(size_t sent)
+	{
+		size_t i = 0;
+		while (i < m_sendBufs.size() && sent >= m_sendBufs[i].size())
+		{
+			sent -= m_sendBufs[i].size();
+			++i;
+		}
+		m_sendBufs.erase(m_sendBufs.begin(), m_sendBufs.begin() + i);
+		if (sent) {
+			m_sendBufs[0] = m_sendBufs[0] + sent;
 		}
-		return true;
 	}
 
 	void TcpConn::write_handler(const NetErr& ec, size_t)
 	{
+		if (sendDone(ec)) {
+			flush(false);	// 有数据就继续发
+		}
+	}
+
+	bool TcpConn::sendDone(const NetErr& ec)
+	{
+#ifdef ASIONET_ZEROCOPY
+		if (m_zcBatch) {
+			zcRetire();
+		}
+#endif
+		for (auto n : m_inflight) {
+			delSendNode(n);
+		}
+		m_inflight.clear();
+		m_sendBufs.clear();
+		auto left = m_sendQueued.fetch_sub(m_inflightBytes, std::memory_order_relaxed) - m_inflightBytes;
+		m_inflightBytes = 0;
+
 		if (ec)
 		{
+			// 不再交出发送权，之后的消息都留在队列里，析构的时候释放
 			err_handler();
-			return;
+			return false;
 		}
 
-		_lock_guard_(m_sendLock);
-		m_sendBuffer.FreeDeatched();
-		auto head = m_sendBuffer.DetachHead();
-		if (head)	// ݾͼ
+		m_watermark.Drained(left);
+		return true;
+	}
+
+#ifdef ASIONET_ZEROCOPY
+	bool TcpConn::zeroCopy()
+	{
+		return m_zeroCopySize && !m_bundled && m_inflightBytes >= m_zeroCopySize;
+	}
+
+	void TcpConn::zcWrite()
+	{
+		m_sock.async_send(m_sendBufs, MSG_ZEROCOPY,
+			std::bind(&TcpConn::zc_write_handler, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+	}
+
+	void TcpConn::zc_write_handler(const NetErr& ec, size_t trans)
+	{
+		if (!ec && trans)
+		{
+			// async_send一次只调用一次sendmsg，可能只发出去一部分
+			zcSent();
+			if (trans < asio::buffer_size(m_sendBufs))
+			{
+				consumeSent(trans);
+				zcWrite();
+				return;
+			}
+		}
+		else if (ec == asio::error::no_buffer_space)
 		{
-			async_write(m_sock, asio::buffer(head->buffer, head->wpos),
+			// 超过了内核允许pin住的内存(net.core.optmem_max)，剩下的改用普通的拷贝发送
+			// 前面已经zerocopy发出去的部分照样等完成通知，节点在zcRetire里处理
+			asio::async_write(m_sock, m_sendBufs,
 				std::bind(&TcpConn::write_handler, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
+			return;
+		}
+		write_handler(ec, trans);
+	}
+
+	void TcpConn::zcSent()
+	{
+		std::vector<SendNode*> freed;
+		{
+			_lock_guard_(m_zcLock);
+			zcMark(m_zcSeq++, true, freed);
+		}
+		for (auto n : freed) {
+			delSendNode(n);
+		}
+
+		m_zcBatch = true;
+		if (!m_zcWaiting)
+		{
+			m_zcWaiting = true;
+			zcWait();
 		}
-		//else {
-		//	// Կ˳ͷһЩͻ
-		//  // ΪĿǰͻСǶ̬ģֻ󣬲
-		//	// m_sendBuffer.Shrink();
-		//}
 	}
 
+	void TcpConn::zcRetire()
+	{
+		m_zcBatch = false;
+		{
+			_lock_guard_(m_zcLock);
+			uint32_t idx = m_zcSeq - 1 - m_zcBase;
+			if (idx < m_zcCalls.size())
+			{
+				auto& nodes = m_zcCalls[idx].nodes;
+				nodes.insert(nodes.end(), m_inflight.begin(), m_inflight.end());
+				m_inflight.clear();
+			}
+			// 否则这一批的通知都已经到了，留在m_inflight里直接释放
+		}
+
+		// 错误队列的edge可能在重新async_wait之前就来过了，这里顺便收一次，避免节点一直挂着
+		zcReap();
+	}
+
+	void TcpConn::zcWait()
+	{
+		m_sock.async_wait(asio::socket_base::wait_error, [self = shared_from_this()](const NetErr& ec) {
+			if (ec) {
+				// 连接关了，剩下的节点在析构里释放
+				return;
+			}
+			self->zcReap();
+			self->zcWait();
+			});
+	}
+
+	void TcpConn::zcReap()
+	{
+		std::vector<SendNode*> freed;
+		char control[128];
+		while (true)
+		{
+			msghdr msg{};
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			if (::recvmsg(m_sock.native_handle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+				break;
+			}
+			for (auto cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+			{
+				bool recvErr = (cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+					(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR);
+				if (!recvErr) {
+					continue;
+				}
+				auto serr = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+				if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+					continue;
+				}
+				// 连续的完成会合并成一个区间[ee_info,ee_data]
+				// 内核实际拷贝了的(SO_EE_CODE_ZEROCOPY_COPIED)一样处理，只是这次没省下拷贝
+				_lock_guard_(m_zcLock);
+				for (uint32_t seq = serr->ee_info; ; seq++)
+				{
+					zcMark(seq, false, freed);
+					if (seq == serr->ee_data) {
+						break;
+					}
+				}
+			}
+		}
+		for (auto n : freed) {
+			delSendNode(n);
+		}
+	}
+
+	void TcpConn::zcMark(uint32_t seq, bool sent, std::vector<SendNode*>& freed)
+	{
+		// 序号会回绕，用差值判断；已经释放过的或者离谱的序号直接忽略
+		const uint32_t MAX_ZEROCOPY_CALLS = 1 << 16;
+		uint32_t idx = seq - m_zcBase;
+		if (idx >= MAX_ZEROCOPY_CALLS) {
+			return;
+		}
+		if (idx >= m_zcCalls.size()) {
+			m_zcCalls.resize(idx + 1);
+		}
+		if (sent) {
+			m_zcCalls[idx].sent = true;
+		}
+		else {
+			m_zcCalls[idx].done = true;
+		}
+
+		while (!m_zcCalls.empty() && m_zcCalls.front().sent && m_zcCalls.front().done)
+		{
+			auto& nodes = m_zcCalls.front().nodes;
+			freed.insert(freed.end(), nodes.begin(), nodes.end());
+			m_zcCalls.pop_front();
+			m_zcBase++;
+		}
+	}
+#endif
+
+	void TcpConn::SampleStats()
+	{
+		if (m_close.load(std::memory_order_relaxed)) {
+			return;
+		}
+		TcpStats s;
+		if (!ReadTcpInfo(static_cast<int>(m_sock.native_handle()), s)) {
+			return;
+		}
+		// 累计值，和上一次的差就是这段时间里的重传
+		uint32_t lastRetrans = m_stats.Load().retrans;
+		m_stats.Store(s);
+
+		if (m_serverStats)
+		{
+			m_serverStats->rtt.Add(s.rtt);
+			m_serverStats->rttvar.Add(s.rttvar);
+			m_serverStats->cwnd.Add(s.cwnd);
+			m_serverStats->deliveryRate.Add(s.deliveryRate);
+			m_serverStats->retrans.fetch_add(s.retrans - lastRetrans, std::memory_order_relaxed);
+			m_serverStats->samples.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	TcpStats TcpConn::Stats()
+	{
+		return m_stats.Load();
+	}
+
+	void TcpConn::SetServerStats(std::shared_ptr<TcpServerStats> s)
+	{
+		m_serverStats = std::move(s);
+	}
+
+	TcpConn::FileSend::~FileSend()
+	{
+#ifdef __linux__
+		if (fd >= 0) {
+			::close(fd);
+		}
+#endif
+	}
+
+#ifdef __linux__
+	// sendfile没有MSG_NOSIGNAL，对端重置之后写socket会产生SIGPIPE，默认行为是杀掉整个进程
+	// 调用期间在本线程屏蔽SIGPIPE，产生了就用sigtimedwait取走，不改进程的信号处理
+	static ssize_t sendfileNoSignal(int sock, int fd, off_t* off, size_t len)
+	{
+		sigset_t pipe, old, pending;
+		sigemptyset(&pipe);
+		sigaddset(&pipe, SIGPIPE);
+		// 已经挂着的SIGPIPE不是我们产生的，不能替别人取走
+		sigpending(&pending);
+		bool wasPending = sigismember(&pending, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &pipe, &old);
+
+		ssize_t n = ::sendfile(sock, fd, off, len);
+		int err = errno;
+		if (n < 0 && err == EPIPE && !wasPending)
+		{
+			struct timespec zero = { 0, 0 };
+			while (sigtimedwait(&pipe, nullptr, &zero) < 0 && errno == EINTR) {}
+		}
+
+		pthread_sigmask(SIG_SETMASK, &old, nullptr);
+		errno = err;
+		return n;
+	}
+
+	bool TcpConn::SendFile(uint16_t msgid, int fd, uint64_t offset, uint64_t len)
+	{
+		if (!len || m_close.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+		int dupFd = ::dup(fd);
+		if (dupFd < 0)
+		{
+			return false;
+		}
+
+		auto n = new (::operator new(sizeof(SendNode))) SendNode();
+		n->size = 0;
+		n->buf = nullptr;
+		n->file.reset(new FileSend());
+		n->file->fd = dupFd;
+		n->file->msgid = msgid;
+		n->file->offset = offset;
+		n->file->left = len;
+		enqueue(n);
+		return true;
+	}
+
+	void TcpConn::sendFile()
+	{
+		auto file = m_fileNode->file.get();
+		while (true)
+		{
+			if (!file->chunkLeft && file->headSent == 0)
+			{
+				// 开始新的一块
+				size_t chunk = static_cast<size_t>(std::min<uint64_t>(file->left, AN_MSG_MAX_SIZE - sizeof(AN_MsgHead)));
+				auto netLen = asio::detail::socket_ops::host_to_network_short(
+					static_cast<decltype(AN_Msg::len)>(chunk + sizeof(AN_MsgHead)));
+				AN_MsgHead head{ file->msgid, 0 };
+				memcpy(file->head, &netLen, sizeof(AN_Msg::len));
+				memcpy(file->head + sizeof(AN_Msg::len), &head, sizeof(AN_MsgHead));
+				file->chunkLeft = chunk;
+			}
+
+			NetErr ec;
+			if (file->headSent < sizeof(file->head))
+			{
+				file->headSent += m_sock.send(asio::buffer(file->head + file->headSent,
+					sizeof(file->head) - file->headSent), 0, ec);
+			}
+			else if (file->chunkLeft)
+			{
+				off_t off = static_cast<off_t>(file->offset);
+				ssize_t n = sendfileNoSignal(m_sock.native_handle(), file->fd, &off, file->chunkLeft);
+				if (n > 0)
+				{
+					file->offset += n;
+					file->left -= n;
+					file->chunkLeft -= n;
+				}
+				else if (n == 0)
+				{
+					// 文件被截断了，这一块的长度已经发出去，只能断开
+					ec = asio::error::eof;
+				}
+				else
+				{
+					ec = NetErr(errno, asio::error::get_system_category());
+				}
+			}
+			else
+			{
+				// 一块发完，还有剩余就排到队尾，让后面的普通消息先走
+				file->headSent = 0;
+				auto node = m_fileNode;
+				m_fileNode = nullptr;
+				if (file->left) {
+					m_sendQueue.Push(node);
+				}
+				else {
+					delSendNode(node);
+				}
+				// 每块结束都回到io_ctx排队，一个大文件不会长时间占住当前线程
+				asio::post(m_sock.get_executor(), std::bind(&TcpConn::flush, shared_from_this(), false));
+				return;
+			}
+
+			if (ec == asio::error::would_block || ec == asio::error::try_again)
+			{
+				m_sock.async_wait(asio::socket_base::wait_write, [self = shared_from_this()](const NetErr& ec) {
+					if (ec) {
+						self->err_handler();
+						return;
+					}
+					self->sendFile();
+					});
+				return;
+			}
+			if (ec)
+			{
+				err_handler();
+				return;
+			}
+		}
+	}
+#endif
+
 	void TcpConn::StartRead()
 	{
 		async_read(m_sock, asio::buffer(m_readBuffer, sizeof(AN_Msg::len)),
 			bind(&TcpConn::read_handler, shared_from_this(), std::placeholders::_1, std::placeholders::_2));
 	}
 
-	// readʵʾǵ̵߳е
+	// read实际就是单线程的运行的
 	void TcpConn::read_handler(const NetErr& ec, size_t)
 	{
 		if (ec)
@@ -106,53 +811,82 @@ namespace AsioNet
 					self->err_handler();
 					return;
 				}
-				self->ptr_poller->PushRecv(self->Key(), self->m_readBuffer, trans);
-				asio::async_read(self->m_sock, asio::buffer(self->m_readBuffer, sizeof(AN_Msg::len)),
-					std::bind(&TcpConn::read_handler, self, std::placeholders::_1, std::placeholders::_2));
+				self->recvMsg(trans);
 			});
 	}
 
-	// 
+	void TcpConn::recvMsg(size_t trans)
+	{
+		if (m_recvLimiter.Enabled())
+		{
+			uint64_t waitUs = 0;
+			switch (m_recvLimiter.Check(m_readBuffer, trans, waitUs))
+			{
+			case RecvLimiter::Action::RL_DROP:
+				StartRead();
+				return;
+			case RecvLimiter::Action::RL_NOTIFY:
+				ptr_poller->PushError(Key(), EventErrCode::RATE_LIMITED);
+				StartRead();
+				return;
+			case RecvLimiter::Action::RL_PAUSE:
+				// 消息留在m_readBuffer里，先不读了，内核缓冲区满了之后对端自然就发不动了
+				if (!m_recvTimer) {
+					m_recvTimer = std::make_unique<asio::steady_timer>(m_sock.get_executor());
+				}
+				m_recvTimer->expires_after(std::chrono::microseconds(waitUs));
+				m_recvTimer->async_wait([self = shared_from_this(), trans](const NetErr& ec) {
+					if (ec || self->m_close) {
+						return;
+					}
+					self->recvMsg(trans);
+					});
+				return;
+			default:
+				break;
+			}
+		}
+		ptr_poller->PushRecv(Key(), m_readBuffer, trans);
+		StartRead();
+	}
+
+	// 错误处理
 	void TcpConn::err_handler()	
 	{
-		// ر
+		// 关闭链接
 		Close();
 	}
 
-	// رӣֻһ
+	// 关闭连接，只会调用一次
 	void TcpConn::Close()
 	{
-		{
-			// ر֮󣬿ܻ첽дio_ctx
-			// Щȡ󣬶error_handler
-			// ֻCloseһΣֹЩͣDisconnect
-			_lock_guard_(m_closeLock);
-			if (m_close) {
-				return;
-			}
-			m_close = true;
+		// 关闭了之后，可能还有其他异步操作残存在里面io_ctx里面
+		// 当那些操作被取消后，都会进入error_handler中
+		// 这里只Close一次，防止这些操作不停地向上抛Disconnect
+		if (m_close.exchange(true)) {
+			return;
 		}
 
 		if (ptr_owner) {
-			// ӶϿ֮ⲿóʧȥconnƿ			
+			// 连接断开之后，外部最好彻底失去对conn的掌控			
 			ptr_owner->DelConn(Key());
 		}
+		if (ptr_table && Key()) {
+			// 表里的引用要等正在Send的线程都退出才会释放
+			ptr_table->Del(Key());
+		}
 		
 		NetErr err;
-		auto remote = m_sock.remote_endpoint(err);
-		// ֪ͨϲӹر
-		ptr_poller->PushDisconnect(Key(),remote.address().to_string(), remote.port());
+		auto remote = Remote();
+		// 通知上层链接关闭了
+		ptr_poller->PushDisconnect(Key(),remote.ip, remote.port);
 
-		// ֪ͨio_ctxȡm_sock첽
+		// 通知io_ctx，取消所有m_sock的异步操作
 		m_sock.shutdown(asio::ip::tcp::socket::shutdown_both, err);
 		m_sock.close(err);	
 
-		{
-			// write_handlerCloseͷm_readBufferôread_handlerm_readBufferǲȫ
-			// m_readBuffer䱾'߳'ܣͲö鲻ͷˣټӸ
-			_lock_guard_(m_sendLock);
-			m_sendBuffer.Clear();
-		}
+		// 发送队列不在这里释放，可能还有别的线程正在Push或者flush，统一在析构里释放
+		// m_readBuffer本身就是'单线程'跑，采用定长数组不释放
 
 		m_key = 0;
 	}
@@ -160,17 +894,35 @@ namespace AsioNet
 	void TcpConn::Connect(const std::string& ip, uint16_t port, int retry)
 	{
 		TcpEndPoint ep(asio::ip::address::from_string(ip.c_str()), port);
-		m_sock.async_connect(ep, [self = shared_from_this(), ip, port, retry](const NetErr& ec) {
+		connect(StreamEndPoint(ep), ip, port, retry);
+	}
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	void TcpConn::ConnectLocal(const std::string& path, int retry)
+	{
+		asio::local::stream_protocol::endpoint ep(path);
+		connect(StreamEndPoint(ep), path, 0, retry);
+	}
+#endif
+
+	void TcpConn::connect(const StreamEndPoint& ep, const std::string& ip, uint16_t port, int retry)
+	{
+		m_sock.async_connect(ep, [self = shared_from_this(), ep, ip, port, retry](const NetErr& ec) {
 			if (ec)
 			{
 				if (retry > 0)
 				{
-					self->Connect(ip, port, retry - 1);
+					self->connect(ep, ip, port, retry - 1);
 					return;
 				}
 				return;
 			}
-			// ɹӣ֪ͨϲ
+			// connect之前socket还没open，这里才能设置上
+			NetErr err;
+			self->m_sock.set_option(asio::ip::tcp::no_delay(true), err);
+
+			// 成功连接，通知上层
+			self->Register();
 			if (self->ptr_owner) {
 				self->ptr_owner->AddConn(self);
 			}
@@ -184,10 +936,71 @@ namespace AsioNet
 		ptr_owner = o;
 	}
 
-	TcpEndPoint TcpConn::Remote()
+	void TcpConn::SetTable(TcpConnTable* t)
+	{
+		ptr_table = t;
+	}
+
+	void TcpConn::Register()
+	{
+		if (m_key) {
+			return;
+		}
+		if (ptr_table) {
+			m_key = ptr_table->Add(shared_from_this());
+		}
+		else {
+			m_key = GenNetKey();
+		}
+
+		// 给Write的直接发送用，只影响同步的send，async操作不受影响
+		NetErr ec;
+		m_sock.non_blocking(true, ec);
+
+#ifdef ASIONET_ZEROCOPY
+		if (m_zeroCopySize)
+		{
+			// unix domain socket或者内核不支持，就一直用普通的发送
+			m_sock.set_option(zero_copy(true), ec);
+			if (ec) {
+				m_zeroCopySize = 0;
+			}
+		}
+#endif
+	}
+
+	void TcpConn::SetOption(const TcpOption& opt)
+	{
+		m_watermark.SetOption(opt.sendQueue);
+		m_compressSize = opt.compressSize;
+		m_writeThrough = opt.writeThrough;
+		m_recvLimiter.SetOption(opt.recvLimit);
+#ifdef ASIONET_ZEROCOPY
+		// 连接建立之后还要在Register里打开SO_ZEROCOPY，之后不能再改
+		if (!m_key) {
+			m_zeroCopySize = opt.zeroCopySize;
+		}
+#endif
+
+		// 合包之后一个包也不能超过AN_MSG_MAX_SIZE
+		m_bundleMsgSize = opt.bundleMsgSize < AN_MSG_MAX_SIZE / 2 ? opt.bundleMsgSize : AN_MSG_MAX_SIZE / 2;
+		if (m_bundleMsgSize && !m_bundleBuf) {
+			m_bundleBuf.reset(new char[BUNDLE_BUFFER_SIZE]);
+		}
+	}
+
+	NetAddr TcpConn::Remote()
 	{
 		NetErr ne;
-		return m_sock.remote_endpoint(ne);
+		auto addr = toNetAddr(m_sock.remote_endpoint(ne));
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+		if (addr.ip.empty() && m_sock.is_open() && m_sock.local_endpoint(ne).protocol().family() == AF_UNIX)
+		{
+			// accept得到的unix domain socket，对端通常没有绑定path，用监听的path代替
+			addr = toNetAddr(m_sock.local_endpoint(ne));
+		}
+#endif
+		return addr;
 	}
 
 	NetKey TcpConn::Key()
@@ -216,10 +1029,10 @@ namespace AsioNet
 	
 	void TcpConnMgr::Disconnect(NetKey k)
 	{
-		_lock_guard_(m_lock);
-		auto itr = m_conns.find(k);
-		if (itr != m_conns.end()) {
-			itr->second->Close();
+		// Close会回调DelConn，不能在锁里面调用
+		auto conn = GetConn(k);
+		if (conn) {
+			conn->Close();
 		}
 	}
 	void TcpConnMgr::AddConn(std::shared_ptr<TcpConn> conn)
@@ -234,15 +1047,33 @@ namespace AsioNet
 	}
 	void TcpConnMgr::Broadcast(const char* data,size_t trans)
 	{
-		_lock_guard_(m_lock);
-		for(auto p : m_conns){
-			p.second->Write(data,trans);
+		// 只编码一次，所有连接共用
+		auto frame = TcpConn::MakeFrame(data, trans);
+		if (!frame) {
+			return;
+		}
+		// 超过水位的断开策略会在WriteFrame里Close，回调DelConn，所以不能在锁里面发
+		std::vector<std::shared_ptr<TcpConn>> conns;
+		{
+			_lock_guard_(m_lock);
+			conns.reserve(m_conns.size());
+			for (auto& p : m_conns) {
+				conns.push_back(p.second);
+			}
+		}
+		for(auto& conn : conns){
+			conn->WriteFrame(frame);
 		}
 	}
 	TcpConnMgr::~TcpConnMgr()
 	{
-		_lock_guard_(m_lock);
-		for(auto p : m_conns){
+		// Close会回调DelConn，不能在锁里面调用
+		std::unordered_map<NetKey, std::shared_ptr<TcpConn>> conns;
+		{
+			_lock_guard_(m_lock);
+			conns.swap(m_conns);
+		}
+		for(auto p : conns){
 			p.second->Close();
 		}
 	}
@@ -1,10 +1,21 @@
 #pragma once
 
 #include "../utils/AsioNetDef.h"
-#include "../utils/BlockBuffer.h"
+#include "../utils/MpscQueue.h"
+#include "../utils/SlotMap.h"
+#include "../utils/SendWatermark.h"
+#include "../utils/RateLimiter.h"
+#include "TcpStats.h"
 #include "../event/IEventPoller.h"
 
+#include <deque>
 #include <unordered_map>
+#include <vector>
+
+// MSG_ZEROCOPY需要linux 4.14+，系统头文件里没有就不编译这条路径
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#define ASIONET_ZEROCOPY
+#endif
 
 namespace AsioNet
 {
@@ -13,7 +24,47 @@ namespace AsioNet
 	using TcpSock = asio::ip::tcp::socket;
 	using TcpEndPoint = asio::ip::tcp::endpoint;
 
-	struct ITcpConnOwner;	// ǰ
+	// conn内部使用generic的流式socket，tcp和unix domain socket共用同一套分帧和收发逻辑
+	using StreamSock = asio::generic::stream_protocol::socket;
+	using StreamEndPoint = asio::generic::stream_protocol::endpoint;
+	using StreamAcceptor = asio::basic_socket_acceptor<asio::generic::stream_protocol>;
+
+	struct ITcpConnOwner;	// 前向声明
+	class TcpConn;
+
+	// NetMgr里所有连接的总表，NetKey就是表里的key，Send时无锁查找
+	using TcpConnTable = SlotMap<std::shared_ptr<TcpConn>>;
+
+	// 编码好的一帧：len(网络序)|data，Multicast时所有连接共用同一份
+	using SharedFrame = std::shared_ptr<const std::vector<char>>;
+
+	// 连接相关的配置
+	struct TcpOption {
+		SendQueueOption sendQueue;
+
+		// 大于0时开启合包：一次发送里不超过这个大小的消息合并成一个AN_MSG_FLAG_BUNDLE的包
+		// 对端少了很多次async_read和NetEvent，适合大量几十字节的小消息，对端需要使用EventDriver
+		size_t bundleMsgSize = 0;
+
+		// 大于0时，超过这个大小的消息先用lz4压缩，压缩后没变小就原样发送
+		size_t compressSize = 0;
+
+		// 没有正在进行的发送时，Write在调用线程里直接非阻塞send，只把没发完的部分交给io线程
+		// 请求应答类的流量可以省掉一次io线程的切换
+		bool writeThrough = true;
+
+		// 接收限速，超速的消息按recvLimit.policy丢弃、暂停读或者通知上层，默认不限制
+		RecvLimitOption recvLimit;
+
+		// 大于0时，一次发送合并之后达到这个字节数就用MSG_ZEROCOPY发送，只对linux的tcp连接生效
+		// 内核直接引用发送队列里的内存，等错误队列里的完成通知到了才释放，小包pin内存的开销比拷贝还大
+		// 回环地址上内核最终还是会拷贝一次，收益要在真实网卡上测，见test/bench/ZeroCopyBench.h
+		size_t zeroCopySize = 0;
+
+		// 以下只对Serve生效
+		bool reusePort = false;		// 每个io线程开一个SO_REUSEPORT的acceptor，由内核把连接分散开
+		size_t acceptNum = 1;		// 每个acceptor同时挂起的async_accept数量
+	};
 
 	class TcpConn : public std::enable_shared_from_this<TcpConn>
 	{
@@ -24,86 +75,233 @@ namespace AsioNet
 		TcpConn& operator=(const TcpConn&) = delete;
 		TcpConn& operator=(TcpConn&&) = delete;
 
-		// ʹshared_ptrconnֱջʹü
-		// ʵ
+		// 请使用shared_ptr来创建conn，直接在栈上使用即可
+		// 实例：
 		// auto conn = std::make_shared<TcpConn>(ctx, ptr_poller);
 		// conn->SetOwner(ITcpConnOwner* owner);	
 		// conn->Connect(... ...);	
 		TcpConn(io_ctx& ctx, IEventPoller* p);
 
-		// TcpServeracceptʱʹ
+		// TcpServer在accept时使用
 		// auto conn = std::make_shared<TcpConn>(remote, ptr_poller);
 		// conn->SetOwner(ITcpConnOwner* owner);	
+		// conn->Register();
 		// owner->AddConn(conn);	
-		// ΪʵConnʵֵģԲAddConnⲿԼ
-		TcpConn(TcpSock&& sock, IEventPoller* p);
+		// 这里因为连接实在Conn外实现的，所以不会调用AddConn，外部自己管理即可
+		TcpConn(StreamSock&& sock, IEventPoller* p);
 		
 		~TcpConn();
 
 		void SetOwner(ITcpConnOwner*);
+
+		// 设置了table的conn，NetKey由table分配，表里持有conn直到Close
+		void SetTable(TcpConnTable*);
+
+		// 分配NetKey，连接建立之后、通知上层之前调用一次
+		// connect成功之后自动调用，accept的请手动调用
+		void Register();
+
+		void SetOption(const TcpOption&);
 		
-		// 
+		// 发送数据，任意线程都可以调用，不加锁
+		// 发送队列超过高水位时，按照TcpOption::sendQueue的策略处理
 		bool Write(const char* data, size_t trans);
 
-		// ʼ첽
-		// ɹ֮ptr_poller->PushConnect
-		void Connect(const std::string& ip, uint16_t port, int retry/*ʧԴ*/);
+		// 发送一个已经编码好的帧，不拷贝数据，只持有frame的引用
+		bool WriteFrame(const SharedFrame& frame);
+
+		// 编码一帧，失败返回nullptr
+		static SharedFrame MakeFrame(const char* data, size_t trans);
 
-		// رӣֻһ
-		// ptr_owner->DelConnpsownerӦټӵconnȨΪײsockѾرգвʧ
-		// ptr_poller->PushDisconnect
+#ifdef __linux__
+		// 用sendfile发送文件的[offset,offset+len)，数据不经过用户态
+		// 文件按块发送，每块是一个普通的消息：msgid|flag(0)|文件内容，对端按msgid收到的顺序拼起来即可
+		// 每发完一块就重新排到发送队列末尾，和普通消息公平地交替发送
+		// fd会被dup，调用之后可以直接关闭；文件数据不计入发送队列的水位
+		bool SendFile(uint16_t msgid, int fd, uint64_t offset, uint64_t len);
+#endif
+
+		// 发送队列中还没发出去的字节数
+		size_t SendQueueSize();
+
+		// 读一次TCP_INFO，更新Stats()，设置了server的汇总就顺便记到直方图里
+		// 由TcpNetMgr的采样定时器调用，同一时间只有一个线程在采样
+		void SampleStats();
+
+		// 最近一次采样，没有采样过sampleTime为0
+		TcpStats Stats();
+
+		// accept的连接，采样结果汇总到所属的server
+		void SetServerStats(std::shared_ptr<TcpServerStats>);
+
+		// 开始异步连接
+		// 成功之后调用ptr_poller->PushConnect
+		void Connect(const std::string& ip, uint16_t port, int retry/*失败重试次数*/);
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+		// 连接本机的unix domain socket，PushConnect的ip为path，port为0
+		void ConnectLocal(const std::string& path, int retry/*失败重试次数*/);
+#endif
+
+		// 主动关闭这个连接，只会调用一次
+		// 调用ptr_owner->DelConn，ps：owner不应该再继续拥有conn的所有权，因为底层的sock已经关闭，接下来的所有操作都将失败
+		// 调用ptr_poller->PushDisconnect
 		void Close();
 
-		// ʼ
-		// connectɹ֮Զãacceptֶ
-		// ɹݺ󣬵ptr_poller->PushRecv
+		// 开始接收数据
+		// connect成功之后自动调用，accept的请手动调用
+		// 成功接收数据后，调用ptr_poller->PushRecv
 		void StartRead(); 
 		
-		// ȡԶaddr
-		TcpEndPoint Remote();
+		// 获取对端addr，unix domain socket的ip为path，port为0
+		NetAddr Remote();
 
-		// Ψһid
+		// 唯一id
 		NetKey Key();
 	protected:
 		void init();
 
+		void connect(const StreamEndPoint& ep, const std::string& ip, uint16_t port, int retry);
+
 		void read_handler(const NetErr&, size_t);
+		// 收到了一条完整的消息，检查限速之后交给上层，然后继续读
+		void recvMsg(size_t trans);
 		void write_handler(const NetErr&, size_t);
 
-		// ֱӹر
+		// SendFile的发送进度
+		struct FileSend {
+			int fd = -1;
+			uint16_t msgid = 0;
+			uint64_t offset = 0;	// 下一个要发的文件位置
+			uint64_t left = 0;		// 还没发的文件字节数(包括当前块)
+			char head[sizeof(AN_Msg::len) + sizeof(AN_MsgHead)];	// 当前块的len|msgid|flag
+			size_t headSent = 0;
+			size_t chunkLeft = 0;	// 当前块还没发的文件字节数
+			~FileSend();
+		};
+
+		// 发送队列里的一条消息，len|data连续存放在节点后面，或者引用一个共享的帧，或者是一个文件
+		struct SendNode : MpscNode {
+			size_t size;
+			const char* buf;
+			SharedFrame frame;
+			std::unique_ptr<FileSend> file;
+		};
+		static SendNode* newSendNode(const char* data, size_t trans);
+		static SendNode* newSendNode(const SharedFrame& frame);
+		static void delSendNode(SendNode*);
+
+		// data/trans用于水位检查，frame为空时拷贝data
+		bool push(const char* data, size_t trans, const SharedFrame* frame);
+		// 入队，没有正在进行的发送就开始发
+		void enqueue(SendNode* n);
+
+		// 只有抢到m_writing的线程才能调用
+		// 把队列里的消息合并成一次发送，writeThrough:先在当前线程直接send，发不完的再async_write
+		// writeThrough时在调用者线程里，出错和文件发送都投递到io线程，不在这里回调poller
+		void flush(bool writeThrough);
+		// 从队列里取出消息放到m_sendBufs，返回占用的队列字节数
+		size_t gather();
+		// 直接send只发了一部分，去掉已经发出去的
+		void consumeSent(size_t sent);
+		// 一次发送结束，释放m_inflight，出错返回false
+		bool sendDone(const NetErr& ec);
+
+#ifdef __linux__
+		// 发送m_fileNode的当前块，发不动就等socket可写
+		void sendFile();
+#endif
+
+#ifdef ASIONET_ZEROCOPY
+		// 这一批是否用MSG_ZEROCOPY发送
+		bool zeroCopy();
+		// 剩下的部分用async_send(MSG_ZEROCOPY)发送
+		void zcWrite();
+		void zc_write_handler(const NetErr&, size_t);
+		// 一次MSG_ZEROCOPY的sendmsg成功了，登记它的序号
+		void zcSent();
+		// 一批发完，把m_inflight挂到这一批最后一次sendmsg上，内核不再引用之后才释放
+		void zcRetire();
+		// 等错误队列里的完成通知
+		void zcWait();
+		// 读完错误队列，释放内核不再引用的节点
+		void zcReap();
+		// m_zcLock里调用，sent:sendmsg返回了，否则是完成通知到了，可以释放的节点放进freed
+		void zcMark(uint32_t seq, bool sent, std::vector<SendNode*>& freed);
+#endif
+
+		// 出错直接关闭连接
 		void err_handler();
 
 	private:
-		TcpSock m_sock;
+		StreamSock m_sock;
+
+		// 发送一次数据的最大数据量
+		static constexpr uint32_t SEND_BUFFER_SIZE = 64 * 1024;
+		// 一次async_write最多合并的消息数，asio单次也只会提交这么多个buffer
+		static constexpr uint32_t SEND_BUFFER_NUM = 64;
+		// 发送队列：生产者无锁push，同一时间只有抢到m_writing的线程在消费
+		MpscQueue m_sendQueue;
+		std::atomic<bool> m_writing;
+		std::atomic<size_t> m_sendQueued;	// 队列里加上正在发送的字节数
+		// 正在发送的消息，只有持有m_writing的线程访问
+		std::vector<SendNode*> m_inflight;
+		std::vector<asio::const_buffer> m_sendBufs;
+		size_t m_inflightBytes;
+		// 正在发送的文件块，文件节点要单独发送，gather遇到它就停下来
+		SendNode* m_fileNode;
+		// 合包的缓冲区，只有持有m_writing的线程访问，开启合包时才分配
+		static constexpr uint32_t BUNDLE_BUFFER_SIZE = SEND_BUFFER_SIZE;
+		std::unique_ptr<char[]> m_bundleBuf;
+		size_t m_bundleMsgSize;
+		size_t m_compressSize;
+		bool m_writeThrough;
+		bool m_bundled;		// 这一批用到了m_bundleBuf，不能zerocopy
+		size_t m_zeroCopySize;
+#ifdef ASIONET_ZEROCOPY
+		// 一次MSG_ZEROCOPY的sendmsg，完成通知可能比sendmsg返回先处理，两边都到了才算结束
+		// 按序号顺序释放，一批的节点挂在这一批最后一次sendmsg上
+		struct ZeroCopyCall {
+			bool sent = false;
+			bool done = false;
+			std::vector<SendNode*> nodes;
+		};
+		std::mutex m_zcLock;
+		std::deque<ZeroCopyCall> m_zcCalls;	// m_zcCalls[0]的序号是m_zcBase
+		uint32_t m_zcBase;
+		uint32_t m_zcSeq;	// 下一次sendmsg的序号，和内核的计数一致
+		// 以下只有持有m_writing的线程访问
+		bool m_zcBatch;		// 这一批有sendmsg用了MSG_ZEROCOPY
+		bool m_zcWaiting;	// 已经开始等错误队列
+#endif
+		SendWatermark m_watermark;
 
-		std::mutex m_sendLock;
-		// һݵ
-		static constexpr uint32_t SEND_BUFFER_SIZE = 8 * 1024;
-		static const uint32_t SEND_BUFFER_EXTEND_NUM = 2;
-		// ͻ
-		BlockSendBuffer<SEND_BUFFER_SIZE,
-			SEND_BUFFER_EXTEND_NUM> m_sendBuffer;
+		TcpStatsRecord m_stats;
+		std::shared_ptr<TcpServerStats> m_serverStats;
 
-		// ջ
+		// 接收缓冲区
 		char m_readBuffer[AN_MSG_MAX_SIZE];
+		// 接收限速，只在读回调里访问；暂停读的时候用m_recvTimer等令牌，用到才创建
+		RecvLimiter m_recvLimiter;
+		std::unique_ptr<asio::steady_timer> m_recvTimer;
 
 		NetKey m_key;
-		bool m_close;
-		std::mutex m_closeLock;
+		std::atomic<bool> m_close;
 		IEventPoller* ptr_poller;
 		ITcpConnOwner* ptr_owner;
+		TcpConnTable* ptr_table;
 	};
 
-	// accept,connect,disconnect첽ģΪ˷ӣӿ
-	// connectɹʱ򣬵AddConn
-	// disconnectʱ򣬵DelConn
+	// 由于accept,connect,disconnect都是异步的，为了方便管理链接，引入这个接口
+	// connect成功的时候，调用AddConn
+	// disconnect的时候，调用DelConn
 	struct ITcpConnOwner {
 		virtual void AddConn(std::shared_ptr<TcpConn>) = 0;
 		virtual void DelConn(NetKey) = 0;
 		virtual ~ITcpConnOwner() {}
 	};
 
-	// ڲõһITcpConnOwnerʵ
+	// 内部用的一个ITcpConnOwner的实现
 	class TcpConnMgr final:public ITcpConnOwner {
 	public:
 		void DelConn(NetKey) override;
@@ -0,0 +1,134 @@
+#include "TcpGroup.h"
+
+#include <algorithm>
+
+namespace AsioNet
+{
+	TcpGroupMgr::TcpGroupMgr(TcpConnTable& conns, io_ctx& ctx, size_t shardNum) :
+		m_conns(conns), m_ctx(ctx), m_shardNum(shardNum ? shardNum : 1)
+	{
+	}
+
+	void TcpGroupMgr::Subscribe(GroupKey gk, NetKey k)
+	{
+		_lock_guard_(m_lock);
+		auto g = std::make_shared<Group>();
+		auto itr = m_groups.find(gk);
+		if (itr != m_groups.end()) {
+			*g = *(itr->second);
+		}
+		else {
+			g->shards.resize(m_shardNum);
+		}
+
+		auto& shard = g->shards[shardOf(k)];
+		auto members = shard ? std::make_shared<Members>(*shard) : std::make_shared<Members>();
+		if (std::find(members->begin(), members->end(), k) != members->end()) {
+			return;
+		}
+		members->push_back(k);
+		shard = members;
+		++g->size;
+		m_groups[gk] = g;
+	}
+
+	void TcpGroupMgr::Unsubscribe(GroupKey gk, NetKey k)
+	{
+		prune(gk, Members{ k });
+	}
+
+	void TcpGroupMgr::DelGroup(GroupKey gk)
+	{
+		_lock_guard_(m_lock);
+		m_groups.erase(gk);
+	}
+
+	size_t TcpGroupMgr::GroupSize(GroupKey gk)
+	{
+		_lock_guard_(m_lock);
+		auto itr = m_groups.find(gk);
+		return itr != m_groups.end() ? itr->second->size : 0;
+	}
+
+	void TcpGroupMgr::Multicast(GroupKey gk, const char* data, size_t trans)
+	{
+		std::shared_ptr<const Group> g;
+		{
+			_lock_guard_(m_lock);
+			auto itr = m_groups.find(gk);
+			if (itr == m_groups.end()) {
+				return;
+			}
+			g = itr->second;
+		}
+
+		auto frame = TcpConn::MakeFrame(data, trans);
+		if (!frame) {
+			return;
+		}
+
+		for (auto& shard : g->shards)
+		{
+			if (!shard || shard->empty()) {
+				continue;
+			}
+			if (g->size <= INLINE_FANOUT_NUM) {
+				fanout(gk, *shard, frame);
+				continue;
+			}
+			// 快照和帧都由回调持有，扇出期间订阅关系变化不影响这次发送
+			asio::post(m_ctx, [this, gk, shard, frame]() {
+				fanout(gk, *shard, frame);
+				});
+		}
+	}
+
+	void TcpGroupMgr::fanout(GroupKey gk, const Members& members, const SharedFrame& frame)
+	{
+		Members stale;
+		for (auto k : members)
+		{
+			bool ok = m_conns.Visit(k, [&frame](std::shared_ptr<TcpConn>& conn) {
+				conn->WriteFrame(frame);
+				});
+			if (!ok) {
+				stale.push_back(k);
+			}
+		}
+		if (!stale.empty()) {
+			prune(gk, stale);
+		}
+	}
+
+	void TcpGroupMgr::prune(GroupKey gk, const Members& stale)
+	{
+		_lock_guard_(m_lock);
+		auto itr = m_groups.find(gk);
+		if (itr == m_groups.end()) {
+			return;
+		}
+
+		auto g = std::make_shared<Group>(*(itr->second));
+		for (auto k : stale)
+		{
+			auto& shard = g->shards[shardOf(k)];
+			if (!shard) {
+				continue;
+			}
+			auto pos = std::find(shard->begin(), shard->end(), k);
+			if (pos == shard->end()) {
+				continue;
+			}
+			auto members = std::make_shared<Members>(*shard);
+			members->erase(members->begin() + (pos - shard->begin()));
+			shard = members;
+			--g->size;
+		}
+
+		if (!g->size) {
+			m_groups.erase(itr);
+			return;
+		}
+		itr->second = g;
+	}
+}
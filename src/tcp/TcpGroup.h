@@ -0,0 +1,57 @@
+#pragma once
+
+#include "TcpConn.h"
+
+#include <unordered_map>
+#include <vector>
+
+namespace AsioNet
+{
+	using GroupKey = uint64_t;	// 由业务决定，比如场景id、房间id、公会id
+
+	// 组播的订阅关系
+	// 每个组的成员按NetKey分成shardNum份(和io线程数一样)，Multicast时每份投递到io_ctx单独发送，多个io线程并行扇出
+	// 成员数组是写时复制的：订阅/退订拷贝一份再替换，Multicast只拿一个快照，不会和订阅互相阻塞
+	// 连接断开后不需要手动退订，扇出时发现key失效会顺手清理掉
+	class TcpGroupMgr {
+	public:
+		TcpGroupMgr() = delete;
+		TcpGroupMgr(const TcpGroupMgr&) = delete;
+		TcpGroupMgr(TcpGroupMgr&&) = delete;
+		TcpGroupMgr& operator=(const TcpGroupMgr&) = delete;
+		TcpGroupMgr& operator=(TcpGroupMgr&&) = delete;
+
+		TcpGroupMgr(TcpConnTable& conns, io_ctx& ctx, size_t shardNum);
+
+		void Subscribe(GroupKey, NetKey);
+		void Unsubscribe(GroupKey, NetKey);
+		void DelGroup(GroupKey);
+		size_t GroupSize(GroupKey);
+
+		// 只编码一次，所有成员共用同一个帧
+		void Multicast(GroupKey, const char* data, size_t trans);
+
+	private:
+		using Members = std::vector<NetKey>;
+		struct Group {
+			std::vector<std::shared_ptr<const Members>> shards;
+			size_t size = 0;
+		};
+
+		size_t shardOf(NetKey k) const { return k % m_shardNum; }
+
+		void fanout(GroupKey gk, const Members& members, const SharedFrame& frame);
+		// 去掉已经失效的key
+		void prune(GroupKey gk, const Members& stale);
+
+		// 成员少于这个数就在调用线程里直接发，不值得投递
+		static constexpr size_t INLINE_FANOUT_NUM = 64;
+
+		TcpConnTable& m_conns;
+		io_ctx& m_ctx;
+		size_t m_shardNum;
+
+		std::mutex m_lock;
+		std::unordered_map<GroupKey, std::shared_ptr<const Group>> m_groups;
+	};
+}
@@ -3,7 +3,7 @@
 
 namespace AsioNet
 {
-	TcpNetMgr::TcpNetMgr(size_t th_num) :m_isClose(false)
+	TcpNetMgr::TcpNetMgr(size_t th_num) :m_isClose(false), m_groups(m_conns, m_ctx, th_num), m_statsCursor(0)
 	{
 		for (size_t i = 0; i < th_num; i++)
 		{
@@ -31,41 +31,119 @@ namespace AsioNet
 		for(auto& th : thPool){
 			th.join();
 		}
+		// 表比io_ctx先析构，先把连接都关掉，io_ctx里残留的回调释放conn时不会再访问表
+		m_conns.ForEach([](std::shared_ptr<TcpConn>& conn) {
+			conn->Close();
+			});
 	}
 
-	void TcpNetMgr::Connect(IEventPoller* poller,const std::string& ip, uint16_t port,int retry/*,options*/)
+	void TcpNetMgr::Connect(IEventPoller* poller,const std::string& ip, uint16_t port,int retry,const TcpOption& opt)
 	{
 		auto conn = std::make_shared<TcpConn>(m_ctx, poller);
-		// 连接并没有成功建立，这里不应该调用AddConn
-		conn->SetOwner(&m_connMgr);
+		// 连接成功之后才会登记到m_conns，在此之前由async_connect的回调持有
+		conn->SetTable(&m_conns);
+		conn->SetOption(opt);
 		conn->Connect(ip, port, retry);
 	}
 
-	ServerKey TcpNetMgr::Serve(IEventPoller* poller, const std::string& ip,uint16_t port /*,options*/)
+	ServerKey TcpNetMgr::Serve(IEventPoller* poller, const std::string& ip,uint16_t port,const TcpOption& opt)
 	{
 		auto s = std::make_shared<TcpServer>(m_ctx, poller);
-		s->Serve(ip,port);
+		s->SetOption(opt);
+		s->SetTable(&m_conns);
+		s->Serve(ip,port,opt.reusePort ? thPool.size() : 1);
 		m_serverMgr.AddServer(s);
 		return s->Key();
 	}
 
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	ServerKey TcpNetMgr::ServeLocal(IEventPoller* poller, const std::string& path, const TcpOption& opt)
+	{
+		auto s = std::make_shared<TcpServer>(m_ctx, poller);
+		s->SetOption(opt);
+		s->SetTable(&m_conns);
+		s->ServeLocal(path);
+		m_serverMgr.AddServer(s);
+		return s->Key();
+	}
+
+	void TcpNetMgr::ConnectLocal(IEventPoller* poller, const std::string& path, int retry, const TcpOption& opt)
+	{
+		auto conn = std::make_shared<TcpConn>(m_ctx, poller);
+		conn->SetTable(&m_conns);
+		conn->SetOption(opt);
+		conn->ConnectLocal(path, retry);
+	}
+#endif
+
 	bool TcpNetMgr::Send(NetKey k, const char* data, size_t trans)
 	{
-		auto conn = m_connMgr.GetConn(k);
-		if (conn) {
-			return conn->Write(data, trans);
+		bool ok = false;
+		m_conns.Visit(k, [&](std::shared_ptr<TcpConn>& conn) {
+			ok = conn->Write(data, trans);
+			});
+		return ok;
+	}
+
+#ifdef __linux__
+	bool TcpNetMgr::SendFile(NetKey k, uint16_t msgid, int fd, uint64_t offset, uint64_t len)
+	{
+		bool ok = false;
+		m_conns.Visit(k, [&](std::shared_ptr<TcpConn>& conn) {
+			ok = conn->SendFile(msgid, fd, offset, len);
+			});
+		return ok;
+	}
+#endif
+
+	size_t TcpNetMgr::SendQueueSize(NetKey k)
+	{
+		size_t size = 0;
+		m_conns.Visit(k, [&](std::shared_ptr<TcpConn>& conn) {
+			size = conn->SendQueueSize();
+			});
+		return size;
+	}
+
+	void TcpNetMgr::StartStats(const TcpStatsOption& opt)
+	{
+		if (m_statsTimer) {
+			return;
 		}
+		m_statsOpt = opt;
+		m_statsOpt.interval = opt.interval ? opt.interval : 1;
+		m_statsTimer = std::make_unique<asio::steady_timer>(m_ctx);
+		sampleStats();
+	}
 
-		ServerKey svr = GetSvrKeyFromNetKey(k);
-		auto server = m_serverMgr.GetServer(svr);
-		if(server){
-			auto client = server->GetConn(k);
-			if (client)
-			{
-				return client->Write(data,trans);
+	void TcpNetMgr::sampleStats()
+	{
+		m_statsTimer->expires_after(std::chrono::milliseconds(m_statsOpt.interval));
+		m_statsTimer->async_wait([this](const NetErr& ec) {
+			if (ec || m_isClose) {
+				return;
 			}
-		}
-		return false;
+			m_conns.ForEachFrom(m_statsCursor, m_statsOpt.budget, [](std::shared_ptr<TcpConn>& conn) {
+				conn->SampleStats();
+				});
+			sampleStats();
+			});
+	}
+
+	bool TcpNetMgr::Stats(NetKey k, TcpStats& out)
+	{
+		bool ok = false;
+		m_conns.Visit(k, [&](std::shared_ptr<TcpConn>& conn) {
+			out = conn->Stats();
+			ok = out.sampleTime != 0;
+			});
+		return ok;
+	}
+
+	std::shared_ptr<TcpServerStats> TcpNetMgr::ServerStats(ServerKey sk)
+	{
+		auto server = m_serverMgr.GetServer(sk);
+		return server ? server->Stats() : nullptr;
 	}
 
 	void TcpNetMgr::Broadcast(ServerKey sk, const char* data, size_t trans)
@@ -76,15 +154,31 @@ namespace AsioNet
 		}
 	}
 
-	void TcpNetMgr::Disconnect(NetKey k)
+	void TcpNetMgr::Subscribe(GroupKey gk, NetKey k)
 	{
-		m_connMgr.DelConn(k);
+		m_groups.Subscribe(gk, k);
+	}
 
-		ServerKey sk = GetSvrKeyFromNetKey(k);
-		auto svr = m_serverMgr.GetServer(sk);
-		if (svr) {
-			svr->Disconnect(k);
-		}
+	void TcpNetMgr::Unsubscribe(GroupKey gk, NetKey k)
+	{
+		m_groups.Unsubscribe(gk, k);
+	}
+
+	void TcpNetMgr::DelGroup(GroupKey gk)
+	{
+		m_groups.DelGroup(gk);
+	}
+
+	void TcpNetMgr::Multicast(GroupKey gk, const char* data, size_t trans)
+	{
+		m_groups.Multicast(gk, data, trans);
+	}
+
+	void TcpNetMgr::Disconnect(NetKey k)
+	{
+		m_conns.Visit(k, [](std::shared_ptr<TcpConn>& conn) {
+			conn->Close();
+			});
 	}
 
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 // #include "../utils/AsioNetDef.h"
 #include "../event/IEventPoller.h"
 #include "../tcp/TcpServer.h"
+#include "../tcp/TcpGroup.h"
 
 namespace AsioNet
 {
@@ -28,18 +29,61 @@ namespace AsioNet
         ~TcpNetMgr();
 
         // ******************** 连接相关 ********************
-        ServerKey Serve(IEventPoller* poller,const std::string& ip,uint16_t port);
+        ServerKey Serve(IEventPoller* poller,const std::string& ip,uint16_t port,const TcpOption& opt = TcpOption());
         void Broadcast(ServerKey, const char* data, size_t trans);
 
-        void Connect(IEventPoller* poller,const std::string& ip, uint16_t port,int retry = 1/*连接失败后的重试次数*/);
+        void Connect(IEventPoller* poller,const std::string& ip, uint16_t port,int retry = 1/*连接失败后的重试次数*/,
+            const TcpOption& opt = TcpOption());
         void Disconnect(NetKey);
         bool Send(NetKey, const char* data, size_t trans);
+
+#ifdef __linux__
+        // 用sendfile发送文件的[offset,offset+len)，按块拆成msgid的消息，和普通消息交替发送
+        // 对端可以用EventDriver::AddRawRouter接收
+        bool SendFile(NetKey, uint16_t msgid, int fd, uint64_t offset, uint64_t len);
+#endif
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+        // ******************** unix domain socket ********************
+        // 同机进程间通信，分帧、NetKey、Send/Broadcast/Disconnect都和tcp一样
+        // Accept/Connect/Disconnect事件里ip为path，port为0
+        ServerKey ServeLocal(IEventPoller* poller,const std::string& path,const TcpOption& opt = TcpOption());
+        void ConnectLocal(IEventPoller* poller,const std::string& path,int retry = 1,const TcpOption& opt = TcpOption());
+#endif
+
+        // ******************** 组播 ********************
+        // 同一个连接可以订阅多个组，连接断开后会自动从组里清理掉
+        void Subscribe(GroupKey, NetKey);
+        void Unsubscribe(GroupKey, NetKey);
+        void DelGroup(GroupKey);
+        // 消息只编码一次，按io线程分片并行发送，比业务层循环Send快得多
+        void Multicast(GroupKey, const char* data, size_t trans);
+
+        // 发送队列中堆积的字节数，连接不存在返回0
+        size_t SendQueueSize(NetKey);
+
+        // ******************** 传输层统计 ********************
+        // 开始定时读取所有连接的TCP_INFO，每次只轮转采样一部分连接，10万连接也不会占多少cpu
+        // 只支持linux，只有第一次调用有效
+        void StartStats(const TcpStatsOption& opt = TcpStatsOption());
+        // 连接最近一次的采样，连接不存在或者还没采样过返回false
+        bool Stats(NetKey, TcpStats& out);
+        // server下所有连接的采样汇总，server不存在返回nullptr
+        std::shared_ptr<TcpServerStats> ServerStats(ServerKey);
     private:
+        void sampleStats();
+
         io_ctx m_ctx;
         std::atomic<bool> m_isClose;
         std::vector<std::thread> thPool;
-        TcpConnMgr m_connMgr;
+        // 所有连接(connect的和accept的)都在这里，NetKey = 代数|下标
+        TcpConnTable m_conns;
+        TcpGroupMgr m_groups;
         TcpServerMgr m_serverMgr;
+        // 采样定时器的回调是串行的，cursor和option只在回调里用
+        std::unique_ptr<asio::steady_timer> m_statsTimer;
+        TcpStatsOption m_statsOpt;
+        uint32_t m_statsCursor;
     };
 
 }
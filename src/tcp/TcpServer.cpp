@@ -2,10 +2,19 @@
 #include <utility>	// std::move
 #include "../utils/utils.h"
 
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+#include <sys/stat.h>	// lstat
+#include <unistd.h>		// unlink
+#endif
+
 namespace AsioNet
 {
+#ifdef SO_REUSEPORT
+	using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
 	TcpServer::TcpServer(io_ctx& ctx,IEventPoller* p):
-		m_acceptor(ctx),ptr_poller(p)
+		m_ctx(ctx),m_stats(std::make_shared<TcpServerStats>()),ptr_table(nullptr),ptr_poller(p)
 	{
 		m_key = GenSvrKey();
 	}
@@ -13,41 +22,115 @@ namespace AsioNet
 	TcpServer::~TcpServer()
 	{
 		NetErr err;
-		m_acceptor.close(err);
+		for (auto& acceptor : m_acceptors) {
+			acceptor->close(err);
+		}
 	}
 
-	void TcpServer::Serve(const std::string& ip,uint16_t port)
+	void TcpServer::Serve(const std::string& ip,uint16_t port,size_t acceptorNum)
 	{
+#ifndef SO_REUSEPORT
+		acceptorNum = 1;
+#endif
+		if (!m_acceptors.empty()) {
+			return;
+		}
+		acceptorNum = acceptorNum ? acceptorNum : 1;
+
 		TcpEndPoint ep(asio::ip::address_v4().from_string(ip), port);
-		m_acceptor.open(ep.protocol());
-		m_acceptor.set_option(asio::ip::tcp::acceptor::reuse_address(true));
-		m_acceptor.bind(ep);
-		m_acceptor.listen();
-		doAccept();
+		for (size_t i = 0; i < acceptorNum; i++)
+		{
+			auto acceptor = std::make_unique<StreamAcceptor>(m_ctx);
+			acceptor->open(StreamEndPoint(ep).protocol());
+			acceptor->set_option(asio::socket_base::reuse_address(true));
+#ifdef SO_REUSEPORT
+			if (acceptorNum > 1) {
+				// 同一个端口开多个监听socket，内核按四元组hash把新连接分给它们
+				acceptor->set_option(reuse_port(true));
+			}
+#endif
+			acceptor->bind(StreamEndPoint(ep));
+			acceptor->listen();
+			m_acceptors.push_back(std::move(acceptor));
+		}
+		startAccept();
+	}
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+	void TcpServer::ServeLocal(const std::string& path)
+	{
+		if (!m_acceptors.empty()) {
+			return;
+		}
+
+		// 上次进程退出时残留的socket文件会导致bind失败，只删socket文件，path配错了不能把别的文件删掉
+		struct stat st;
+		if (::lstat(path.c_str(), &st) == 0)
+		{
+			if (!S_ISSOCK(st.st_mode)) {
+				throw asio::system_error(asio::error::address_in_use, "ServeLocal: " + path + " is not a socket");
+			}
+			::unlink(path.c_str());
+		}
+
+		asio::local::stream_protocol::endpoint ep(path);
+		auto acceptor = std::make_unique<StreamAcceptor>(m_ctx);
+		acceptor->open(StreamEndPoint(ep).protocol());
+		acceptor->bind(StreamEndPoint(ep));
+		acceptor->listen();
+		m_acceptors.push_back(std::move(acceptor));
+		startAccept();
 	}
+#endif
 
-	void TcpServer::doAccept()
+	void TcpServer::startAccept()
 	{
-		m_acceptor.async_accept([self = shared_from_this()](const NetErr& ec, TcpSock cli) {
+		// 每个acceptor同时挂起多个accept，重连潮的时候不会一个一个排队完成
+		size_t acceptNum = m_option.acceptNum ? m_option.acceptNum : 1;
+		for (auto& acceptor : m_acceptors) {
+			for (size_t i = 0; i < acceptNum; i++) {
+				doAccept(acceptor.get());
+			}
+		}
+	}
+
+	void TcpServer::doAccept(StreamAcceptor* acceptor)
+	{
+		// acceptor由server持有，回调里持有self即可保证acceptor存活
+		acceptor->async_accept([self = shared_from_this(), acceptor](const NetErr& ec, StreamSock cli) {
 			if (ec) { return; }
 
 			auto conn = std::make_shared<TcpConn>(std::move(cli),self->ptr_poller);
 
 			conn->SetOwner(&(self->connMgr));
+			conn->SetOption(self->m_option);
+			conn->SetTable(self->ptr_table);
+			conn->SetServerStats(self->m_stats);
+			conn->Register();
 			
-			// ˳ܴ
-			// PushAccept֮WriteҪ֤ʱconnMgr
-			// PushAcceptȻҪPushRecv֮ǰ˳
+			// 这里顺序不能错
+			// 如果PushAccept之后立即Write，要保证此时connMgr里面有
+			// PushAccept显然要在PushRecv之前，遂采用如下顺序
 			self->connMgr.AddConn(conn);
 			
-			TcpEndPoint remote = conn->Remote();
-			self->ptr_poller->PushAccept(conn->Key(), remote.address().to_string(),remote.port());
+			NetAddr remote = conn->Remote();
+			self->ptr_poller->PushAccept(conn->Key(), remote.ip, remote.port);
 			conn->StartRead();
 
-			self->doAccept();
+			self->doAccept(acceptor);
 		});
 	}	
 
+	void TcpServer::SetOption(const TcpOption& opt)
+	{
+		m_option = opt;
+	}
+
+	void TcpServer::SetTable(TcpConnTable* t)
+	{
+		ptr_table = t;
+	}
+
 	void TcpServer::Broadcast(const char* data,size_t trans)
 	{
 		connMgr.Broadcast(data,trans);
@@ -58,6 +141,11 @@ namespace AsioNet
 		return connMgr.GetConn(k);
 	}
 
+	std::shared_ptr<TcpServerStats> TcpServer::Stats()
+	{
+		return m_stats;
+	}
+
 	void TcpServer::Disconnect(NetKey k)
 	{
 		return connMgr.Disconnect(k);
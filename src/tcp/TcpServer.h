@@ -17,7 +17,19 @@ namespace AsioNet
 		
 		~TcpServer();
 
-		void Serve(const std::string& ip, uint16_t port);
+		// acceptorNum:监听socket的数量，大于1时需要系统支持SO_REUSEPORT，否则只开一个
+		void Serve(const std::string& ip, uint16_t port, size_t acceptorNum = 1);
+
+#ifdef ASIO_HAS_LOCAL_SOCKETS
+		// 监听unix domain socket，path上残留的socket文件会先删除，是别的文件的话抛异常
+		void ServeLocal(const std::string& path);
+#endif
+
+		// 对之后accept的连接生效
+		void SetOption(const TcpOption&);
+
+		// accept的连接登记到这个表里，NetKey由表分配
+		void SetTable(TcpConnTable*);
 
 		void Disconnect(NetKey);
 
@@ -25,17 +37,25 @@ namespace AsioNet
 
 		std::shared_ptr<TcpConn> GetConn(NetKey k);
 
+		// 这个server下所有连接的TCP_INFO采样汇总
+		std::shared_ptr<TcpServerStats> Stats();
+
 		ServerKey Key();
 
 	protected:
-		void doAccept();
+		void startAccept();
+		void doAccept(StreamAcceptor* acceptor);
 
 	private:
-		asio::ip::tcp::acceptor m_acceptor;
+		io_ctx& m_ctx;
+		std::vector<std::unique_ptr<StreamAcceptor>> m_acceptors;
 		
 		TcpConnMgr connMgr;
+		std::shared_ptr<TcpServerStats> m_stats;
+		TcpConnTable* ptr_table;
 		IEventPoller* ptr_poller;
 		ServerKey m_key;
+		TcpOption m_option;
 	};
 
 	// 自己用的一个简易Server管理器
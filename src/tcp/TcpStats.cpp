@@ -0,0 +1,54 @@
+#include "TcpStats.h"
+
+#ifdef __linux__
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#endif
+
+namespace AsioNet
+{
+#ifdef __linux__
+	// glibc的tcp_info只到tcpi_total_retrans，后面的字段按内核的布局补上
+	// 内核只会往后追加字段，老内核返回的长度短，没有的字段就当0
+	struct TcpInfoExt {
+		tcp_info base;
+		uint64_t pacingRate;
+		uint64_t maxPacingRate;
+		uint64_t bytesAcked;
+		uint64_t bytesReceived;
+		uint32_t segsOut;
+		uint32_t segsIn;
+		uint32_t notsentBytes;
+		uint32_t minRtt;
+		uint32_t dataSegsIn;
+		uint32_t dataSegsOut;
+		uint64_t deliveryRate;
+	};
+#endif
+
+	bool ReadTcpInfo(int fd, TcpStats& out)
+	{
+#ifdef __linux__
+		TcpInfoExt info{};
+		socklen_t len = sizeof(info);
+		if (::getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) != 0 || len < sizeof(tcp_info)) {
+			return false;
+		}
+		out.rtt = info.base.tcpi_rtt;
+		out.rttvar = info.base.tcpi_rttvar;
+		out.retrans = info.base.tcpi_total_retrans;
+		out.cwnd = info.base.tcpi_snd_cwnd;
+		out.unacked = info.base.tcpi_unacked;
+		out.deliveryRate = len >= sizeof(TcpInfoExt) ? info.deliveryRate : 0;
+		uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>
+			(std::chrono::system_clock::now().time_since_epoch()).count() - AN_START_TIME;
+		out.sampleTime = now ? now : 1;
+		return true;
+#else
+		(void)fd;
+		(void)out;
+		return false;
+#endif
+	}
+}
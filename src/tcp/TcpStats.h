@@ -0,0 +1,155 @@
+#pragma once
+
+#include "../utils/AsioNetDef.h"
+
+#include <atomic>
+
+namespace AsioNet
+{
+	// 一次TCP_INFO采样，时间单位us
+	struct TcpStats {
+		uint32_t rtt = 0;
+		uint32_t rttvar = 0;
+		uint32_t retrans = 0;		// 累计重传的段数
+		uint32_t cwnd = 0;			// 拥塞窗口，单位段
+		uint32_t unacked = 0;		// 已发送还没确认的段数
+		uint64_t deliveryRate = 0;	// 字节/秒，内核4.9之前没有，为0
+		uint64_t sampleTime = 0;	// 相对AN_START_TIME的毫秒数，0表示还没有采样过
+	};
+
+	// 读取socket的TCP_INFO，只支持linux，失败返回false(unix domain socket、已经关闭的socket)
+	bool ReadTcpInfo(int fd, TcpStats& out);
+
+	// conn里保存的最近一次采样，采样线程写，任意线程读
+	// 每个字段单独是原子的，读的时候可能正好碰上写了一半，对观测来说够用
+	class TcpStatsRecord {
+	public:
+		void Store(const TcpStats& s)
+		{
+			m_rtt.store(s.rtt, std::memory_order_relaxed);
+			m_rttvar.store(s.rttvar, std::memory_order_relaxed);
+			m_retrans.store(s.retrans, std::memory_order_relaxed);
+			m_cwnd.store(s.cwnd, std::memory_order_relaxed);
+			m_unacked.store(s.unacked, std::memory_order_relaxed);
+			m_deliveryRate.store(s.deliveryRate, std::memory_order_relaxed);
+			m_sampleTime.store(s.sampleTime, std::memory_order_release);
+		}
+
+		TcpStats Load()
+		{
+			TcpStats s;
+			s.sampleTime = m_sampleTime.load(std::memory_order_acquire);
+			s.rtt = m_rtt.load(std::memory_order_relaxed);
+			s.rttvar = m_rttvar.load(std::memory_order_relaxed);
+			s.retrans = m_retrans.load(std::memory_order_relaxed);
+			s.cwnd = m_cwnd.load(std::memory_order_relaxed);
+			s.unacked = m_unacked.load(std::memory_order_relaxed);
+			s.deliveryRate = m_deliveryRate.load(std::memory_order_relaxed);
+			return s;
+		}
+
+	private:
+		std::atomic<uint32_t> m_rtt{ 0 };
+		std::atomic<uint32_t> m_rttvar{ 0 };
+		std::atomic<uint32_t> m_retrans{ 0 };
+		std::atomic<uint32_t> m_cwnd{ 0 };
+		std::atomic<uint32_t> m_unacked{ 0 };
+		std::atomic<uint64_t> m_deliveryRate{ 0 };
+		std::atomic<uint64_t> m_sampleTime{ 0 };
+	};
+
+	// 按2的幂分桶的直方图，桶0统计0，桶i统计[2^(i-1),2^i)，最后一个桶包括更大的值
+	// Add无锁，任意线程都可以调用
+	class LogHistogram {
+	public:
+		static constexpr size_t BUCKET_NUM = 48;
+
+		LogHistogram()
+		{
+			Reset();
+		}
+
+		void Add(uint64_t v)
+		{
+			size_t i = 0;
+			while (v && i < BUCKET_NUM - 1)
+			{
+				v >>= 1;
+				i++;
+			}
+			m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+		}
+
+		uint64_t Count()
+		{
+			uint64_t n = 0;
+			for (auto& b : m_buckets) {
+				n += b.load(std::memory_order_relaxed);
+			}
+			return n;
+		}
+
+		// 第i个桶的计数
+		uint64_t Bucket(size_t i)
+		{
+			return i < BUCKET_NUM ? m_buckets[i].load(std::memory_order_relaxed) : 0;
+		}
+
+		// 近似的分位数，p在[0,1]，返回所在桶的上界，没有数据返回0
+		uint64_t Percentile(double p)
+		{
+			uint64_t total = Count();
+			if (!total) {
+				return 0;
+			}
+			uint64_t want = static_cast<uint64_t>(p * (total - 1)) + 1;
+			uint64_t n = 0;
+			for (size_t i = 0; i < BUCKET_NUM; i++)
+			{
+				n += m_buckets[i].load(std::memory_order_relaxed);
+				if (n >= want) {
+					return i ? (1ull << i) - 1 : 0;
+				}
+			}
+			return (1ull << (BUCKET_NUM - 1)) - 1;
+		}
+
+		void Reset()
+		{
+			for (auto& b : m_buckets) {
+				b.store(0, std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		std::atomic<uint64_t> m_buckets[BUCKET_NUM];
+	};
+
+	// 一个server下所有连接的采样汇总，每采样一个连接记一次
+	// 采样是限速轮转的，直方图反映的是一段时间里所有连接的分布，想看最近的情况就定期Reset
+	struct TcpServerStats {
+		LogHistogram rtt;			// us
+		LogHistogram rttvar;		// us
+		LogHistogram cwnd;			// 段
+		LogHistogram deliveryRate;	// 字节/秒
+		std::atomic<uint64_t> retrans{ 0 };	// 相邻两次采样之间新增的重传段数的总和
+		std::atomic<uint64_t> samples{ 0 };
+
+		void Reset()
+		{
+			rtt.Reset();
+			rttvar.Reset();
+			cwnd.Reset();
+			deliveryRate.Reset();
+			retrans.store(0, std::memory_order_relaxed);
+			samples.store(0, std::memory_order_relaxed);
+		}
+	};
+
+	// TcpNetMgr::StartStats的参数
+	// 默认每100ms采样1000个连接，10万连接时每个连接10秒采一次，每秒1万次getsockopt
+	struct TcpStatsOption {
+		uint32_t interval = 100;	// 毫秒
+		size_t budget = 1000;		// 每次最多采样的连接数
+	};
+}
@@ -20,6 +20,28 @@ namespace AsioNet {
 	};
 	
 	constexpr size_t AN_MSG_MAX_SIZE = (1 << (sizeof(AN_Msg::len) * 8)) - 1;
+
+	// 消息体的头部：msgid|flag|data
+	struct AN_MsgHead {
+		uint16_t msgid;
+		uint16_t flag;
+	};
+
+	// flag的高位保留给网络库，业务请只使用低位
+	constexpr uint16_t AN_MSG_FLAG_DROPPABLE = 1 << 15;	// 发送队列堆积时允许丢弃
+	constexpr uint16_t AN_MSG_FLAG_BUNDLE = 1 << 14;	// 合包，data是多个len(网络序)|msgid|flag|data
+	constexpr uint16_t AN_MSG_FLAG_COMPRESSED = 1 << 13;	// data经过lz4压缩
+
+	// 合包使用的msgid，业务不要使用
+	constexpr uint16_t AN_MSG_BUNDLE_ID = 0;
+
+	inline bool AN_MsgDroppable(const char* data, size_t trans)
+	{
+		if (trans < sizeof(AN_MsgHead)) {
+			return false;
+		}
+		return ((const AN_MsgHead*)data)->flag & AN_MSG_FLAG_DROPPABLE;
+	}
 	
 	using NetKey = uint64_t;	// addr:port
 	using ServerKey = uint32_t;
@@ -3,116 +3,9 @@
 #include "MemPool.h"
 #include <queue>
 
-template<size_t V_BUFFER_SIZE>
-struct BlockElem {
-	// дBlockֱbufferд
-	// ʵʿ
-	size_t Write(const char* data, size_t trans)
-	{
-		size_t remain = V_BUFFER_SIZE >= wpos ? V_BUFFER_SIZE - wpos : 0;
-		if (remain)
-		{
-			size_t copied = trans;
-			if (remain < trans)	// ʣĲ
-			{
-				copied = remain;	// ֻܿô
-			}
-			memcpy_s(buffer + wpos, remain, data, copied);
-			wpos += copied;
-			return copied;
-		}
-		return 0;
-	}
-
-	bool IsFull()
-	{
-		return wpos >= V_BUFFER_SIZE;
-	}
-
-	char buffer[V_BUFFER_SIZE];
-	size_t wpos;	// дƫ
-	BlockElem<V_BUFFER_SIZE>* next;
-	bool done;
-};
-
-template<size_t V_BUFFER_SIZE/*ÿbufferĴС*/,
-	size_t V_EXTEND_NUM/*ÿĴС*/>
-class BlockSendBuffer {
-public:
-	// ÿ伸buffer
-	BlockSendBuffer() :
-		m_pool(V_EXTEND_NUM), head(nullptr), tail(nullptr), detachedHead(nullptr)
-	{}
-	~BlockSendBuffer()
-	{}
-	bool Empty()
-	{
-		return head == nullptr;
-	}
-	BlockElem<V_BUFFER_SIZE>* DetachHead()
-	{
-		if (!detachedHead && head) {
-			detachedHead = head;
-			if (tail && tail == detachedHead) {
-				tail = tail->next;	// nil
-			}
-			head = head->next;	// could be nil
-			return detachedHead;
-		}
-		return nullptr;
-	}
-	void FreeDeatched()
-	{
-		if (detachedHead)
-		{
-			m_pool.Del(detachedHead);
-			detachedHead = nullptr;
-		}
-	}
-	// ݿܷɢڶblock
-	bool Push(const char* data, size_t trans)
-	{
-		if (trans <= 0)
-		{
-			return false;
-		}
-
-		if (!tail)
-		{
-			tail = m_pool.New();	// this will memset the block
-			if (!head)	// first push
-			{
-				head = tail;
-			}
-		}
-
-		size_t copied = 0;
-		do {
-			copied += tail->Write(data + copied, trans - copied);
-
-			if (tail->IsFull())	// ˾ٷһ
-			{
-				tail->next = m_pool.New();
-				tail = tail->next;
-			}
-		} while (copied < trans);
-		return true;
-	}
-
-	void Clear()
-	{
-		m_pool.Clear();
-		detachedHead = head = tail = nullptr;
-	}
-private:
-	BlockElem<V_BUFFER_SIZE>* head, * tail, * detachedHead;
-	MemPool_ThreadUnsafe<BlockElem<V_BUFFER_SIZE>> m_pool;
-};
-
-
 template<size_t V_BUFFER_SIZE>
 struct BlockElem_1 {
-	// ԽȫдBlockʣbuffer㣬д
+	// 尝试将数据全部写入这个Block，如果剩余buffer不足，则不写入
 	size_t WriteAll(const char* data, size_t trans)
 	{
 		size_t remain = V_BUFFER_SIZE >= wpos ? V_BUFFER_SIZE - wpos : 0;
@@ -143,17 +36,17 @@ struct BlockElem_1 {
 		done = true;
 	}
 	char buffer[V_BUFFER_SIZE];
-	size_t wpos;	// дƫ
-	size_t rpos;	// ƫ,max = V_BUFFER_SIZE
+	size_t wpos;	// 写偏移
+	size_t rpos;	// 读偏移,max = V_BUFFER_SIZE
 	BlockElem_1<V_BUFFER_SIZE>* next;
 	bool done;
 };
 
-template<size_t V_BUFFER_SIZE/*ÿbufferĴС*/,
-	size_t V_EXTEND_NUM/*ÿĴС*/>
+template<size_t V_BUFFER_SIZE/*每个buffer的大小*/,
+	size_t V_EXTEND_NUM/*每次扩充的大小*/>
 class BlockBuffer {
 public:
-	// ÿ伸buffer
+	// 每次扩充几个buffer
 	BlockBuffer() :
 		m_pool(V_EXTEND_NUM), head(nullptr), tail(nullptr)
 	{}
@@ -164,10 +57,10 @@ public:
 		return head == nullptr;
 	}
 
-	// ֤һblock
+	// 保证数据在一个block上
 	bool Push(const char* data, size_t trans)
 	{
-		// ֤дĴСһblockܷŵ
+		// 保证写入的大小在一个block里能放得下
 		if (trans <= 0 || trans > V_BUFFER_SIZE)
 		{
 			return false;
@@ -192,7 +85,7 @@ public:
 		return true;
 	}
 
-	// д봫buffer
+	// 将数据写入传进的buffer中
 	size_t Pop(char* in)
 	{
 		if (!head || que.empty())
@@ -240,7 +133,7 @@ private:
 		size_t len;
 	};
 public:
-	// ݣֱӰڲָ뱩¶ȥ
+	// 不拷贝数据，直接吧内部指针暴露出去
 	Bytes PopUnsafe()
 	{
 		if (!head || que.empty())
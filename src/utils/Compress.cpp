@@ -0,0 +1,50 @@
+#include "./Compress.h"
+
+#include <lz4.h>
+
+namespace AsioNet
+{
+	size_t CompressMsg(const char* data, size_t trans, char* out, size_t cap)
+	{
+		if (trans <= sizeof(AN_MsgHead) || cap <= sizeof(AN_MsgHead)) {
+			return 0;
+		}
+		AN_MsgHead head;
+		memcpy(&head, data, sizeof(AN_MsgHead));
+		// 合包和已经压缩过的不再处理
+		if (head.flag & (AN_MSG_FLAG_COMPRESSED | AN_MSG_FLAG_BUNDLE)) {
+			return 0;
+		}
+
+		// 压缩后至少要省下一个字节，dstCapacity给小一点，lz4发现放不下会直接失败
+		size_t maxLen = (cap < trans ? cap : trans) - 1;
+		int n = LZ4_compress_default(data + sizeof(AN_MsgHead), out + sizeof(AN_MsgHead),
+			static_cast<int>(trans - sizeof(AN_MsgHead)), static_cast<int>(maxLen - sizeof(AN_MsgHead)));
+		if (n <= 0) {
+			return 0;
+		}
+
+		head.flag |= AN_MSG_FLAG_COMPRESSED;
+		memcpy(out, &head, sizeof(AN_MsgHead));
+		return sizeof(AN_MsgHead) + n;
+	}
+
+	size_t DecompressMsg(const char* data, size_t trans, char* out, size_t cap)
+	{
+		if (trans <= sizeof(AN_MsgHead) || cap <= sizeof(AN_MsgHead)) {
+			return 0;
+		}
+		AN_MsgHead head;
+		memcpy(&head, data, sizeof(AN_MsgHead));
+
+		int n = LZ4_decompress_safe(data + sizeof(AN_MsgHead), out + sizeof(AN_MsgHead),
+			static_cast<int>(trans - sizeof(AN_MsgHead)), static_cast<int>(cap - sizeof(AN_MsgHead)));
+		if (n < 0) {
+			return 0;
+		}
+
+		head.flag &= ~AN_MSG_FLAG_COMPRESSED;
+		memcpy(out, &head, sizeof(AN_MsgHead));
+		return sizeof(AN_MsgHead) + n;
+	}
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "./AsioNetDef.h"
+
+namespace AsioNet
+{
+	// 单条消息的压缩，使用lz4
+	// 压缩后：msgid|flag(带AN_MSG_FLAG_COMPRESSED)|lz4(data)，msgid和flag不压缩，发送队列的水位判断照常可用
+	// 解压的时候目标缓冲区按AN_MSG_MAX_SIZE准备，不需要额外记录原始长度
+
+	// data:msgid|flag|data，out的容量至少为trans
+	// 压缩之后变小了才返回压缩后的长度，否则返回0，调用方直接发送原始数据
+	size_t CompressMsg(const char* data, size_t trans, char* out, size_t cap);
+
+	// data:压缩过的消息，解压到out：msgid|flag(去掉AN_MSG_FLAG_COMPRESSED)|data
+	// 失败返回0
+	size_t DecompressMsg(const char* data, size_t trans, char* out, size_t cap);
+}
@@ -112,6 +112,35 @@ public:
 		((Elem*)p)->next = m_freeHead;
 		m_freeHead = (Elem*)p;
 	}
+	// 一次加锁取n个，不清零，T当原始内存块用的时候用这个
+	void NewBatch(T** out, size_t n)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (size_t i = 0; i < n; i++)
+		{
+			if (m_freeHead == nullptr)
+			{
+				ExtendPool();
+			}
+			out[i] = &(m_freeHead->data);
+			m_freeHead = m_freeHead->next;
+		}
+	}
+	void DelBatch(T* const* ps, size_t n)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (size_t i = 0; i < n; i++)
+		{
+			((Elem*)ps[i])->next = m_freeHead;
+			m_freeHead = (Elem*)ps[i];
+		}
+	}
+	// 已经向系统申请的元素个数
+	size_t Capacity()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		return m_pool.size() * m_extendSize;
+	}
 protected:
 	void ExtendPool()
 	{
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+
+namespace AsioNet
+{
+	// 侵入式队列的节点，需要入队的结构继承它即可
+	struct MpscNode
+	{
+		std::atomic<MpscNode*> next{ nullptr };
+	};
+
+	// 多生产者单消费者的无锁队列(Dmitry Vyukov的intrusive mpsc)
+	// Push:任意线程，wait-free，一次exchange
+	// Pop/Empty:同一时间只能有一个消费者，由外部保证
+	// 节点的内存由使用者管理，队列只负责串起来
+	class MpscQueue
+	{
+	public:
+		MpscQueue(const MpscQueue&) = delete;
+		MpscQueue(MpscQueue&&) = delete;
+		MpscQueue& operator=(const MpscQueue&) = delete;
+		MpscQueue& operator=(MpscQueue&&) = delete;
+
+		MpscQueue() :m_tail(&m_stub), m_head(&m_stub) {}
+
+		void Push(MpscNode* n)
+		{
+			n->next.store(nullptr, std::memory_order_relaxed);
+			MpscNode* prev = m_tail.exchange(n, std::memory_order_acq_rel);
+			// exchange和下面这句之间，消费者会看到一个断开的链表，Pop返回nullptr但Empty为false
+			prev->next.store(n, std::memory_order_release);
+		}
+
+		// 队列为空，或者有生产者正好在Push的中间，都返回nullptr
+		MpscNode* Pop()
+		{
+			MpscNode* head = m_head;
+			MpscNode* next = head->next.load(std::memory_order_acquire);
+			if (head == &m_stub)
+			{
+				if (!next) {
+					return nullptr;
+				}
+				m_head = next;
+				head = next;
+				next = next->next.load(std::memory_order_acquire);
+			}
+			if (next)
+			{
+				m_head = next;
+				return head;
+			}
+
+			if (head != m_tail.load(std::memory_order_acquire)) {
+				return nullptr;
+			}
+			// 只剩最后一个节点，把stub放回去才能把它取出来
+			Push(&m_stub);
+			next = head->next.load(std::memory_order_acquire);
+			if (next)
+			{
+				m_head = next;
+				return head;
+			}
+			return nullptr;
+		}
+
+		// 消费者调用，没有任何生产者push过新节点才为true
+		bool Empty()
+		{
+			MpscNode* tail = m_tail.load(std::memory_order_seq_cst);
+			return tail == m_head && tail == &m_stub;
+		}
+
+	private:
+		alignas(64) std::atomic<MpscNode*> m_tail;	// 生产者
+		alignas(64) MpscNode* m_head;				// 消费者
+		MpscNode m_stub;
+	};
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "./AsioNetDef.h"
+
+namespace AsioNet
+{
+	// 接收超速之后的处理策略
+	enum class RateLimitPolicy
+	{
+		RLP_DROP = 0,	// 直接丢弃超速的消息
+		RLP_PAUSE,		// 消息留着，暂停读这个连接，等令牌够了再交给上层；tcp会靠窗口把对端压住，kcp退化为丢弃
+		RLP_NOTIFY,		// 丢弃，并通知上层RATE_LIMITED，每次超速只通知一次，恢复之后才会再次通知
+	};
+
+	// 令牌桶：每秒补充rate个令牌，最多存burst个，rate为0表示不限制
+	struct TokenBucketOption
+	{
+		uint32_t rate = 0;
+		uint32_t burst = 0;		// 0表示和rate一样，即允许一秒的突发
+	};
+
+	// 接收限速，在io线程里、交给IEventPoller之前检查
+	// 合包按里面的子消息计数
+	struct RecvLimitOption
+	{
+		TokenBucketOption connMsg;		// 整个连接每秒的消息数
+		TokenBucketOption connBytes;	// 整个连接每秒的字节数
+		std::unordered_map<uint16_t, TokenBucketOption> msg;	// 按msgid单独限制每秒的消息数
+		RateLimitPolicy policy = RateLimitPolicy::RLP_DROP;
+	};
+
+	// 令牌按 个数*1000000 存，按微秒补充，避免浮点
+	class TokenBucket
+	{
+	public:
+		static constexpr uint64_t SCALE = 1000000;
+
+		TokenBucket() :m_rate(0), m_burst(0), m_tokens(0), m_last(0), m_pending(0) {}
+
+		void SetOption(const TokenBucketOption& opt, uint64_t nowUs)
+		{
+			m_rate = opt.rate;
+			m_burst = static_cast<uint64_t>(opt.burst ? opt.burst : opt.rate) * SCALE;
+			m_tokens = m_burst;
+			m_last = nowUs;
+			m_pending = 0;
+		}
+
+		bool Enabled()
+		{
+			return m_rate != 0;
+		}
+
+		// 先把一次检查要用的令牌记下来，所有桶都够了再一起扣，避免扣了一半
+		void Want(uint64_t n)
+		{
+			m_pending += n * SCALE;
+		}
+
+		// 令牌够的话返回0，否则返回还要等多少微秒
+		uint64_t Check(uint64_t nowUs)
+		{
+			refill(nowUs);
+			// 一次要的比桶还大，等桶满了就放过去，不然RLP_PAUSE会一直等下去
+			uint64_t need = std::min(m_pending, m_burst);
+			if (m_tokens >= need) {
+				return 0;
+			}
+			return (need - m_tokens + m_rate - 1) / m_rate;
+		}
+
+		void Commit(bool take)
+		{
+			if (take) {
+				m_tokens -= std::min(m_pending, m_tokens);
+			}
+			m_pending = 0;
+		}
+
+	private:
+		void refill(uint64_t nowUs)
+		{
+			// 没开的桶也会被Check，burst是0，不用补
+			if (nowUs > m_last && m_rate)
+			{
+				// 空闲很久之后 经过的时间*rate 会溢出，超过把桶补满所需的时间就没有意义了
+				uint64_t elapsed = std::min(nowUs - m_last, (m_burst + m_rate - 1) / m_rate);
+				m_tokens = std::min(m_burst, m_tokens + elapsed * m_rate);
+				m_last = nowUs;
+			}
+		}
+
+		uint64_t m_rate;
+		uint64_t m_burst;
+		uint64_t m_tokens;
+		uint64_t m_last;
+		uint64_t m_pending;
+	};
+
+	// 一个连接的接收限速，只负责给出动作，具体怎么做由conn决定
+	// 只在这个连接的读回调里使用，不加锁
+	class RecvLimiter
+	{
+	public:
+		enum class Action
+		{
+			RL_PASS,	// 交给上层
+			RL_DROP,	// 丢弃
+			RL_PAUSE,	// 暂停读，waitUs之后再检查一次
+			RL_NOTIFY,	// 丢弃，并通知上层
+		};
+
+		RecvLimiter() :m_enabled(false), m_limited(false), m_policy(RateLimitPolicy::RLP_DROP) {}
+
+		void SetOption(const RecvLimitOption& opt)
+		{
+			uint64_t now = nowUs();
+			m_policy = opt.policy;
+			m_connMsg.SetOption(opt.connMsg, now);
+			m_connBytes.SetOption(opt.connBytes, now);
+			m_msg.clear();
+			for (auto& p : opt.msg)
+			{
+				if (p.second.rate) {
+					m_msg[p.first].SetOption(p.second, now);
+				}
+			}
+			m_enabled = m_connMsg.Enabled() || m_connBytes.Enabled() || !m_msg.empty();
+			m_limited = false;
+		}
+
+		bool Enabled()
+		{
+			return m_enabled;
+		}
+
+		// data/trans:收到的一条消息，msgid|flag|data
+		// 合包按子消息计数，和EventDriver一样只看flag
+		// 压缩过的合包直接丢掉：CompressMsg不压缩合包，这种包只能是对端构造的，不解压数不出子消息，EventDriver也不分发
+		Action Check(const char* data, size_t trans, uint64_t& waitUs)
+		{
+			waitUs = 0;
+			AN_MsgHead head{ 0,0 };
+			if (trans >= sizeof(AN_MsgHead)) {
+				memcpy(&head, data, sizeof(AN_MsgHead));
+			}
+			if ((head.flag & AN_MSG_FLAG_BUNDLE) && (head.flag & AN_MSG_FLAG_COMPRESSED)) {
+				return Action::RL_DROP;
+			}
+
+			uint64_t now = nowUs();
+			m_connBytes.Want(trans);
+			if (head.flag & AN_MSG_FLAG_BUNDLE) {
+				wantBundle(data + sizeof(AN_MsgHead), trans - sizeof(AN_MsgHead));
+			}
+			else {
+				wantMsg(head.msgid);
+			}
+
+			waitUs = m_connMsg.Check(now);
+			waitUs = std::max(waitUs, m_connBytes.Check(now));
+			for (auto& p : m_msg) {
+				waitUs = std::max(waitUs, p.second.Check(now));
+			}
+
+			// 没通过的不扣令牌，RLP_PAUSE的消息等一会儿还会再检查一次
+			bool pass = waitUs == 0;
+			m_connMsg.Commit(pass);
+			m_connBytes.Commit(pass);
+			for (auto& p : m_msg) {
+				p.second.Commit(pass);
+			}
+
+			if (pass)
+			{
+				m_limited = false;
+				return Action::RL_PASS;
+			}
+			switch (m_policy)
+			{
+			case RateLimitPolicy::RLP_PAUSE:
+				return Action::RL_PAUSE;
+			case RateLimitPolicy::RLP_NOTIFY:
+				if (!m_limited)
+				{
+					m_limited = true;
+					return Action::RL_NOTIFY;
+				}
+				return Action::RL_DROP;
+			default:
+				return Action::RL_DROP;
+			}
+		}
+
+	private:
+		static uint64_t nowUs()
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>
+				(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		void wantMsg(uint16_t msgid)
+		{
+			m_connMsg.Want(1);
+			if (!m_msg.empty())
+			{
+				auto itr = m_msg.find(msgid);
+				if (itr != m_msg.end()) {
+					itr->second.Want(1);
+				}
+			}
+		}
+
+		// 合包：len(网络序)|msgid|flag|data ...，格式不对的交给EventDriver去报错，这里按一条算
+		void wantBundle(const char* data, size_t len)
+		{
+			size_t num = 0;
+			while (len >= sizeof(AN_Msg::len) + sizeof(AN_MsgHead))
+			{
+				decltype(AN_Msg::len) netLen = 0;
+				memcpy(&netLen, data, sizeof(AN_Msg::len));
+				size_t subLen = asio::detail::socket_ops::network_to_host_short(netLen);
+				if (subLen < sizeof(AN_MsgHead) || subLen > len - sizeof(AN_Msg::len)) {
+					break;
+				}
+				AN_MsgHead head;
+				memcpy(&head, data + sizeof(AN_Msg::len), sizeof(AN_MsgHead));
+				wantMsg(head.msgid);
+				data += sizeof(AN_Msg::len) + subLen;
+				len -= sizeof(AN_Msg::len) + subLen;
+				num++;
+			}
+			if (!num) {
+				m_connMsg.Want(1);
+			}
+		}
+
+		bool m_enabled;
+		bool m_limited;		// RLP_NOTIFY：已经通知过了
+		RateLimitPolicy m_policy;
+		TokenBucket m_connMsg;
+		TokenBucket m_connBytes;
+		std::unordered_map<uint16_t, TokenBucket> m_msg;
+	};
+}
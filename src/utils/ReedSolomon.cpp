@@ -0,0 +1,373 @@
+#include "ReedSolomon.h"
+
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define ASIONET_GF_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// gcc/clang不开-mavx2也能编译单个函数，运行时按cpu选
+#if defined(ASIONET_GF_X86) && (defined(__GNUC__) || defined(__clang__))
+#define ASIONET_TARGET(x) __attribute__((target(x)))
+#else
+#define ASIONET_TARGET(x)
+#endif
+
+namespace AsioNet
+{
+	// ******************** GF(2^8)，本原多项式x^8+x^4+x^3+x^2+1(0x11d)，生成元2 ********************
+	namespace
+	{
+		struct GfTables
+		{
+			uint8_t exp[512];
+			uint8_t log[256];
+			uint8_t mul[256][256];
+			// mulLow[c][x] = c * x，mulHigh[c][x] = c * (x << 4)，x < 16，给pshufb用
+			alignas(16) uint8_t mulLow[256][16];
+			alignas(16) uint8_t mulHigh[256][16];
+
+			GfTables()
+			{
+				unsigned x = 1;
+				for (int i = 0; i < 255; i++)
+				{
+					exp[i] = static_cast<uint8_t>(x);
+					log[x] = static_cast<uint8_t>(i);
+					x <<= 1;
+					if (x & 0x100) {
+						x ^= 0x11d;
+					}
+				}
+				// 两倍长，乘法的时候log相加不用取模
+				for (int i = 255; i < 512; i++) {
+					exp[i] = exp[i - 255];
+				}
+				log[0] = 0;
+				for (int a = 0; a < 256; a++)
+				{
+					for (int b = 0; b < 256; b++) {
+						mul[a][b] = (a && b) ? exp[log[a] + log[b]] : 0;
+					}
+					for (int i = 0; i < 16; i++)
+					{
+						mulLow[a][i] = mul[a][i];
+						mulHigh[a][i] = mul[a][i << 4];
+					}
+				}
+			}
+		};
+
+		const GfTables& gf()
+		{
+			static const GfTables tables;
+			return tables;
+		}
+
+		uint8_t gfMul(uint8_t a, uint8_t b)
+		{
+			return gf().mul[a][b];
+		}
+
+		uint8_t gfInv(uint8_t a)
+		{
+			return gf().exp[255 - gf().log[a]];
+		}
+
+		// ******************** kernels ********************
+		void mulAddScalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+		{
+			const uint8_t* t = gf().mul[c];
+			for (size_t i = 0; i < len; i++) {
+				dst[i] ^= t[src[i]];
+			}
+		}
+
+		void mulScalar(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+		{
+			const uint8_t* t = gf().mul[c];
+			for (size_t i = 0; i < len; i++) {
+				dst[i] = t[src[i]];
+			}
+		}
+
+#ifdef ASIONET_GF_X86
+		template<bool ADD>
+		ASIONET_TARGET("ssse3")
+		void mulSsse3(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+		{
+			const __m128i low = _mm_load_si128(reinterpret_cast<const __m128i*>(gf().mulLow[c]));
+			const __m128i high = _mm_load_si128(reinterpret_cast<const __m128i*>(gf().mulHigh[c]));
+			const __m128i mask = _mm_set1_epi8(0x0f);
+			size_t i = 0;
+			for (; i + 16 <= len; i += 16)
+			{
+				__m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+				__m128i l = _mm_shuffle_epi8(low, _mm_and_si128(s, mask));
+				__m128i h = _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+				__m128i r = _mm_xor_si128(l, h);
+				if (ADD) {
+					r = _mm_xor_si128(r, _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i)));
+				}
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), r);
+			}
+			if (ADD) {
+				mulAddScalar(dst + i, src + i, c, len - i);
+			}
+			else {
+				mulScalar(dst + i, src + i, c, len - i);
+			}
+		}
+
+		template<bool ADD>
+		ASIONET_TARGET("avx2")
+		void mulAvx2(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+		{
+			// 两个128位的lane各放一份表，pshufb是按lane查的
+			const __m256i low = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(gf().mulLow[c])));
+			const __m256i high = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<const __m128i*>(gf().mulHigh[c])));
+			const __m256i mask = _mm256_set1_epi8(0x0f);
+			size_t i = 0;
+			for (; i + 32 <= len; i += 32)
+			{
+				__m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+				__m256i l = _mm256_shuffle_epi8(low, _mm256_and_si256(s, mask));
+				__m256i h = _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask));
+				__m256i r = _mm256_xor_si256(l, h);
+				if (ADD) {
+					r = _mm256_xor_si256(r, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i)));
+				}
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), r);
+			}
+			mulSsse3<ADD>(dst + i, src + i, c, len - i);
+		}
+
+		bool cpuHas(GfKernel k)
+		{
+#if defined(__GNUC__) || defined(__clang__)
+			__builtin_cpu_init();
+			return k == GfKernel::GK_AVX2 ? __builtin_cpu_supports("avx2") : __builtin_cpu_supports("ssse3");
+#elif defined(_MSC_VER)
+			int info[4] = { 0 };
+			if (k == GfKernel::GK_AVX2)
+			{
+				// avx2还要操作系统保存ymm寄存器
+				__cpuid(info, 1);
+				bool osxsave = (info[2] & (1 << 27)) != 0;
+				if (!osxsave || (_xgetbv(0) & 6) != 6) {
+					return false;
+				}
+				__cpuidex(info, 7, 0);
+				return (info[1] & (1 << 5)) != 0;
+			}
+			__cpuid(info, 1);
+			return (info[2] & (1 << 9)) != 0;
+#else
+			return false;
+#endif
+		}
+#endif
+
+		using MulFunc = void (*)(uint8_t*, const uint8_t*, uint8_t, size_t);
+
+		struct Kernel
+		{
+			GfKernel kind;
+			MulFunc mulAdd;
+			MulFunc mul;
+		};
+
+		bool makeKernel(GfKernel k, Kernel& out)
+		{
+			switch (k)
+			{
+			case GfKernel::GK_SCALAR:
+				out = { k, &mulAddScalar, &mulScalar };
+				return true;
+#ifdef ASIONET_GF_X86
+			case GfKernel::GK_SSSE3:
+				if (cpuHas(k))
+				{
+					out = { k, &mulSsse3<true>, &mulSsse3<false> };
+					return true;
+				}
+				return false;
+			case GfKernel::GK_AVX2:
+				if (cpuHas(k))
+				{
+					out = { k, &mulAvx2<true>, &mulAvx2<false> };
+					return true;
+				}
+				return false;
+#endif
+			default:
+				return false;
+			}
+		}
+
+		Kernel& kernel()
+		{
+			static Kernel k = [] {
+				Kernel best;
+				if (!makeKernel(GfKernel::GK_AVX2, best) && !makeKernel(GfKernel::GK_SSSE3, best)) {
+					makeKernel(GfKernel::GK_SCALAR, best);
+				}
+				return best;
+			}();
+			return k;
+		}
+	}
+
+	GfKernel GfGetKernel()
+	{
+		return kernel().kind;
+	}
+
+	bool GfSetKernel(GfKernel k)
+	{
+		Kernel tmp;
+		if (!makeKernel(k, tmp)) {
+			return false;
+		}
+		kernel() = tmp;
+		return true;
+	}
+
+	void GfMulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+	{
+		if (c == 0) {
+			return;
+		}
+		kernel().mulAdd(dst, src, c, len);
+	}
+
+	void GfMul(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len)
+	{
+		if (c == 0) {
+			memset(dst, 0, len);
+			return;
+		}
+		kernel().mul(dst, src, c, len);
+	}
+
+	// ******************** ReedSolomon ********************
+	ReedSolomon::ReedSolomon(size_t dataShards, size_t parityShards) :
+		m_data(dataShards), m_parity(parityShards), m_matrix(dataShards * parityShards)
+	{
+		// Cauchy矩阵：m[i][j] = 1 / (x_i + y_j)，x_i = data + i，y_j = j，所有x、y互不相同
+		for (size_t i = 0; i < m_parity; i++)
+		{
+			for (size_t j = 0; j < m_data; j++) {
+				m_matrix[i * m_data + j] = gfInv(static_cast<uint8_t>((m_data + i) ^ j));
+			}
+		}
+	}
+
+	void ReedSolomon::Encode(uint8_t* const* shards, size_t size)
+	{
+		for (size_t i = 0; i < m_parity; i++)
+		{
+			uint8_t* out = shards[m_data + i];
+			const uint8_t* row = &m_matrix[i * m_data];
+			GfMul(out, shards[0], row[0], size);
+			for (size_t j = 1; j < m_data; j++) {
+				GfMulAdd(out, shards[j], row[j], size);
+			}
+		}
+	}
+
+	bool ReedSolomon::Reconstruct(uint8_t* const* shards, const bool* present, size_t size)
+	{
+		// 选dataShards个收到的分片，对应的编码矩阵的行拼成方阵
+		std::vector<uint8_t> m(m_data * m_data, 0);
+		std::vector<size_t> rows;
+		for (size_t i = 0; i < m_data + m_parity && rows.size() < m_data; i++)
+		{
+			if (!present[i]) {
+				continue;
+			}
+			uint8_t* dst = &m[rows.size() * m_data];
+			if (i < m_data) {
+				dst[i] = 1;
+			}
+			else {
+				memcpy(dst, &m_matrix[(i - m_data) * m_data], m_data);
+			}
+			rows.push_back(i);
+		}
+		if (rows.size() < m_data) {
+			return false;
+		}
+
+		// 缺数据分片的时候，rows里一定有校验分片，方阵可逆(Cauchy矩阵的性质)
+		if (!invert(m, m_data)) {
+			return false;
+		}
+
+		// data[j] = sum(inv[j][k] * received[k])
+		for (size_t j = 0; j < m_data; j++)
+		{
+			if (present[j]) {
+				continue;
+			}
+			const uint8_t* row = &m[j * m_data];
+			GfMul(shards[j], shards[rows[0]], row[0], size);
+			for (size_t k = 1; k < m_data; k++) {
+				GfMulAdd(shards[j], shards[rows[k]], row[k], size);
+			}
+		}
+		return true;
+	}
+
+	bool ReedSolomon::invert(std::vector<uint8_t>& m, size_t n)
+	{
+		// 高斯-约当消元，右边拼一个单位矩阵
+		std::vector<uint8_t> inv(n * n, 0);
+		for (size_t i = 0; i < n; i++) {
+			inv[i * n + i] = 1;
+		}
+		for (size_t col = 0; col < n; col++)
+		{
+			size_t pivot = col;
+			while (pivot < n && m[pivot * n + col] == 0) {
+				pivot++;
+			}
+			if (pivot == n) {
+				return false;
+			}
+			if (pivot != col)
+			{
+				for (size_t k = 0; k < n; k++)
+				{
+					std::swap(m[pivot * n + k], m[col * n + k]);
+					std::swap(inv[pivot * n + k], inv[col * n + k]);
+				}
+			}
+			uint8_t scale = gfInv(m[col * n + col]);
+			for (size_t k = 0; k < n; k++)
+			{
+				m[col * n + k] = gfMul(m[col * n + k], scale);
+				inv[col * n + k] = gfMul(inv[col * n + k], scale);
+			}
+			for (size_t r = 0; r < n; r++)
+			{
+				uint8_t f = m[r * n + col];
+				if (r == col || f == 0) {
+					continue;
+				}
+				for (size_t k = 0; k < n; k++)
+				{
+					m[r * n + k] ^= gfMul(f, m[col * n + k]);
+					inv[r * n + k] ^= gfMul(f, inv[col * n + k]);
+				}
+			}
+		}
+		m.swap(inv);
+		return true;
+	}
+}
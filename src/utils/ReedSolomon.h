@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace AsioNet
+{
+	// GF(2^8)上的乘加：dst[i] ^= c * src[i]
+	// x86上按cpu支持的指令选AVX2/SSSE3的查表实现(pshufb，高低4位各查一次16字节的表)，否则逐字节查表
+	enum class GfKernel
+	{
+		GK_SCALAR = 0,
+		GK_SSSE3,
+		GK_AVX2,
+	};
+
+	// 当前使用的实现，第一次调用的时候按cpu选最快的
+	GfKernel GfGetKernel();
+	// 压测用：强制使用某个实现，cpu不支持返回false
+	bool GfSetKernel(GfKernel);
+
+	void GfMulAdd(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+	// dst[i] = c * src[i]
+	void GfMul(uint8_t* dst, const uint8_t* src, uint8_t c, size_t len);
+
+	// 系统码的Reed-Solomon：dataShards个数据分片原样发送，另外算出parityShards个校验分片
+	// 任意丢掉不超过parityShards个分片，都能从剩下的分片里恢复出数据分片
+	// 校验矩阵用Cauchy矩阵，和单位矩阵拼起来任意dataShards行都可逆
+	// 所有分片一样长，不够长的由调用方补0
+	class ReedSolomon
+	{
+	public:
+		// dataShards + parityShards <= 256
+		ReedSolomon(size_t dataShards, size_t parityShards);
+
+		size_t DataShards() const { return m_data; }
+		size_t ParityShards() const { return m_parity; }
+
+		// shards:dataShards + parityShards个分片，前面的是数据，算出后面的校验分片
+		void Encode(uint8_t* const* shards, size_t size);
+
+		// present[i]表示shards[i]收到了，恢复缺的数据分片写回shards[i](缓冲区由调用方准备)，校验分片不恢复
+		// 收到的分片少于dataShards返回false
+		bool Reconstruct(uint8_t* const* shards, const bool* present, size_t size);
+
+	private:
+		// n*n的矩阵求逆，结果写回m，不可逆返回false
+		static bool invert(std::vector<uint8_t>& m, size_t n);
+
+		size_t m_data;
+		size_t m_parity;
+		std::vector<uint8_t> m_matrix;	// 校验部分，parity行data列
+	};
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+#include "./AsioNetDef.h"
+
+namespace AsioNet
+{
+	// 发送队列超过高水位之后的处理策略
+	enum class SlowConsumerPolicy
+	{
+		SCP_NOTIFY = 0,		// 通知上层，消息照常入队
+		SCP_DROP,			// 丢弃标记了AN_MSG_FLAG_DROPPABLE的消息，其余照常入队并通知
+		SCP_DISCONNECT,		// 直接断开连接
+	};
+
+	struct SendQueueOption
+	{
+		size_t highWatermark = 0;	// 单位字节，0表示不限制
+		SlowConsumerPolicy policy = SlowConsumerPolicy::SCP_NOTIFY;
+	};
+
+	// 发送队列的水位检测，只负责给出动作，具体怎么做由conn决定
+	// 通知只在越过高水位时发一次，回落到高水位的一半以下才会重新触发
+	class SendWatermark
+	{
+	public:
+		enum class Action
+		{
+			SW_PUSH,		// 正常入队
+			SW_NOTIFY,		// 入队，并通知上层
+			SW_DROP,		// 丢弃这条消息
+			SW_DISCONNECT,	// 断开连接
+		};
+
+		SendWatermark() :m_above(false) {}
+
+		void SetOption(const SendQueueOption& opt)
+		{
+			m_opt = opt;
+		}
+
+		// queued:当前队列中的字节数，trans:本次要入队的字节数
+		Action Check(size_t queued, const char* data, size_t trans)
+		{
+			if (!m_opt.highWatermark || queued + trans <= m_opt.highWatermark)
+			{
+				return Action::SW_PUSH;
+			}
+
+			switch (m_opt.policy)
+			{
+			case SlowConsumerPolicy::SCP_DISCONNECT:
+				return Action::SW_DISCONNECT;
+			case SlowConsumerPolicy::SCP_DROP:
+				if (AN_MsgDroppable(data, trans)) {
+					return Action::SW_DROP;
+				}
+				[[fallthrough]];
+			default:
+				return m_above.exchange(true) ? Action::SW_PUSH : Action::SW_NOTIFY;
+			}
+		}
+
+		// 发送队列有数据发出去之后调用
+		void Drained(size_t queued)
+		{
+			if (queued <= m_opt.highWatermark / 2) {
+				m_above = false;
+			}
+		}
+
+	private:
+		SendQueueOption m_opt;
+		std::atomic<bool> m_above;
+	};
+}
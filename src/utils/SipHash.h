@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstring>
+#include <stdint.h>
+
+namespace AsioNet
+{
+	// SipHash-2-4，128位key，输出64位
+	// 用作短消息的MAC，比如握手的cookie，key不公开的前提下对端算不出来
+	// doc:https://www.aumasson.jp/siphash/siphash.pdf
+	inline uint64_t SipHash(uint64_t k0, uint64_t k1, const void* data, size_t len)
+	{
+		auto rotl = [](uint64_t x, int b) { return (x << b) | (x >> (64 - b)); };
+		uint64_t v0 = 0x736f6d6570736575ull ^ k0;
+		uint64_t v1 = 0x646f72616e646f6dull ^ k1;
+		uint64_t v2 = 0x6c7967656e657261ull ^ k0;
+		uint64_t v3 = 0x7465646279746573ull ^ k1;
+		auto round = [&]() {
+			v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+			v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+			v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+			v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+		};
+
+		// 按小端读8字节一组
+		auto p = static_cast<const uint8_t*>(data);
+		size_t left = len;
+		for (; left >= 8; left -= 8, p += 8)
+		{
+			uint64_t m = 0;
+			for (int i = 7; i >= 0; i--) {
+				m = (m << 8) | p[i];
+			}
+			v3 ^= m;
+			round();
+			round();
+			v0 ^= m;
+		}
+		uint64_t b = static_cast<uint64_t>(len) << 56;
+		for (size_t i = 0; i < left; i++) {
+			b |= static_cast<uint64_t>(p[i]) << (8 * i);
+		}
+		v3 ^= b;
+		round();
+		round();
+		v0 ^= b;
+
+		v2 ^= 0xff;
+		round();
+		round();
+		round();
+		round();
+		return v0 ^ v1 ^ v2 ^ v3;
+	}
+}
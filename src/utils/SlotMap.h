@@ -0,0 +1,329 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <utility>
+#include <vector>
+
+#include "./AsioNetDef.h"
+
+namespace AsioNet
+{
+	// 带代数的slot map，key = gen << V_INDEX_BITS | idx
+	// Visit:任意线程，无锁，一次下标寻址 + 一次fetch_add，key过期(连接已经删掉或者slot被复用)返回false
+	// Add/Del:任意线程，无锁，只有扩容的时候拿一下锁
+	// 元素在Del之后，等最后一个正在Visit的线程退出才析构，之后slot的代数+1再放回空闲链表
+	// 存储按块分配，扩容不搬移旧的元素，Visit拿到的引用在回调期间一直有效
+	template<class T, uint32_t V_INDEX_BITS = 24, uint32_t V_GEN_BITS = 32>
+	class SlotMap
+	{
+		static_assert(V_INDEX_BITS > 0 && V_INDEX_BITS <= 32, "index bits must be in (0,32]");
+		static_assert(V_GEN_BITS > 0 && V_GEN_BITS <= 32, "gen bits must be in (0,32]");
+		static_assert(V_INDEX_BITS + V_GEN_BITS <= 64, "key must fit in 64 bits");
+
+		// slot状态：gen(32) | live(1) | retired(1) | pins(30)
+		static constexpr uint64_t LIVE = 1ull << 31;
+		static constexpr uint64_t RETIRED = 1ull << 30;
+		static constexpr uint64_t PIN_MASK = RETIRED - 1;
+
+		static constexpr uint32_t CHUNK_BITS = V_INDEX_BITS < 12 ? V_INDEX_BITS : 12;
+		static constexpr uint32_t CHUNK_SIZE = 1u << CHUNK_BITS;
+		static constexpr uint64_t MAX_CHUNKS = 1ull << (V_INDEX_BITS - CHUNK_BITS);
+		static constexpr uint64_t INDEX_MASK = (1ull << V_INDEX_BITS) - 1;
+		static constexpr uint64_t GEN_MASK = (1ull << V_GEN_BITS) - 1;
+
+		struct Slot {
+			std::atomic<uint64_t> state{ 1ull << 32 };	// 代数从1开始，保证key不为0
+			std::atomic<uint32_t> nextFree{ 0 };		// 空闲链表，存的是idx+1
+			alignas(T) unsigned char storage[sizeof(T)];
+
+			T* Value() { return std::launder(reinterpret_cast<T*>(storage)); }
+		};
+
+	public:
+		using Key = uint64_t;
+
+		SlotMap(const SlotMap&) = delete;
+		SlotMap(SlotMap&&) = delete;
+		SlotMap& operator=(const SlotMap&) = delete;
+		SlotMap& operator=(SlotMap&&) = delete;
+
+		SlotMap() :m_freeHead(0), m_chunkNum(0), m_size(0)
+		{
+			for (auto& c : m_chunks) {
+				c.store(nullptr, std::memory_order_relaxed);
+			}
+		}
+
+		~SlotMap()
+		{
+			// 先让所有的key失效，元素析构的时候如果再调用Del，会因为代数不对直接返回
+			std::vector<Slot*> alive;
+			for (uint64_t c = 0; c < m_chunkNum; c++)
+			{
+				Slot* chunk = m_chunks[c].load(std::memory_order_acquire);
+				for (uint32_t i = 0; i < CHUNK_SIZE; i++)
+				{
+					uint64_t v = chunk[i].state.load(std::memory_order_acquire);
+					if (v & (LIVE | RETIRED))
+					{
+						chunk[i].state.store(nextGen(v >> 32) << 32, std::memory_order_release);
+						alive.push_back(&chunk[i]);
+					}
+				}
+			}
+			for (auto s : alive) {
+				s->Value()->~T();
+			}
+			for (uint64_t c = 0; c < m_chunkNum; c++) {
+				delete[] m_chunks[c].load(std::memory_order_relaxed);
+			}
+		}
+
+		// 满了返回0
+		Key Add(T&& value)
+		{
+			uint32_t idx = 0;
+			if (!popFree(idx) && !grow(idx)) {
+				return 0;
+			}
+
+			Slot* s = slot(idx);
+			new (s->storage) T(std::move(value));
+			// release：Visit看到LIVE的时候，一定能看到构造好的元素
+			uint64_t v = s->state.fetch_or(LIVE, std::memory_order_release);
+			m_size.fetch_add(1, std::memory_order_relaxed);
+			return ((v >> 32) << V_INDEX_BITS) | idx;
+		}
+
+		// key有效时调用f(T&)并返回true
+		template<typename F>
+		bool Visit(Key key, F&& f)
+		{
+			uint64_t gen = 0;
+			uint32_t idx = 0;
+			Slot* s = decode(key, gen, idx);
+			if (!s) {
+				return false;
+			}
+
+			// 先占住slot，再检查代数，这样检查通过之后元素不会被析构
+			uint64_t v = s->state.fetch_add(1, std::memory_order_acquire);
+			bool ok = (v >> 32) == gen && (v & LIVE);
+			if (ok) {
+				f(*(s->Value()));
+			}
+			unpin(s, idx);
+			return ok;
+		}
+
+		// 不看代数，下标上有元素就调用f(T&)并返回true
+		// 给只知道下标的场合用，元素是不是要找的那个由调用者用元素里存的字段判断
+		template<typename F>
+		bool VisitIndex(uint32_t idx, F&& f)
+		{
+			Slot* s = idx <= INDEX_MASK ? slot(idx) : nullptr;
+			if (!s) {
+				return false;
+			}
+
+			uint64_t v = s->state.fetch_add(1, std::memory_order_acquire);
+			bool ok = v & LIVE;
+			if (ok) {
+				f(*(s->Value()));
+			}
+			unpin(s, idx);
+			return ok;
+		}
+
+		// 遍历所有元素，遍历期间新加的可能遍历不到
+		template<typename F>
+		void ForEach(F&& f)
+		{
+			uint64_t chunkNum = 0;
+			{
+				_lock_guard_(m_growLock);
+				chunkNum = m_chunkNum;
+			}
+			for (uint64_t c = 0; c < chunkNum; c++)
+			{
+				Slot* chunk = m_chunks[c].load(std::memory_order_acquire);
+				for (uint32_t i = 0; i < CHUNK_SIZE; i++)
+				{
+					uint64_t v = chunk[i].state.fetch_add(1, std::memory_order_acquire);
+					if (v & LIVE) {
+						f(*(chunk[i].Value()));
+					}
+					unpin(&chunk[i], static_cast<uint32_t>((c << CHUNK_BITS) + i));
+				}
+			}
+		}
+
+		// 从cursor开始遍历最多limit个元素，cursor更新为下一次开始的位置，到了末尾从头开始
+		// 用来把大表分成多次遍历，每次最多扫一圈，返回遍历到的元素个数
+		template<typename F>
+		size_t ForEachFrom(uint32_t& cursor, size_t limit, F&& f)
+		{
+			uint64_t chunkNum = 0;
+			{
+				_lock_guard_(m_growLock);
+				chunkNum = m_chunkNum;
+			}
+			uint64_t total = chunkNum << CHUNK_BITS;
+			uint64_t idx = cursor < total ? cursor : 0;
+			size_t num = 0;
+			for (uint64_t scanned = 0; scanned < total && num < limit; scanned++)
+			{
+				Slot* s = slot(static_cast<uint32_t>(idx));
+				uint64_t v = s->state.fetch_add(1, std::memory_order_acquire);
+				if (v & LIVE)
+				{
+					f(*(s->Value()));
+					num++;
+				}
+				unpin(s, static_cast<uint32_t>(idx));
+				idx = idx + 1 < total ? idx + 1 : 0;
+			}
+			cursor = static_cast<uint32_t>(idx);
+			return num;
+		}
+
+		// 只有第一次删除返回true
+		bool Del(Key key)
+		{
+			uint64_t gen = 0;
+			uint32_t idx = 0;
+			Slot* s = decode(key, gen, idx);
+			if (!s) {
+				return false;
+			}
+
+			uint64_t v = s->state.fetch_add(1, std::memory_order_acquire);
+			bool ok = (v >> 32) == gen && (v & LIVE);
+			if (ok)
+			{
+				// 占着slot，代数不会变；并发的Del只有一个能清掉LIVE
+				ok = s->state.fetch_and(~LIVE, std::memory_order_acq_rel) & LIVE;
+				if (ok) {
+					s->state.fetch_or(RETIRED, std::memory_order_release);
+				}
+			}
+			unpin(s, idx);
+			return ok;
+		}
+
+		size_t Size()
+		{
+			return m_size.load(std::memory_order_relaxed);
+		}
+
+	private:
+		static uint64_t nextGen(uint64_t gen)
+		{
+			gen = (gen + 1) & GEN_MASK;
+			return gen ? gen : 1;
+		}
+
+		Slot* slot(uint32_t idx)
+		{
+			uint64_t c = idx >> CHUNK_BITS;
+			if (c >= MAX_CHUNKS) {
+				return nullptr;
+			}
+			Slot* chunk = m_chunks[c].load(std::memory_order_acquire);
+			return chunk ? &chunk[idx & (CHUNK_SIZE - 1)] : nullptr;
+		}
+
+		Slot* decode(Key key, uint64_t& gen, uint32_t& idx)
+		{
+			if (V_INDEX_BITS + V_GEN_BITS < 64 && (key >> (V_INDEX_BITS + V_GEN_BITS))) {
+				return nullptr;
+			}
+			idx = static_cast<uint32_t>(key & INDEX_MASK);
+			gen = (key >> V_INDEX_BITS) & GEN_MASK;
+			return gen ? slot(idx) : nullptr;
+		}
+
+		void unpin(Slot* s, uint32_t idx)
+		{
+			uint64_t v = s->state.fetch_sub(1, std::memory_order_acq_rel) - 1;
+			if (!(v & RETIRED) || (v & PIN_MASK)) {
+				return;
+			}
+			// 最后一个离开的负责回收；失败说明又有人占住了，交给他回收
+			if (!s->state.compare_exchange_strong(v, nextGen(v >> 32) << 32, std::memory_order_acq_rel)) {
+				return;
+			}
+			s->Value()->~T();
+			m_size.fetch_sub(1, std::memory_order_relaxed);
+			pushFree(idx);
+		}
+
+		// 空闲链表头：tag(32) | idx+1(32)，tag防止ABA
+		bool popFree(uint32_t& idx)
+		{
+			uint64_t head = m_freeHead.load(std::memory_order_acquire);
+			while (true)
+			{
+				uint32_t first = static_cast<uint32_t>(head);
+				if (!first) {
+					return false;
+				}
+				uint32_t next = slot(first - 1)->nextFree.load(std::memory_order_relaxed);
+				uint64_t newHead = (((head >> 32) + 1) << 32) | next;
+				if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel)) {
+					idx = first - 1;
+					return true;
+				}
+			}
+		}
+
+		void pushFree(uint32_t idx)
+		{
+			Slot* s = slot(idx);
+			uint64_t head = m_freeHead.load(std::memory_order_relaxed);
+			while (true)
+			{
+				s->nextFree.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+				uint64_t newHead = (((head >> 32) + 1) << 32) | (static_cast<uint64_t>(idx) + 1);
+				if (m_freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed)) {
+					return;
+				}
+			}
+		}
+
+		// 新分配一块，第一个slot直接给调用者，剩下的放进空闲链表
+		bool grow(uint32_t& idx)
+		{
+			_lock_guard_(m_growLock);
+			// 等锁的时候别人可能已经扩容了
+			if (popFree(idx)) {
+				return true;
+			}
+			uint64_t c = m_chunkNum;
+			// idx+1要放进空闲链表的32位里
+			if (c >= MAX_CHUNKS || ((c + 1) << CHUNK_BITS) > UINT32_MAX) {
+				return false;
+			}
+
+			Slot* chunk = new Slot[CHUNK_SIZE];
+			m_chunks[c].store(chunk, std::memory_order_release);
+			m_chunkNum = c + 1;
+
+			uint32_t base = static_cast<uint32_t>(c << CHUNK_BITS);
+			for (uint32_t i = CHUNK_SIZE - 1; i > 0; i--) {
+				pushFree(base + i);
+			}
+			idx = base;
+			return true;
+		}
+
+		std::atomic<uint64_t> m_freeHead;
+		std::atomic<Slot*> m_chunks[MAX_CHUNKS];
+		uint64_t m_chunkNum;	// 只在m_growLock里面修改
+		std::mutex m_growLock;
+		std::atomic<size_t> m_size;
+	};
+}
@@ -1,17 +1,18 @@
 #include "./utils.h"
 
+#include <atomic>
+
 namespace AsioNet 
 {
 	NetKey GenNetKey(ServerKey svr)
 	{
-		static NetKey id = AN_START_TIME % 666 + 666666;
-		static std::mutex lock;
+		// 低32位自增，回绕时跳过0
+		static std::atomic<uint32_t> counter(static_cast<uint32_t>(AN_START_TIME % 666 + 666666));
 
-		_lock_guard_(lock);
-		if (id == UINT32_MAX){
-			id = 1;
+		uint32_t id = ++counter;
+		if (id == 0) {
+			id = ++counter;
 		}
-		++id;
 		if (svr){
 			return (static_cast<uint64_t>(svr) << 32) | id;
 		}
@@ -20,12 +21,8 @@ namespace AsioNet
 
 	ServerKey GenSvrKey()
 	{
-		static ServerKey id = AN_START_TIME % 888 + 88888888;
-		static std::mutex lock;
-
-		_lock_guard_(lock);
-		++id;
-		return id;
+		static std::atomic<ServerKey> id(static_cast<ServerKey>(AN_START_TIME % 888 + 88888888));
+		return ++id;
 	}
 
 	ServerKey GetSvrKeyFromNetKey(NetKey key)
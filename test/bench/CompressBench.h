@@ -0,0 +1,138 @@
+#pragma once
+
+#include "../../src/utils/Compress.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// 消息压缩压测
+// 按protobuf的编码格式拼出几种典型的大消息(背包、地图状态)，统计压缩率和压缩/解压的MB/s
+// 用来决定TcpOption/KcpOption::compressSize设多大
+class CompressBench {
+public:
+	CompressBench(size_t loop = 2000) :m_loop(loop) {}
+
+	void Run()
+	{
+		run("inventory(200 items)", makeInventory(200));
+		run("inventory(1000 items)", makeInventory(1000));
+		run("map state(500 entities)", makeMapState(500));
+		run("random bytes(8KB)", makeRandom(8 * 1024));
+	}
+
+private:
+	void run(const std::string& name, const std::vector<char>& msg)
+	{
+		std::vector<char> zip(AsioNet::AN_MSG_MAX_SIZE), unzip(AsioNet::AN_MSG_MAX_SIZE);
+
+		size_t zipLen = 0;
+		auto t1 = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < m_loop; i++) {
+			zipLen = AsioNet::CompressMsg(msg.data(), msg.size(), zip.data(), zip.size());
+		}
+		auto t2 = std::chrono::steady_clock::now();
+		if (zipLen) {
+			for (size_t i = 0; i < m_loop; i++) {
+				AsioNet::DecompressMsg(zip.data(), zipLen, unzip.data(), unzip.size());
+			}
+		}
+		auto t3 = std::chrono::steady_clock::now();
+
+		auto mbps = [this, &msg](std::chrono::steady_clock::duration d) {
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+			return us ? static_cast<double>(msg.size()) * m_loop / us : 0.0;	// byte/us == MB/s
+		};
+		std::cout << name << " size:" << msg.size()
+			<< " zip:" << (zipLen ? zipLen : msg.size())
+			<< " ratio:" << (zipLen ? static_cast<double>(zipLen) / msg.size() : 1.0)
+			<< " compress(MB/s):" << mbps(t2 - t1)
+			<< " decompress(MB/s):" << (zipLen ? mbps(t3 - t2) : 0.0) << std::endl;
+	}
+
+	// ******************** protobuf编码 ********************
+	static void varint(std::string& out, uint64_t v)
+	{
+		while (v >= 0x80) {
+			out.push_back(static_cast<char>(v | 0x80));
+			v >>= 7;
+		}
+		out.push_back(static_cast<char>(v));
+	}
+	static void tagVarint(std::string& out, uint32_t field, uint64_t v)
+	{
+		varint(out, field << 3);
+		varint(out, v);
+	}
+	static void tagBytes(std::string& out, uint32_t field, const std::string& bytes)
+	{
+		varint(out, (field << 3) | 2);
+		varint(out, bytes.size());
+		out += bytes;
+	}
+	static uint64_t zigzag(int64_t v)
+	{
+		return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+	}
+	static std::vector<char> toMsg(uint16_t msgid, const std::string& pb)
+	{
+		std::vector<char> msg(sizeof(AsioNet::AN_MsgHead) + pb.size());
+		AsioNet::AN_MsgHead h{ msgid,0 };
+		memcpy(msg.data(), &h, sizeof(h));
+		memcpy(msg.data() + sizeof(h), pb.data(), pb.size());
+		return msg;
+	}
+
+	// message Item{uint32 id=1;uint32 count=2;string name=3;uint64 expire=4;}
+	// message Inventory{repeated Item items=1;}
+	static std::vector<char> makeInventory(size_t num)
+	{
+		static const char* names[] = { "potion_small","potion_large","iron_sword","leather_armor","gold_coin","dragon_scale" };
+		std::mt19937 rnd(1);
+		std::string pb;
+		for (size_t i = 0; i < num; i++)
+		{
+			std::string item;
+			tagVarint(item, 1, 10000 + rnd() % 500);
+			tagVarint(item, 2, 1 + rnd() % 99);
+			tagBytes(item, 3, names[rnd() % 6]);
+			tagVarint(item, 4, 1700000000ull + rnd() % 86400);
+			tagBytes(pb, 1, item);
+		}
+		return toMsg(101, pb);
+	}
+
+	// message Entity{uint32 id=1;sint32 x=2;sint32 y=3;uint32 hp=4;uint32 state=5;}
+	// message MapState{repeated Entity entities=1;}
+	static std::vector<char> makeMapState(size_t num)
+	{
+		std::mt19937 rnd(2);
+		std::string pb;
+		for (size_t i = 0; i < num; i++)
+		{
+			std::string e;
+			tagVarint(e, 1, 500000 + i);
+			tagVarint(e, 2, zigzag(static_cast<int32_t>(rnd() % 2048) - 1024));
+			tagVarint(e, 3, zigzag(static_cast<int32_t>(rnd() % 2048) - 1024));
+			tagVarint(e, 4, rnd() % 4 ? 100 : rnd() % 100);
+			tagVarint(e, 5, rnd() % 3);
+			tagBytes(pb, 1, e);
+		}
+		return toMsg(102, pb);
+	}
+
+	static std::vector<char> makeRandom(size_t size)
+	{
+		std::mt19937 rnd(3);
+		std::string pb;
+		for (size_t i = 0; i < size; i++) {
+			pb.push_back(static_cast<char>(rnd()));
+		}
+		return toMsg(103, pb);
+	}
+
+	size_t m_loop;
+};
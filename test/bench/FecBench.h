@@ -0,0 +1,211 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// kcp前向纠错压测
+// 1. Reed-Solomon编码、恢复的GB/s，每种kernel(scalar/ssse3/avx2)各跑一次
+// 2. 两个ikcp在进程里对发，虚拟时钟，单向延迟delayMs，按丢包率随机丢包
+//    每intervalMs发一条消息，统计消息从发出到收到的平均和p99延迟，对比开关fec
+//    不走socket，测的是kcp+fec的恢复效果，和机器快慢无关
+class FecBench {
+public:
+	FecBench(size_t dataShards = 10, size_t parityShards = 3) :m_data(dataShards), m_parity(parityShards) {}
+
+	void Run()
+	{
+		for (auto k : { AsioNet::GfKernel::GK_SCALAR, AsioNet::GfKernel::GK_SSSE3, AsioNet::GfKernel::GK_AVX2 }) {
+			runCodec(k);
+		}
+		// 恢复成默认的
+		AsioNet::GfSetKernel(AsioNet::GfKernel::GK_AVX2) || AsioNet::GfSetKernel(AsioNet::GfKernel::GK_SSSE3);
+
+		for (double loss : { 0.01, 0.05, 0.1, 0.2 }) {
+			runLink(loss, false);
+			runLink(loss, true);
+		}
+	}
+
+private:
+	// ******************** codec ********************
+	void runCodec(AsioNet::GfKernel k)
+	{
+		static const char* names[] = { "scalar", "ssse3 ", "avx2  " };
+		if (!AsioNet::GfSetKernel(k))
+		{
+			std::cout << names[static_cast<int>(k)] << " not supported" << std::endl;
+			return;
+		}
+
+		const size_t size = 1400;
+		const size_t loop = 20000;
+		AsioNet::ReedSolomon rs(m_data, m_parity);
+		std::vector<std::vector<uint8_t>> shards(m_data + m_parity, std::vector<uint8_t>(size));
+		std::mt19937 rnd(1);
+		for (auto& s : shards) {
+			for (auto& b : s) {
+				b = static_cast<uint8_t>(rnd());
+			}
+		}
+		std::vector<uint8_t*> ptrs;
+		for (auto& s : shards) {
+			ptrs.push_back(s.data());
+		}
+
+		auto t1 = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < loop; i++) {
+			rs.Encode(ptrs.data(), size);
+		}
+		auto t2 = std::chrono::steady_clock::now();
+
+		// 丢掉前parity个数据分片再恢复
+		std::unique_ptr<bool[]> present(new bool[m_data + m_parity]);
+		for (size_t i = 0; i < m_data + m_parity; i++) {
+			present[i] = i >= m_parity;
+		}
+		for (size_t i = 0; i < loop; i++) {
+			rs.Reconstruct(ptrs.data(), present.get(), size);
+		}
+		auto t3 = std::chrono::steady_clock::now();
+
+		auto gbps = [&](std::chrono::steady_clock::duration d) {
+			double sec = std::chrono::duration<double>(d).count();
+			return sec > 0 ? static_cast<double>(m_data * size * loop) / sec / 1e9 : 0.0;
+		};
+		std::cout << names[static_cast<int>(k)]
+			<< " (" << m_data << "," << m_parity << ") shard:" << size
+			<< " encode(GB/s):" << gbps(t2 - t1)
+			<< " reconstruct(GB/s):" << gbps(t3 - t2) << std::endl;
+	}
+
+	// ******************** 模拟丢包链路 ********************
+	struct Sim;
+	struct Side {
+		Sim* sim = nullptr;
+		ikcpcb* kcp = nullptr;
+		Side* peer = nullptr;
+		std::unique_ptr<AsioNet::KcpFecEncoder> enc;
+		std::unique_ptr<AsioNet::KcpFecDecoder> dec;
+		std::multimap<uint32_t, std::string> inflight;	// 到达时间 -> 发往peer的包
+	};
+
+	struct Sim {
+		uint32_t now = 0;
+		uint32_t delay = 30;
+		double loss = 0;
+		std::mt19937 rnd{ 7 };
+
+		void send(Side& from, const char* data, size_t len)
+		{
+			if (std::uniform_real_distribution<double>(0, 1)(rnd) < loss) {
+				return;
+			}
+			from.inflight.emplace(now + delay, std::string(data, len));
+		}
+	};
+
+	static int output(const char* buf, int len, ikcpcb*, void* user)
+	{
+		Side& s = *static_cast<Side*>(user);
+		if (s.enc) {
+			s.enc->Encode(buf, len, [&s](const char* data, size_t n) { s.sim->send(s, data, n); });
+		}
+		else {
+			s.sim->send(s, buf, len);
+		}
+		return 0;
+	}
+
+	static void deliver(Side& from)
+	{
+		Side& to = *from.peer;
+		auto end = from.inflight.upper_bound(from.sim->now);
+		for (auto itr = from.inflight.begin(); itr != end; ++itr)
+		{
+			const std::string& pkt = itr->second;
+			if (to.dec) {
+				to.dec->Decode(pkt.data(), pkt.size(), [&to](const char* data, size_t n) {
+					ikcp_input(to.kcp, data, static_cast<long>(n));
+					});
+			}
+			else {
+				ikcp_input(to.kcp, pkt.data(), static_cast<long>(pkt.size()));
+			}
+		}
+		from.inflight.erase(from.inflight.begin(), end);
+	}
+
+	void runLink(double loss, bool fec, uint32_t seconds = 30, uint32_t intervalMs = 10, size_t msgSize = 200)
+	{
+		Sim sim;
+		sim.loss = loss;
+		Side a, b;
+		for (Side* s : { &a, &b })
+		{
+			s->sim = &sim;
+			s->peer = s == &a ? &b : &a;
+			s->kcp = ikcp_create(1, s);
+			s->kcp->output = &FecBench::output;
+			// 和KcpConn的参数一样
+			ikcp_nodelay(s->kcp, 1, 10, 2, 1);
+			if (fec)
+			{
+				s->enc.reset(new AsioNet::KcpFecEncoder(1, m_data, m_parity, AsioNet::IKCP_MTU));
+				s->dec.reset(new AsioNet::KcpFecDecoder(m_data, m_parity));
+				ikcp_setmtu(s->kcp, AsioNet::IKCP_MTU - AsioNet::AN_FEC_OVERHEAD);
+			}
+			else {
+				ikcp_setmtu(s->kcp, AsioNet::IKCP_MTU);
+			}
+		}
+
+		std::vector<char> msg(msgSize, 'a');
+		char buf[AsioNet::AN_MSG_MAX_SIZE];
+		std::vector<uint32_t> lat;
+		for (sim.now = 0; sim.now < seconds * 1000; sim.now++)
+		{
+			if (sim.now % intervalMs == 0)
+			{
+				memcpy(msg.data(), &sim.now, sizeof(sim.now));
+				ikcp_send(a.kcp, msg.data(), static_cast<int>(msg.size()));
+			}
+			deliver(a);
+			deliver(b);
+			ikcp_update(a.kcp, sim.now);
+			ikcp_update(b.kcp, sim.now);
+			int n = 0;
+			while ((n = ikcp_recv(b.kcp, buf, sizeof(buf))) > 0)
+			{
+				uint32_t sent = 0;
+				memcpy(&sent, buf, sizeof(sent));
+				lat.push_back(sim.now - sent);
+			}
+		}
+		ikcp_release(a.kcp);
+		ikcp_release(b.kcp);
+
+		std::sort(lat.begin(), lat.end());
+		double avg = 0;
+		for (auto l : lat) {
+			avg += l;
+		}
+		avg = lat.empty() ? 0 : avg / lat.size();
+		std::cout << "loss:" << loss << (fec ? " fec   " : " no fec")
+			<< " delay(ms):" << sim.delay
+			<< " msg:" << lat.size()
+			<< " avg(ms):" << avg
+			<< " p99(ms):" << (lat.empty() ? 0 : lat[lat.size() * 99 / 100])
+			<< " max(ms):" << (lat.empty() ? 0 : lat.back()) << std::endl;
+	}
+
+	size_t m_data;
+	size_t m_parity;
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include <ctime>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// KcpAllocator压测：kcp echo，小消息，消息率高
+// connNum个连接，每个连接保持inflight条消息在路上，server原样发回，client收到一条再发一条
+// 分配器只能在创建第一个kcp之前换，默认分配器和池子要分两次进程跑：Run(false)、Run(true)
+// 对比消息吞吐和进程CPU时间，池子那次打印命中率和常驻内存
+class KcpAllocBench {
+public:
+	KcpAllocBench(size_t connNum = 64, size_t inflight = 16, size_t msgSize = 64, size_t seconds = 10, size_t thNum = 4) :
+		m_connNum(connNum), m_inflight(inflight), m_msgSize(msgSize), m_seconds(seconds), m_thNum(thNum)
+	{
+	}
+
+	void Run(bool pooled, uint16_t port = 9991)
+	{
+		if (pooled) {
+			AsioNet::KcpAllocator::Install();
+		}
+		{
+			// poller要比NetMgr活得久
+			EchoPoller svrPoller(false), cliPoller(true);
+			AsioNet::KcpNetMgr svrNet(m_thNum), cliNet(m_thNum);
+			svrPoller.net = &svrNet;
+			cliPoller.net = &cliNet;
+
+			svrNet.Serve(&svrPoller, "127.0.0.1", port, 1);
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			for (size_t i = 0; i < m_connNum; i++) {
+				cliNet.Connect(&cliPoller, "127.0.0.1", port, 1);
+			}
+			while (cliPoller.Keys() < m_connNum) {
+				std::this_thread::yield();
+			}
+
+			std::vector<char> msg(m_msgSize, 'a');
+			auto keys = cliPoller.keys;
+			std::clock_t c1 = std::clock();
+			auto t1 = std::chrono::steady_clock::now();
+			for (auto key : keys) {
+				for (size_t i = 0; i < m_inflight; i++) {
+					cliNet.Send(key, msg.data(), msg.size());
+				}
+			}
+			std::this_thread::sleep_for(std::chrono::seconds(m_seconds));
+			size_t total = cliPoller.recv;
+			auto t2 = std::chrono::steady_clock::now();
+			std::clock_t c2 = std::clock();
+			cliPoller.stop = true;
+
+			auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+			auto cpuMs = (c2 - c1) * 1000 / CLOCKS_PER_SEC;
+			std::cout << (pooled ? "pooled " : "default")
+				<< " conn:" << m_connNum
+				<< " inflight:" << m_inflight
+				<< " echo:" << total
+				<< " echo/s:" << (ms ? total * 1000 / ms : 0)
+				<< " cpu(ms):" << cpuMs
+				<< " cpu(us)/echo:" << (total ? static_cast<double>(cpuMs) * 1000 / total : 0) << std::endl;
+
+			for (auto key : keys) {
+				cliNet.Disconnect(key);
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+
+		if (pooled)
+		{
+			auto s = AsioNet::KcpAllocator::Stats();
+			uint64_t all = s.hits + s.misses;
+			std::cout << "hits:" << s.hits
+				<< " misses:" << s.misses
+				<< " hit rate:" << (all ? static_cast<double>(s.hits) / all : 0)
+				<< " large:" << s.large
+				<< " resident(KB):" << s.resident / 1024 << std::endl;
+		}
+	}
+
+private:
+	// server原样发回，client收到就再发一条，不走EventDriver
+	struct EchoPoller : public AsioNet::IEventPoller {
+		EchoPoller(bool c) :net(nullptr), client(c) {}
+
+		void PushAccept(AsioNet::NetKey, const std::string&, uint16_t) override {}
+		void PushConnect(AsioNet::NetKey k, const std::string&, uint16_t) override
+		{
+			_lock_guard_(lock);
+			keys.push_back(k);
+		}
+		void PushDisconnect(AsioNet::NetKey, const std::string&, uint16_t) override {}
+		void PushRecv(AsioNet::NetKey k, const char* data, size_t trans) override
+		{
+			if (client)
+			{
+				++recv;
+				if (stop) {
+					return;
+				}
+			}
+			net->Send(k, data, trans);
+		}
+		void PushError(AsioNet::NetKey, AsioNet::EventErrCode) override {}
+		size_t Keys()
+		{
+			_lock_guard_(lock);
+			return keys.size();
+		}
+
+		AsioNet::KcpNetMgr* net;
+		bool client;
+		std::mutex lock;
+		std::vector<AsioNet::NetKey> keys;
+		std::atomic<size_t> recv = 0;
+		std::atomic<bool> stop = false;
+	};
+
+	size_t m_connNum;
+	size_t m_inflight;
+	size_t m_msgSize;
+	size_t m_seconds;
+	size_t m_thNum;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include <ctime>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// KcpOption::udpOffload压测
+// connNum个kcp连接同时往server发msgSize的消息，每个连接发msgNum条
+// 分别用普通发送和GSO/GRO跑一次，对比消息吞吐和进程CPU时间(client和server在同一个进程里)
+// kcp默认的发送窗口只有32个包，窗口把吞吐压住的时候看CPU时间更有意义
+// 回环地址上没有网卡的分段卸载，内核软件切分，收益比真实网卡小
+class KcpOffloadBench {
+public:
+	KcpOffloadBench(size_t connNum = 64, size_t msgNum = 2000, size_t msgSize = 4 * 1024, size_t thNum = 2) :
+		m_connNum(connNum), m_msgNum(msgNum), m_msgSize(msgSize), m_thNum(thNum)
+	{
+	}
+
+	void Run()
+	{
+#ifndef ASIONET_UDP_GSO
+		std::cout << "UDP GSO/GRO is not supported on this platform" << std::endl;
+#else
+		run(false, 9995);
+		run(true, 9994);
+#endif
+	}
+
+private:
+	void run(bool offload, uint16_t port)
+	{
+		CountPoller svrPoller, cliPoller;
+		AsioNet::KcpNetMgr svrNet(m_thNum), cliNet(m_thNum);
+
+		AsioNet::KcpOption opt;
+		opt.udpOffload = offload;
+		svrNet.Serve(&svrPoller, "127.0.0.1", port, 1, opt);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		for (size_t i = 0; i < m_connNum; i++) {
+			cliNet.Connect(&cliPoller, "127.0.0.1", port, 1, opt);
+		}
+		while (cliPoller.Keys() < m_connNum) {
+			std::this_thread::yield();
+		}
+
+		std::vector<char> msg(m_msgSize, 'a');
+		AsioNet::AN_MsgHead h{ 1,0 };
+		memcpy(msg.data(), &h, sizeof(h));
+
+		auto keys = cliPoller.keys;
+		size_t total = m_connNum * m_msgNum;
+		std::clock_t c1 = std::clock();
+		auto t1 = std::chrono::steady_clock::now();
+		for (size_t n = 0; n < m_msgNum; n++) {
+			for (auto key : keys) {
+				// kcp的发送队列没有上限，堆太多就变成测内存分配了
+				while (cliNet.SendQueueSize(key) > 256 * 1024) {
+					std::this_thread::yield();
+				}
+				cliNet.Send(key, msg.data(), msg.size());
+			}
+		}
+		while (svrPoller.recv < total) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		auto t2 = std::chrono::steady_clock::now();
+		std::clock_t c2 = std::clock();
+
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+		auto cpuMs = (c2 - c1) * 1000 / CLOCKS_PER_SEC;
+		std::cout << (offload ? "gso/gro " : "plain   ")
+			<< " conn:" << m_connNum
+			<< " msg:" << total
+			<< " cost(ms):" << ms
+			<< " msg/s:" << (ms ? total * 1000 / ms : 0)
+			<< " cpu(ms):" << cpuMs
+			<< " cpu(us)/msg:" << static_cast<double>(cpuMs) * 1000 / total << std::endl;
+
+		for (auto key : keys) {
+			cliNet.Disconnect(key);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	// 只计数，不走EventDriver
+	struct CountPoller : public AsioNet::IEventPoller {
+		void PushAccept(AsioNet::NetKey, const std::string&, uint16_t) override {}
+		void PushConnect(AsioNet::NetKey k, const std::string&, uint16_t) override
+		{
+			_lock_guard_(lock);
+			keys.push_back(k);
+		}
+		void PushDisconnect(AsioNet::NetKey, const std::string&, uint16_t) override {}
+		void PushRecv(AsioNet::NetKey, const char*, size_t) override { ++recv; }
+		void PushError(AsioNet::NetKey, AsioNet::EventErrCode) override {}
+		size_t Keys()
+		{
+			_lock_guard_(lock);
+			return keys.size();
+		}
+
+		std::mutex lock;
+		std::vector<AsioNet::NetKey> keys;
+		std::atomic<size_t> recv = 0;
+	};
+
+	size_t m_connNum;
+	size_t m_msgNum;
+	size_t m_msgSize;
+	size_t m_thNum;
+};
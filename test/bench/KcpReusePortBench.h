@@ -0,0 +1,108 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// KcpOption::reusePort压测
+// connNum个kcp连接同时往server发小消息，每个连接发msgNum条，统计server每秒收到的消息数
+// 分别用一个socket和每个io线程一个SO_REUSEPORT的socket跑一次，thNum越大差距越明显
+// client和server在同一个进程里，client用的是单独的KcpNetMgr，client的线程数固定
+class KcpReusePortBench {
+public:
+	KcpReusePortBench(size_t connNum = 256, size_t msgNum = 2000, size_t msgSize = 128, size_t thNum = 4) :
+		m_connNum(connNum), m_msgNum(msgNum), m_msgSize(msgSize), m_thNum(thNum)
+	{
+	}
+
+	void Run()
+	{
+#ifndef __linux__
+		std::cout << "SO_REUSEPORT sharding is only supported on linux" << std::endl;
+#else
+		run(false, 9993);
+		run(true, 9992);
+#endif
+	}
+
+private:
+	void run(bool reusePort, uint16_t port)
+	{
+		CountPoller svrPoller, cliPoller;
+		AsioNet::KcpNetMgr svrNet(m_thNum), cliNet(4);
+
+		AsioNet::KcpOption opt;
+		opt.reusePort = reusePort;
+		svrNet.Serve(&svrPoller, "127.0.0.1", port, 1, opt);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		for (size_t i = 0; i < m_connNum; i++) {
+			cliNet.Connect(&cliPoller, "127.0.0.1", port, 1);
+		}
+		while (cliPoller.Keys() < m_connNum) {
+			std::this_thread::yield();
+		}
+
+		std::vector<char> msg(m_msgSize, 'a');
+		AsioNet::AN_MsgHead h{ 1,0 };
+		memcpy(msg.data(), &h, sizeof(h));
+
+		auto keys = cliPoller.keys;
+		size_t total = m_connNum * m_msgNum;
+		auto t1 = std::chrono::steady_clock::now();
+		for (size_t n = 0; n < m_msgNum; n++) {
+			for (auto key : keys) {
+				// kcp的发送队列没有上限，堆太多就变成测内存分配了
+				while (cliNet.SendQueueSize(key) > 256 * 1024) {
+					std::this_thread::yield();
+				}
+				cliNet.Send(key, msg.data(), msg.size());
+			}
+		}
+		while (svrPoller.recv < total) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		auto t2 = std::chrono::steady_clock::now();
+
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+		std::cout << (reusePort ? "reuseport" : "single   ")
+			<< " thread:" << m_thNum
+			<< " conn:" << m_connNum
+			<< " msg:" << total
+			<< " cost(ms):" << ms
+			<< " msg/s:" << (ms ? total * 1000 / ms : 0) << std::endl;
+
+		for (auto key : keys) {
+			cliNet.Disconnect(key);
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	// 只计数，不走EventDriver
+	struct CountPoller : public AsioNet::IEventPoller {
+		void PushAccept(AsioNet::NetKey, const std::string&, uint16_t) override {}
+		void PushConnect(AsioNet::NetKey k, const std::string&, uint16_t) override
+		{
+			_lock_guard_(lock);
+			keys.push_back(k);
+		}
+		void PushDisconnect(AsioNet::NetKey, const std::string&, uint16_t) override {}
+		void PushRecv(AsioNet::NetKey, const char*, size_t) override { ++recv; }
+		void PushError(AsioNet::NetKey, AsioNet::EventErrCode) override {}
+		size_t Keys()
+		{
+			_lock_guard_(lock);
+			return keys.size();
+		}
+
+		std::mutex lock;
+		std::vector<AsioNet::NetKey> keys;
+		std::atomic<size_t> recv = 0;
+	};
+
+	size_t m_connNum;
+	size_t m_msgNum;
+	size_t m_msgSize;
+	size_t m_thNum;
+};
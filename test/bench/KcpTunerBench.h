@@ -0,0 +1,174 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+// kcp参数/自适应调参压测，和FecBench一样是进程里两个ikcp对发，虚拟时钟，不走socket
+// 1. 大块传输：单向延迟delayMs，按丢包率随机丢包，a往b发totalBytes，统计用时和吞吐
+// 2. 空闲连接：每idleGap毫秒发一条小消息，统计两边ikcp_update的次数(按ikcp_check的时间调用，和调度器一样)
+// 对比默认profile、Bulk profile、默认profile+自适应
+class KcpTunerBench {
+public:
+	KcpTunerBench(uint32_t delayMs = 50, size_t totalBytes = 16 * 1024 * 1024) :m_delay(delayMs), m_total(totalBytes) {}
+
+	void Run()
+	{
+		AsioNet::KcpAdaptiveOption off;
+		AsioNet::KcpAdaptiveOption on;
+		on.enable = true;
+		for (double loss : { 0.0, 0.01, 0.05 })
+		{
+			runBulk("default ", AsioNet::KcpProfile(), off, loss);
+			runBulk("bulk    ", AsioNet::KcpProfile::Bulk(), off, loss);
+			runBulk("adaptive", AsioNet::KcpProfile(), on, loss);
+		}
+		runIdle("default ", AsioNet::KcpProfile(), off);
+		runIdle("adaptive", AsioNet::KcpProfile(), on);
+	}
+
+private:
+	struct Sim;
+	struct Side {
+		Sim* sim = nullptr;
+		ikcpcb* kcp = nullptr;
+		Side* peer = nullptr;
+		AsioNet::KcpTuner tuner;
+		uint32_t next = 0;			// 下次update的时间
+		size_t updates = 0;
+		std::multimap<uint32_t, std::string> inflight;	// 到达时间 -> 发往peer的包
+	};
+
+	struct Sim {
+		uint32_t now = 0;
+		uint32_t delay = 50;
+		double loss = 0;
+		std::mt19937 rnd{ 7 };
+	};
+
+	static int output(const char* buf, int len, ikcpcb*, void* user)
+	{
+		Side& s = *static_cast<Side*>(user);
+		if (std::uniform_real_distribution<double>(0, 1)(s.sim->rnd) < s.sim->loss) {
+			return 0;
+		}
+		s.inflight.emplace(s.sim->now + s.sim->delay, std::string(buf, len));
+		return 0;
+	}
+
+	static void deliver(Side& from)
+	{
+		Side& to = *from.peer;
+		auto end = from.inflight.upper_bound(from.sim->now);
+		for (auto itr = from.inflight.begin(); itr != end; ++itr)
+		{
+			if (ikcp_input(to.kcp, itr->second.data(), static_cast<long>(itr->second.size())) == 0) {
+				to.tuner.Wake(to.kcp);
+			}
+		}
+		from.inflight.erase(from.inflight.begin(), end);
+	}
+
+	static void update(Side& s)
+	{
+		if (static_cast<int32_t>(s.sim->now - s.next) < 0) {
+			return;
+		}
+		ikcp_update(s.kcp, s.sim->now);
+		s.tuner.Update(s.kcp, s.sim->now);
+		s.next = ikcp_check(s.kcp, s.sim->now);
+		s.updates++;
+	}
+
+	void init(Sim& sim, Side& a, Side& b, const AsioNet::KcpProfile& p, const AsioNet::KcpAdaptiveOption& opt)
+	{
+		for (Side* s : { &a, &b })
+		{
+			s->sim = &sim;
+			s->peer = s == &a ? &b : &a;
+			s->kcp = ikcp_create(1, s);
+			s->kcp->output = &KcpTunerBench::output;
+			s->tuner.Reset(s->kcp, p, opt, 0);
+		}
+	}
+
+	void runBulk(const char* name, const AsioNet::KcpProfile& p, const AsioNet::KcpAdaptiveOption& opt, double loss)
+	{
+		Sim sim;
+		sim.delay = m_delay;
+		sim.loss = loss;
+		Side a, b;
+		init(sim, a, b, p, opt);
+
+		const size_t msgSize = 1024;
+		std::vector<char> msg(msgSize, 'a');
+		char buf[AsioNet::AN_MSG_MAX_SIZE];
+		size_t sent = 0, recv = 0;
+		const uint32_t limit = 600 * 1000;
+		for (sim.now = 0; recv < m_total && sim.now < limit; sim.now++)
+		{
+			// 发送队列保持有数据，看窗口能跑多快
+			while (sent < m_total && static_cast<uint32_t>(ikcp_waitsnd(a.kcp)) < a.kcp->snd_wnd * 2)
+			{
+				ikcp_send(a.kcp, msg.data(), static_cast<int>(msg.size()));
+				a.tuner.Wake(a.kcp);
+				sent += msg.size();
+			}
+			deliver(a);
+			deliver(b);
+			update(a);
+			update(b);
+			int n = 0;
+			while ((n = ikcp_recv(b.kcp, buf, sizeof(buf))) > 0) {
+				recv += n;
+			}
+		}
+		double sec = sim.now / 1000.0;
+		std::cout << name << " loss:" << loss << " delay(ms):" << sim.delay
+			<< " bytes:" << recv << " time(s):" << sec
+			<< " MB/s:" << (sec > 0 ? recv / sec / 1024 / 1024 : 0)
+			<< " snd_wnd:" << a.kcp->snd_wnd << " rcv_wnd:" << b.kcp->rcv_wnd << std::endl;
+		ikcp_release(a.kcp);
+		ikcp_release(b.kcp);
+	}
+
+	void runIdle(const char* name, const AsioNet::KcpProfile& p, const AsioNet::KcpAdaptiveOption& opt,
+		uint32_t seconds = 60, uint32_t idleGap = 5000)
+	{
+		Sim sim;
+		sim.delay = m_delay;
+		Side a, b;
+		init(sim, a, b, p, opt);
+
+		char msg[32] = { 0 };
+		char buf[AsioNet::AN_MSG_MAX_SIZE];
+		size_t got = 0;
+		for (sim.now = 0; sim.now < seconds * 1000; sim.now++)
+		{
+			if (sim.now % idleGap == 0)
+			{
+				ikcp_send(a.kcp, msg, sizeof(msg));
+				a.tuner.Wake(a.kcp);
+			}
+			deliver(a);
+			deliver(b);
+			update(a);
+			update(b);
+			while (ikcp_recv(b.kcp, buf, sizeof(buf)) > 0) {
+				got++;
+			}
+		}
+		std::cout << name << " idle " << seconds << "s, msg every " << idleGap << "ms"
+			<< " msg:" << got << " updates:" << a.updates + b.updates << std::endl;
+		ikcp_release(a.kcp);
+		ikcp_release(b.kcp);
+	}
+
+	uint32_t m_delay;
+	size_t m_total;
+};
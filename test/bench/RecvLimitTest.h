@@ -0,0 +1,112 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include <lz4.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// 接收限速和压缩合包：对端把合包压缩之后发过来，不能绕过按msgid的限速
+// 1. 按msgid限速(burst=3)，不压缩的合包(2条)通过，压缩的合包(2条)必须被丢掉
+// 2. 同一个压缩的合包交给EventDriver，一条子消息都不能分发，报RECV_ERR
+// 不走socket，直接调用RecvLimiter和EventDriver
+class RecvLimitTest {
+public:
+	static constexpr uint16_t MSG_ID = 100;
+
+	void Run()
+	{
+		std::string plain = makeBundle(2);
+		std::string zipped = compressBundle(plain);
+
+		AsioNet::RecvLimitOption opt;
+		opt.msg[MSG_ID].rate = 1;
+		opt.msg[MSG_ID].burst = 3;
+		AsioNet::RecvLimiter limiter;
+		limiter.SetOption(opt);
+
+		uint64_t waitUs = 0;
+		auto a1 = limiter.Check(plain.data(), plain.size(), waitUs);
+		auto a2 = limiter.Check(zipped.data(), zipped.size(), waitUs);
+		// 压缩的合包没有扣令牌，剩下的1个还能放一条消息过去
+		std::string single = makeMsg(MSG_ID, "x");
+		auto a3 = limiter.Check(single.data(), single.size(), waitUs);
+		report("limiter plain bundle", a1 == AsioNet::RecvLimiter::Action::RL_PASS);
+		report("limiter compressed bundle", a2 == AsioNet::RecvLimiter::Action::RL_DROP);
+		report("limiter tokens untouched", a3 == AsioNet::RecvLimiter::Action::RL_PASS);
+
+		AsioNet::EventDriver ed;
+		ed.AddRawRouter<CountHandler>(this, MSG_ID);
+		ed.RegisterErrHandler<ErrHandler>(this);
+		ed.PushRecv(1, zipped.data(), zipped.size());
+		while (ed.RunOne()) {}
+		report("driver compressed bundle", m_delivered == 0 && m_recvErr == 1);
+
+		ed.PushRecv(1, plain.data(), plain.size());
+		while (ed.RunOne()) {}
+		report("driver plain bundle", m_delivered == 2 && m_recvErr == 1);
+	}
+
+private:
+	struct CountHandler {
+		void operator()(void* user, AsioNet::NetKey, const char*, size_t)
+		{
+			static_cast<RecvLimitTest*>(user)->m_delivered++;
+		}
+	};
+
+	struct ErrHandler {
+		void operator()(void* user, AsioNet::NetKey, AsioNet::EventErrCode ec)
+		{
+			if (ec == AsioNet::EventErrCode::RECV_ERR) {
+				static_cast<RecvLimitTest*>(user)->m_recvErr++;
+			}
+		}
+	};
+
+	static std::string makeMsg(uint16_t msgid, const std::string& data, uint16_t flag = 0)
+	{
+		AsioNet::AN_MsgHead head{ msgid, flag };
+		std::string msg(reinterpret_cast<const char*>(&head), sizeof(head));
+		return msg + data;
+	}
+
+	// 合包：len(网络序)|msgid|flag|data ...
+	static std::string makeBundle(size_t num)
+	{
+		std::string body;
+		for (size_t i = 0; i < num; i++)
+		{
+			std::string sub = makeMsg(MSG_ID, "hello hello hello hello");
+			auto netLen = asio::detail::socket_ops::host_to_network_short(static_cast<uint16_t>(sub.size()));
+			body.append(reinterpret_cast<const char*>(&netLen), sizeof(netLen));
+			body += sub;
+		}
+		return makeMsg(AsioNet::AN_MSG_BUNDLE_ID, body, AsioNet::AN_MSG_FLAG_BUNDLE);
+	}
+
+	// CompressMsg不压缩合包，按对端的做法直接用lz4压
+	static std::string compressBundle(const std::string& bundle)
+	{
+		const size_t headLen = sizeof(AsioNet::AN_MsgHead);
+		std::string out(headLen + LZ4_compressBound(static_cast<int>(bundle.size())), '\0');
+		int n = LZ4_compress_default(bundle.data() + headLen, &out[headLen],
+			static_cast<int>(bundle.size() - headLen), static_cast<int>(out.size() - headLen));
+		AsioNet::AN_MsgHead head;
+		memcpy(&head, bundle.data(), headLen);
+		head.flag |= AsioNet::AN_MSG_FLAG_COMPRESSED;
+		memcpy(&out[0], &head, headLen);
+		out.resize(headLen + (n > 0 ? n : 0));
+		return out;
+	}
+
+	static void report(const std::string& name, bool ok)
+	{
+		std::cout << name << (ok ? " ok" : " FAILED") << std::endl;
+	}
+
+	size_t m_delivered = 0;
+	size_t m_recvErr = 0;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// 多线程往同一个连接发送的压测
+// writerNum个业务线程同时调用Send往同一个连接写，每个线程写msgNum条msgSize字节的消息
+// 分别用1、4、16个写线程跑，对比发送队列的争用情况
+// push:所有Send调用返回的耗时，all:对端全部收完的耗时
+class SendQueueBench {
+public:
+	SendQueueBench(size_t msgNum, size_t msgSize = 64, size_t thNum = 2) :
+		m_svrNet(thNum), m_cliNet(thNum), m_msgNum(msgNum), m_msgSize(msgSize)
+	{
+		m_svrNet.Serve(&m_svrPoller, "127.0.0.1", 9998);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	void Run(size_t writerNum)
+	{
+		m_svrPoller.Reset();
+		m_cliPoller.Reset();
+
+		m_cliNet.Connect(&m_cliPoller, "127.0.0.1", 9998, 3);
+		while (!m_cliPoller.key || !m_svrPoller.key) {
+			std::this_thread::yield();
+		}
+		AsioNet::NetKey key = m_cliPoller.key;
+
+		std::vector<char> msg(m_msgSize, 'a');
+		AsioNet::AN_MsgHead h{ 1,0 };
+		memcpy(msg.data(), &h, sizeof(h));
+
+		auto t1 = std::chrono::steady_clock::now();
+		std::vector<std::thread> writers;
+		for (size_t i = 0; i < writerNum; i++) {
+			writers.emplace_back([&]() {
+				for (size_t n = 0; n < m_msgNum; n++) {
+					m_cliNet.Send(key, msg.data(), msg.size());
+				}
+				});
+		}
+		for (auto& t : writers) {
+			t.join();
+		}
+		auto t2 = std::chrono::steady_clock::now();
+
+		size_t total = writerNum * m_msgNum;
+		while (m_svrPoller.recv < total) {
+			std::this_thread::yield();
+		}
+		auto t3 = std::chrono::steady_clock::now();
+
+		auto push = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+		auto all = std::chrono::duration_cast<std::chrono::milliseconds>(t3 - t1).count();
+		std::cout << "writer:" << writerNum << " msg:" << total
+			<< " push(ms):" << push
+			<< " all(ms):" << all
+			<< " msg/s:" << (all ? total * 1000 / all : 0) << std::endl;
+
+		m_cliNet.Disconnect(key);
+		m_svrNet.Disconnect(m_svrPoller.key);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+private:
+	// 只计数，不走EventDriver，避免单线程分发成为瓶颈
+	struct CountPoller : public AsioNet::IEventPoller {
+		void PushAccept(AsioNet::NetKey k, const std::string&, uint16_t) override { key = k; }
+		void PushConnect(AsioNet::NetKey k, const std::string&, uint16_t) override { key = k; }
+		void PushDisconnect(AsioNet::NetKey, const std::string&, uint16_t) override {}
+		void PushRecv(AsioNet::NetKey, const char*, size_t) override { ++recv; }
+		void PushError(AsioNet::NetKey, AsioNet::EventErrCode) override {}
+		void Reset() { key = 0; recv = 0; }
+
+		std::atomic<AsioNet::NetKey> key = 0;
+		std::atomic<size_t> recv = 0;
+	};
+
+	CountPoller m_svrPoller;
+	CountPoller m_cliPoller;
+	AsioNet::TcpNetMgr m_svrNet;
+	AsioNet::TcpNetMgr m_cliNet;
+
+	size_t m_msgNum;
+	size_t m_msgSize;
+};
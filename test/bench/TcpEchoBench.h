@@ -0,0 +1,129 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include "../../protoc/cpp_all_pb.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// TCP回显压测
+// connNum个连接，每个连接同时只有一个请求在路上，一共收发msgNum个请求
+// 分别用epoll和io_uring(cmake -DASIONET_IO_URING=ON)编译跑一次，对比吞吐和尾延迟
+// 系统调用次数可以配合 strace -c -f 查看
+class TcpEchoBench {
+public:
+	TcpEchoBench(size_t connNum, size_t msgNum, size_t thNum = 4) :
+		m_svrNet(thNum), m_cliNet(thNum), m_connNum(connNum), m_msgNum(msgNum),
+		m_sent(0), m_recv(0)
+	{
+		m_svrEd.AddRouter<EchoRouter, protobuf::DemoPb>(this, MSG_ECHO);
+		m_cliEd.AddRouter<ReplyRouter, protobuf::DemoPb>(this, MSG_ECHO);
+		m_cliEd.RegisterConnectHandler<ConnectHandler>(this);
+	}
+
+	void Run()
+	{
+		m_svrNet.Serve(&m_svrEd, "127.0.0.1", 9999);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+		std::atomic<bool> stop = false;
+		std::thread svrTh([&]() {
+			while (!stop) {
+				if (!m_svrEd.RunOne()) {
+					std::this_thread::yield();
+				}
+			}
+			});
+
+		for (size_t i = 0; i < m_connNum; i++) {
+			m_cliNet.Connect(&m_cliEd, "127.0.0.1", 9999, 3);
+		}
+
+		auto t1 = std::chrono::steady_clock::now();
+		while (m_recv < m_msgNum) {
+			if (!m_cliEd.RunOne()) {
+				std::this_thread::yield();
+			}
+		}
+		auto t2 = std::chrono::steady_clock::now();
+		stop = true;
+		svrTh.join();
+
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+		std::sort(m_latency.begin(), m_latency.end());
+		auto pct = [this](double p) {
+			return m_latency.empty() ? 0 : m_latency[static_cast<size_t>(p * (m_latency.size() - 1))];
+		};
+		std::cout << "conn:" << m_connNum << " msg:" << m_recv
+			<< " cost(ms):" << ms
+			<< " qps:" << (ms ? m_recv * 1000 / ms : 0)
+			<< " p50(us):" << pct(0.5)
+			<< " p99(us):" << pct(0.99)
+			<< " p999(us):" << pct(0.999) << std::endl;
+	}
+
+private:
+	static constexpr uint16_t MSG_ECHO = 1;
+
+	static bool sendPb(AsioNet::TcpNetMgr& net, AsioNet::NetKey key, const protobuf::DemoPb& pb)
+	{
+		char buf[64];
+		AsioNet::AN_MsgHead h{ MSG_ECHO,0 };
+		memcpy(buf, &h, sizeof(h));
+		size_t len = pb.ByteSizeLong();
+		pb.SerializeToArray(buf + sizeof(h), static_cast<int>(sizeof(buf) - sizeof(h)));
+		return net.Send(key, buf, sizeof(h) + len);
+	}
+
+	void sendNext(AsioNet::NetKey key)
+	{
+		if (m_sent >= m_msgNum) {
+			return;
+		}
+		++m_sent;
+		protobuf::DemoPb pb;
+		pb.set_a(static_cast<uint32_t>(m_sent));
+		m_sendTime[key] = std::chrono::steady_clock::now();
+		sendPb(m_cliNet, key, pb);
+	}
+
+	struct ConnectHandler {
+		void operator()(void* b, AsioNet::NetKey key, std::string, uint16_t) {
+			auto bench = static_cast<TcpEchoBench*>(b);
+			bench->sendNext(key);
+		}
+	};
+
+	struct EchoRouter {
+		void operator()(void* b, AsioNet::NetKey key, const protobuf::DemoPb& pb) {
+			auto bench = static_cast<TcpEchoBench*>(b);
+			sendPb(bench->m_svrNet, key, pb);
+		}
+	};
+
+	struct ReplyRouter {
+		void operator()(void* b, AsioNet::NetKey key, const protobuf::DemoPb&) {
+			auto bench = static_cast<TcpEchoBench*>(b);
+			auto cost = std::chrono::steady_clock::now() - bench->m_sendTime[key];
+			bench->m_latency.push_back(static_cast<uint32_t>(
+				std::chrono::duration_cast<std::chrono::microseconds>(cost).count()));
+			++bench->m_recv;
+			bench->sendNext(key);
+		}
+	};
+
+	// io线程会往driver里面push，driver要比netMgr后析构
+	AsioNet::EventDriver m_svrEd;
+	AsioNet::EventDriver m_cliEd;
+	AsioNet::TcpNetMgr m_svrNet;
+	AsioNet::TcpNetMgr m_cliNet;
+
+	size_t m_connNum;
+	size_t m_msgNum;
+	size_t m_sent;
+	size_t m_recv;
+	std::unordered_map<AsioNet::NetKey, std::chrono::steady_clock::time_point> m_sendTime;
+	std::vector<uint32_t> m_latency;
+};
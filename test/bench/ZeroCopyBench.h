@@ -0,0 +1,97 @@
+#pragma once
+
+#include "../../src/AsioNet.h"
+
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// MSG_ZEROCOPY压测
+// 一个连接发totalMB的数据，消息从4KB到60KB，每种大小分别用普通发送和zerocopy跑一次，对比MB/s
+// zerocopy开始比拷贝快的那个大小，就是TcpOption::zeroCopySize该设的值
+// 注意回环地址上内核收包时还是会拷贝一次，这里测出来的是pin内存和完成通知的额外开销
+// 真实的收益要把server放到另一台机器上，走真实网卡测
+class ZeroCopyBench {
+public:
+	ZeroCopyBench(size_t totalMB = 1024, size_t thNum = 2) :
+		m_svrNet(thNum), m_cliNet(thNum), m_total(totalMB * 1024 * 1024)
+	{
+		m_svrNet.Serve(&m_svrPoller, "127.0.0.1", 9997);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	void Run()
+	{
+#ifndef ASIONET_ZEROCOPY
+		std::cout << "MSG_ZEROCOPY is not supported on this platform" << std::endl;
+#else
+		for (size_t size : {4 * 1024, 8 * 1024, 16 * 1024, 32 * 1024, 60 * 1024}) {
+			run(size, false);
+			run(size, true);
+		}
+#endif
+	}
+
+private:
+	void run(size_t msgSize, bool zeroCopy)
+	{
+		m_svrPoller.Reset();
+		m_cliPoller.Reset();
+
+		AsioNet::TcpOption opt;
+		opt.zeroCopySize = zeroCopy ? 1 : 0;
+		m_cliNet.Connect(&m_cliPoller, "127.0.0.1", 9997, 3, opt);
+		while (!m_cliPoller.key || !m_svrPoller.key) {
+			std::this_thread::yield();
+		}
+		AsioNet::NetKey key = m_cliPoller.key;
+
+		std::vector<char> msg(msgSize, 'a');
+		AsioNet::AN_MsgHead h{ 1,0 };
+		memcpy(msg.data(), &h, sizeof(h));
+
+		size_t msgNum = m_total / msgSize;
+		auto t1 = std::chrono::steady_clock::now();
+		for (size_t n = 0; n < msgNum; n++) {
+			// 发送队列不要堆太多，测的是发送路径而不是内存分配
+			while (m_cliNet.SendQueueSize(key) > 4 * 1024 * 1024) {
+				std::this_thread::yield();
+			}
+			m_cliNet.Send(key, msg.data(), msg.size());
+		}
+		while (m_svrPoller.recv < msgNum) {
+			std::this_thread::yield();
+		}
+		auto t2 = std::chrono::steady_clock::now();
+
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+		std::cout << "size:" << msgSize << (zeroCopy ? " zerocopy" : " copy    ")
+			<< " msg:" << msgNum
+			<< " cost(ms):" << ms
+			<< " MB/s:" << (ms ? msgNum * msgSize / 1024 / 1024 * 1000 / ms : 0) << std::endl;
+
+		m_cliNet.Disconnect(key);
+		m_svrNet.Disconnect(m_svrPoller.key);
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	// 只计数，不走EventDriver
+	struct CountPoller : public AsioNet::IEventPoller {
+		void PushAccept(AsioNet::NetKey k, const std::string&, uint16_t) override { key = k; }
+		void PushConnect(AsioNet::NetKey k, const std::string&, uint16_t) override { key = k; }
+		void PushDisconnect(AsioNet::NetKey, const std::string&, uint16_t) override {}
+		void PushRecv(AsioNet::NetKey, const char*, size_t) override { ++recv; }
+		void PushError(AsioNet::NetKey, AsioNet::EventErrCode) override {}
+		void Reset() { key = 0; recv = 0; }
+
+		std::atomic<AsioNet::NetKey> key = 0;
+		std::atomic<size_t> recv = 0;
+	};
+
+	CountPoller m_svrPoller;
+	CountPoller m_cliPoller;
+	AsioNet::TcpNetMgr m_svrNet;
+	AsioNet::TcpNetMgr m_cliNet;
+
+	size_t m_total;
+};
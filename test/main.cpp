@@ -1,10 +1,42 @@
 #include "./server/TestServer.h"
 #include "./client/TestClient.h"
+#include "./bench/TcpEchoBench.h"
+#include "./bench/SendQueueBench.h"
+#include "./bench/CompressBench.h"
+#include "./bench/ZeroCopyBench.h"
+#include "./bench/KcpOffloadBench.h"
+#include "./bench/KcpReusePortBench.h"
+#include "./bench/FecBench.h"
+#include "./bench/KcpTunerBench.h"
+#include "./bench/KcpAllocBench.h"
+#include "./bench/RecvLimitTest.h"
 
 int main()
 {
 	//TestClient c;
 	//c.Update();
+	//TcpEchoBench b(1000, 1000000);
+	//b.Run();
+	//SendQueueBench sq(1000000);
+	//sq.Run(1);
+	//sq.Run(4);
+	//sq.Run(16);
+	//CompressBench cb;
+	//cb.Run();
+	//ZeroCopyBench zb;
+	//zb.Run();
+	//KcpOffloadBench kb;
+	//kb.Run();
+	//KcpReusePortBench rb;
+	//rb.Run();
+	//FecBench fb;
+	//fb.Run();
+	//KcpTunerBench tb;
+	//tb.Run();
+	//KcpAllocBench ab;
+	//ab.Run(false);
+	//RecvLimitTest rt;
+	//rt.Run();
 	TestServer s;
 	s.Update();
 	